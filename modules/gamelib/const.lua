@@ -238,6 +238,7 @@ PathFindFlags = {
   AllowCreatures = 2,
   AllowNonPathable = 4,
   AllowNonWalkable = 8,
+  Hierarchical = 16,
 }
 
 VipState = {
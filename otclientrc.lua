@@ -9,93 +9,59 @@ local clientVersion = 123
 local otbPath = ''
 local mapPath = ''
 
-local areaSizeY = 25
 local areaSizeX = 25
 local isGenerating = false
 local startTime = 0
-local threadsToRun = 1
-local areasList = {}
-local areasIds = {}
-local currentArea = 0
 local lastPrintStatus = os.time()
+local isLoading = false
+local pendingGenerate = nil
+local generateJob = nil
 
 -- ex. prepareClient(1076, '/things/1076/items.otb', '/map.otbm')
 function prepareClient(cv, op, mp)
 	clientVersion = cv
 	otbPath = op
 	mapPath = mp
-	g_logger.info("Loading client data... (it will freez client for FEEEEW seconds)")
-	g_dispatcher.scheduleEvent(prepareClient_action, 1000)
+	g_logger.info("Loading client data...")
+	isLoading = true
+	g_dispatcher.addEvent(prepareClient_action)
 end
 
 function prepareClient_action()
 	g_map.initializeMapGenerator();
 	g_logger.info("Loading client Tibia.dat and Tibia.spr...")
 	g_game.setClientVersion(clientVersion)
+	-- items.otb and the map are loaded in background, one after another
 	g_logger.info("Loading server items.otb...")
-	g_things.loadOtb(otbPath)
-	g_logger.info("Loading server map...")
-	g_map.loadOtbm(mapPath)
-	g_logger.info("Loaded client data")
-end
-
-function threadsManager()
-	local threadsRunning = 0
-	local allFinished = true
-	for threadId = 0, threadsToRun - 1 do
-		if g_map.isThreadRunning(threadId) then
-			threadsRunning = threadsRunning + 1
-			allFinished = false
-		end
-	end
-	if currentArea == #areasList then
-		if allFinished then
-			isGenerating = false
-			print('Map image generation finished.')
-			print(currentArea .. ' areas generated [each up to ' .. (areaSizeX*areaSizeY) .. ' images] in ' .. (os.time() - startTime) .. ' seconds.')
-			return
+	g_things.loadOtbAsync(otbPath).onComplete = function(job, succeeded, err)
+		if succeeded then
+			g_logger.info("Loading server map...")
 		end
 	end
-	if lastPrintStatus ~= os.time() then
-		print(currentArea .. ' of ' .. #areasList .. ' generated or are being generated right now, ' .. threadsRunning .. ' threads are generating')
-		lastPrintStatus = os.time()
-	end
-	
-	-- there is no more areas to generate and we are just waiting for all threads to finish
-	if currentArea < #areasList then
-		for threadId = 0, threadsToRun - 1 do
-			if currentArea == #areasList then
-				break
-			end
-			if not g_map.isThreadRunning(threadId) then
-				currentArea = currentArea + 1
-				local areaId = areasIds[currentArea]
-				local area = areasList[areaId]
-				-- start new thread with given area
-				g_map.startThread(threadId, area[1], area[2], area[3], area[4], area[5], area[6])
+	g_map.loadOtbmAsync(mapPath).onComplete = function(job, succeeded, err)
+		isLoading = false
+		if succeeded then
+			g_logger.info("Loaded client data in " .. job:getElapsedMillis() .. " ms")
+			if pendingGenerate then
+				generateMap(unpack(pendingGenerate))
 			end
+		else
+			g_logger.error("Failed to load client data: " .. err)
 		end
+		pendingGenerate = nil
 	end
-	g_dispatcher.scheduleEvent(threadsManager, 10)
 end
 
-function generateMap(minX, minY, minZ, maxX, maxY, maxZ, threadsCount, customCurrentArea)
+function generateMap(minX, minY, minZ, maxX, maxY, maxZ, threadsCount)
 	if isGenerating then
 		print('Generating script is already running.')
 		return
 	end
-	isGenerating = true
-	areasList = {}
-	currentArea = 0
-	if customCurrentArea then
-		currentArea = customCurrentArea
-	end
-	-- threads number limit is set in engine in file 'mapio.cpp' in line: #define THREADS_NUMBER 128
-	if(threadsCount > 128) then
-		g_logger.debug('Notice: You tried to run ' .. threadsCount .. ' threads, but threads number limit is 128.')
-		threadsCount = 128
+	-- typed in the same line as prepareClient, start when the map is loaded
+	if isLoading then
+		pendingGenerate = {minX, minY, minZ, maxX, maxY, maxZ, threadsCount}
+		return
 	end
-	threadsToRun = threadsCount
 
 	-- block invalid values
 	minX = math.max(0, minX)
@@ -104,40 +70,91 @@ function generateMap(minX, minY, minZ, maxX, maxY, maxZ, threadsCount, customCur
 
 	maxX = math.min(g_map.getSize().width, maxX)
 	maxY = math.min(g_map.getSize().height, maxY)
-	maxZ = math.min(16, maxZ) -- more then 16 floors? idk if it's possible
+	maxZ = math.min(15, maxZ)
 
-	print('Generating areas list for tile positons: min{x=' .. minX .. ', y=' .. minY .. ', z=' .. minZ .. '} , max{x=' .. maxX .. ', y=' .. maxY .. ', z=' .. maxZ .. '}')
-	-- change to 8x8 tiles 
-	minX = math.floor(minX / 8)
-	minY = math.floor(minY / 8)
-	maxX = math.floor(maxX / 8) + 1
-	maxY = math.floor(maxY / 8) + 1
-	for z = minZ, maxZ do
-		local startX = minX
-		local endX = minX + areaSizeX
-		while(startX < maxX) do
-			local startY = minY
-			local endY = minY + areaSizeY
-			while(startY < maxY) do
-				-- 1 floor, areaSizeY x areaSizeY 'areas' (each 8x8 tiles), up to 400 images to generate [no tiles in area = no image]
-				table.insert(areasList, {startX, startY, z, endX, endY, z})
-				--print(startX, startY, z, endX, endY, z)
-				startY = endY + 1
-				endY = endY + areaSizeY
-			end
-			startX = endX + 1
-			endX = endX + areaSizeX
+	print('Generating images for tile positons: min{x=' .. minX .. ', y=' .. minY .. ', z=' .. minZ .. '} , max{x=' .. maxX .. ', y=' .. maxY .. ', z=' .. maxZ .. '}')
+	isGenerating = true
+	startTime = os.time()
+	local job = g_map.renderAsync(minX, minY, minZ, maxX, maxY, maxZ, threadsCount)
+	generateJob = job
+	job.onProgress = function(job, done, total)
+		if lastPrintStatus ~= os.time() then
+			print(done .. ' of ' .. total .. ' images generated')
+			lastPrintStatus = os.time()
 		end
 	end
-	-- we need some pseudo random order of areas generated to reduce chance of client crash
-	for i = 1, 7 do
-		local x = i
-		while x <= #areasList do
-			table.insert(areasIds, x)
-			x = x + 7
+	job.onComplete = function(job, succeeded, err)
+		isGenerating = false
+		generateJob = nil
+		if succeeded then
+			print('Map image generation finished.')
+			print(job:getTotal() .. ' areas (8x8 tiles) generated in ' .. (os.time() - startTime) .. ' seconds.')
+		else
+			print('Map image generation stopped after ' .. job:getDone() .. ' of ' .. job:getTotal() .. ' areas: ' .. err)
 		end
 	end
-	print('Generated list of ' .. #areasList .. ' areas. ' .. threadsCount .. ' threads will generate it now. Please wait.')
+	return job
+end
+
+-- pauseMap() lets the server breathe during peak hours, stopMap() finishes images being rendered,
+-- saves them and exits generation, areas already done are skipped by the next generateMap
+function pauseMap()
+	if generateJob then
+		generateJob:pause()
+		print('Map image generation paused, ' .. generateJob:getDone() .. ' of ' .. generateJob:getTotal() .. ' images generated.')
+	end
+end
+
+function resumeMap()
+	if generateJob then
+		generateJob:resume()
+		print('Map image generation resumed.')
+	end
+end
+
+function stopMap()
+	if generateJob then
+		generateJob:cancel()
+		print('Stopping map image generation...')
+	end
+end
+
+-- sharded rendering, state is kept in a job directory so it can be resumed after crash
+-- and shared by many clients (also on other machines when directory is on shared disk)
+-- ex. planMapJob('mapjob', 25, 45, 0, 555, 699, 15) and then in every client: runMapJob('mapjob', 4)
+function planMapJob(dir, minX, minY, minZ, maxX, maxY, maxZ, shardSize)
+	shardSize = shardSize or areaSizeX
+	maxX = math.min(g_map.getSize().width, maxX)
+	maxY = math.min(g_map.getSize().height, maxY)
+	return g_map.planRenderJob(dir, math.max(0, minX), math.max(0, minY), math.max(0, minZ), maxX, maxY, math.min(15, maxZ), shardSize)
+end
+
+function runMapJob(dir, threadsCount)
+	if isGenerating then
+		print('Generating script is already running.')
+		return
+	end
+	local job = g_map.startRenderJob(dir, threadsCount or 1)
+	if not job then
+		return
+	end
+	isGenerating = true
 	startTime = os.time()
-	g_dispatcher.scheduleEvent(threadsManager, 1000)
+	generateJob = job
+	job.onProgress = function(job, done, total)
+		if lastPrintStatus ~= os.time() then
+			print(done .. ' of ' .. total .. ' shards done')
+			lastPrintStatus = os.time()
+		end
+	end
+	job.onComplete = function(job, succeeded, err)
+		isGenerating = false
+		generateJob = nil
+		if succeeded then
+			print('Render job finished, ' .. job:getDone() .. ' of ' .. job:getTotal() .. ' shards done in ' .. (os.time() - startTime) .. ' seconds.')
+		else
+			print('Render job stopped, ' .. job:getDone() .. ' of ' .. job:getTotal() .. ' shards done: ' .. err)
+		end
+	end
+	return job
 end
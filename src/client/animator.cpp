@@ -166,6 +166,14 @@ int Animator::getLoopPhase()
     return m_phase;
 }
 
+int Animator::getAverageDuration(int phase)
+{
+    assert(phase < (int)m_phaseDurations.size());
+
+    std::tuple<int, int> data = m_phaseDurations.at(phase);
+    return (std::get<0>(data) + std::get<1>(data)) / 2;
+}
+
 int Animator::getPhaseDuration(int phase)
 {
     assert(phase < (int)m_phaseDurations.size());
@@ -52,6 +52,7 @@ public:
     int getPhase();
 
     int getStartPhase();
+    int getAverageDuration(int phase);
     int getAnimationPhases() { return m_animationPhases; }
     bool isAsync() { return m_async; }
     bool isComplete() { return m_isComplete; }
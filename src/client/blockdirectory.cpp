@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "blockdirectory.h"
+#include <framework/core/filestream.h>
+#include <zlib.h>
+
+void BlockDirectory::write(const FileStreamPtr& fin, std::vector<DirectoryBlock>& blocks, int level)
+{
+    parallelFor(blocks.size(), [&](size_t i) {
+        DirectoryBlock& block = blocks[i];
+        std::string compressed(compressBound(block.data.size()), '\0');
+        ulong len = compressed.size();
+        if(compress2((uchar*)&compressed[0], &len, (const uchar*)block.data.data(), block.data.size(), level) != Z_OK)
+            len = 0;
+        compressed.resize(len);
+        block.rawSize = block.data.size();
+        block.data.swap(compressed);
+    });
+
+    const uint32 entrySize = 2 + 2 + 1 + 4 + 4 + 4;
+    uint32 offset = fin->tell() + 4 + blocks.size() * entrySize;
+    fin->addU32(blocks.size());
+    for(DirectoryBlock& block : blocks) {
+        if(block.data.empty() && block.rawSize > 0)
+            stdext::throw_exception("block compression failed");
+
+        block.offset = offset;
+        block.compressedSize = block.data.size();
+        offset += block.compressedSize;
+
+        fin->addU16(block.pos.x);
+        fin->addU16(block.pos.y);
+        fin->addU8(block.pos.z);
+        fin->addU32(block.offset);
+        fin->addU32(block.compressedSize);
+        fin->addU32(block.rawSize);
+    }
+    for(const DirectoryBlock& block : blocks)
+        fin->write(block.data.data(), block.data.size());
+}
+
+std::vector<DirectoryBlock> BlockDirectory::read(const FileStreamPtr& fin)
+{
+    uint32 count = fin->getU32();
+    std::vector<DirectoryBlock> blocks(count);
+    for(DirectoryBlock& block : blocks) {
+        block.pos.x = fin->getU16();
+        block.pos.y = fin->getU16();
+        block.pos.z = fin->getU8();
+        block.offset = fin->getU32();
+        block.compressedSize = fin->getU32();
+        block.rawSize = fin->getU32();
+        if(!block.pos.isValid())
+            stdext::throw_exception("corrupted block directory");
+    }
+    return blocks;
+}
+
+void BlockDirectory::load(const FileStreamPtr& fin, std::vector<DirectoryBlock>& blocks)
+{
+    // reading stays sequential, blocks are sorted by offset so the file is read forward
+    std::sort(blocks.begin(), blocks.end(), [](const DirectoryBlock& a, const DirectoryBlock& b) { return a.offset < b.offset; });
+    for(DirectoryBlock& block : blocks) {
+        block.data.resize(block.compressedSize);
+        fin->seek(block.offset);
+        if(block.compressedSize > 0 && fin->read(&block.data[0], block.compressedSize) != 1)
+            stdext::throw_exception("unable to read block");
+    }
+
+    std::atomic<bool> failed(false);
+    parallelFor(blocks.size(), [&](size_t i) {
+        DirectoryBlock& block = blocks[i];
+        std::string raw(block.rawSize, '\0');
+        ulong len = block.rawSize;
+        if(block.rawSize > 0 && (uncompress((uchar*)&raw[0], &len, (const uchar*)block.data.data(), block.data.size()) != Z_OK || len != block.rawSize))
+            failed = true;
+        block.data.swap(raw);
+    });
+    if(failed)
+        stdext::throw_exception("corrupted block");
+}
+
+void BlockDirectory::parallelFor(size_t count, const std::function<void(size_t)>& function)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        size_t i;
+        while((i = next.fetch_add(1)) < count)
+            function(i);
+    };
+
+    size_t threads = std::min<size_t>(std::max<size_t>(std::thread::hardware_concurrency(), 1), count);
+    std::vector<std::thread> workers;
+    for(size_t t = 1; t < threads; ++t)
+        workers.emplace_back(worker);
+    worker();
+    for(std::thread& thread : workers)
+        thread.join();
+}
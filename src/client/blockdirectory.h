@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef BLOCKDIRECTORY_H
+#define BLOCKDIRECTORY_H
+
+#include "declarations.h"
+#include "position.h"
+#include <framework/core/declarations.h>
+
+struct DirectoryBlock {
+    DirectoryBlock() : offset(0), compressedSize(0), rawSize(0) { }
+    Position pos;
+    uint32 offset;
+    uint32 compressedSize;
+    uint32 rawSize;
+    std::string data;
+};
+
+// Version 2 layout shared by OTCM and OTMM files: a block count, a directory of
+// (x, y, z, offset, compressed size, raw size) and the zlib compressed blocks, so
+// blocks are (de)compressed in parallel and regions are read without the whole file.
+class BlockDirectory
+{
+public:
+    // compresses the data of every block and writes directory and blocks at the current position
+    static void write(const FileStreamPtr& fin, std::vector<DirectoryBlock>& blocks, int level);
+    static std::vector<DirectoryBlock> read(const FileStreamPtr& fin);
+    // reads and decompresses the data of the given directory blocks
+    static void load(const FileStreamPtr& fin, std::vector<DirectoryBlock>& blocks);
+
+    static void parallelFor(size_t count, const std::function<void(size_t)>& function);
+};
+
+#endif
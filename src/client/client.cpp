@@ -29,6 +29,7 @@
 #include "shadermanager.h"
 #include "spritemanager.h"
 #include "minimap.h"
+#include "tileserver.h"
 #include <framework/core/configmanager.h>
 
 Client g_client;
@@ -85,6 +86,7 @@ void Client::terminate()
 {
     g_creatures.terminate();
     g_game.terminate();
+    g_tileServer.stop();
     g_map.terminate();
     g_minimap.terminate();
     g_things.terminate();
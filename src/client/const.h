@@ -419,7 +419,8 @@ namespace Otc
         PathFindAllowNotSeenTiles = 1,
         PathFindAllowCreatures = 2,
         PathFindAllowNonPathable = 4,
-        PathFindAllowNonWalkable = 8
+        PathFindAllowNonWalkable = 8,
+        PathFindHierarchical = 16
     };
 
     enum AutomapFlags {
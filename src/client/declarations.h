@@ -53,6 +53,8 @@ class Town;
 class CreatureType;
 class Spawn;
 class TileBlock;
+class MapJob;
+struct MapJobState;
 
 typedef stdext::shared_object_ptr<MapView> MapViewPtr;
 typedef stdext::shared_object_ptr<LightView> LightViewPtr;
@@ -76,6 +78,8 @@ typedef stdext::shared_object_ptr<House> HousePtr;
 typedef stdext::shared_object_ptr<Town> TownPtr;
 typedef stdext::shared_object_ptr<CreatureType> CreatureTypePtr;
 typedef stdext::shared_object_ptr<Spawn> SpawnPtr;
+typedef stdext::shared_object_ptr<MapJob> MapJobPtr;
+typedef std::shared_ptr<MapJobState> MapJobStatePtr;
 
 typedef std::vector<ThingPtr> ThingList;
 typedef std::vector<ThingTypePtr> ThingTypeList;
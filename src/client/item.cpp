@@ -37,6 +37,8 @@
 #include <framework/core/filestream.h>
 #include <framework/core/binarytree.h>
 
+ObjectArena Item::s_arena(sizeof(Item));
+
 Item::Item() :
     m_clientId(0),
     m_serverId(0),
@@ -90,7 +92,7 @@ void Item::draw(const Point& dest, float scaleFactor, bool animate, LightView *l
         g_painter->resetColor();
 }
 
-void Item::drawToImage(Point dest, ImagePtr image)
+void Item::drawToImage(Point dest, ImagePtr image, int animationTicks)
 {
     if(m_clientId == 0)
         return;
@@ -98,7 +100,8 @@ void Item::drawToImage(Point dest, ImagePtr image)
     int xPattern = 0, yPattern = 0, zPattern = 0;
     calculatePatterns(xPattern, yPattern, zPattern);
 
-    rawGetThingType()->drawToImage(dest, xPattern, yPattern, zPattern, image);
+    ThingType *thingType = rawGetThingType();
+    thingType->drawToImage(dest, xPattern, yPattern, zPattern, image, thingType->getAnimationPhaseAt(animationTicks));
 }
 
 void Item::setId(uint32 id)
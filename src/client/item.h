@@ -28,6 +28,7 @@
 #include "thing.h"
 #include "effect.h"
 #include "itemtype.h"
+#include "objectarena.h"
 
 enum ItemAttr : uint8
 {
@@ -79,11 +80,15 @@ public:
     Item();
     virtual ~Item() { }
 
+    static void *operator new(size_t size) { return s_arena.allocate(size); }
+    static void operator delete(void *p) { ObjectArena::deallocate(p); }
+    static ObjectArena& getArena() { return s_arena; }
+
     static ItemPtr create(int id);
     static ItemPtr createFromOtb(int id);
 
     void draw(const Point& dest, float scaleFactor, bool animate, LightView *lightView = nullptr);
-    void drawToImage(Point dest, ImagePtr image);
+    void drawToImage(Point dest, ImagePtr image, int animationTicks = 0);
 
     void setId(uint32 id);
     void setOtbId(uint16 id);
@@ -162,6 +167,8 @@ private:
 
     uint8 m_phase;
     ticks_t m_lastPhase;
+
+    static ObjectArena s_arena;
 };
 
 #pragma pack(pop)
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "itemindex.h"
+
+void ItemIndex::add(uint16 clientId, const Position& pos)
+{
+    PositionList& list = m_lists[getListKey(clientId, pos.z)];
+    uint32 packed = packPosition(pos);
+    // items are loaded area by area, so most lists stay sorted while appending
+    if(list.sorted && !list.positions.empty() && list.positions.back() > packed)
+        list.sorted = false;
+    list.positions.push_back(packed);
+}
+
+void ItemIndex::remove(uint16 clientId, const Position& pos)
+{
+    auto it = m_lists.find(getListKey(clientId, pos.z));
+    if(it == m_lists.end())
+        return;
+
+    PositionList& list = it->second;
+    sort(list);
+    auto position = std::lower_bound(list.positions.begin(), list.positions.end(), packPosition(pos));
+    if(position == list.positions.end() || *position != packPosition(pos))
+        return;
+
+    list.positions.erase(position);
+    if(list.positions.empty())
+        m_lists.erase(it);
+}
+
+std::vector<Position> ItemIndex::find(uint16 clientId)
+{
+    std::vector<Position> ret;
+    for(int z = 0; z <= Otc::MAX_Z; ++z) {
+        auto it = m_lists.find(getListKey(clientId, z));
+        if(it == m_lists.end())
+            continue;
+
+        PositionList& list = it->second;
+        sort(list);
+        uint32 last = 0;
+        for(size_t i = 0; i < list.positions.size(); ++i) {
+            uint32 packed = list.positions[i];
+            if(i > 0 && packed == last)
+                continue;
+            ret.push_back(Position(packed & 0xFFFF, packed >> 16, z));
+            last = packed;
+        }
+    }
+    return ret;
+}
+
+size_t ItemIndex::getMemoryUsage()
+{
+    size_t usage = m_lists.bucket_count() * sizeof(void*);
+    for(const auto& it : m_lists)
+        usage += sizeof(void*) + sizeof(it) + it.second.positions.capacity() * sizeof(uint32);
+    return usage;
+}
+
+void ItemIndex::sort(PositionList& list)
+{
+    if(list.sorted)
+        return;
+    std::sort(list.positions.begin(), list.positions.end());
+    list.sorted = true;
+}
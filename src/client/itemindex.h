@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef ITEMINDEX_H
+#define ITEMINDEX_H
+
+#include "declarations.h"
+#include "position.h"
+
+// Positions of every item of the map by client id. Positions are packed to 32 bits
+// (y << 16 | x) in one list per id and floor, an item stacked twice on a tile is
+// listed twice. Entries are not checked against tiles, callers must verify them.
+class ItemIndex
+{
+public:
+    void add(uint16 clientId, const Position& pos);
+    void remove(uint16 clientId, const Position& pos);
+    void clear() { m_lists.clear(); }
+
+    // positions sorted by floor, y and x, without duplicates
+    std::vector<Position> find(uint16 clientId);
+    size_t getMemoryUsage();
+
+private:
+    struct PositionList {
+        PositionList() : sorted(true) { }
+        std::vector<uint32> positions;
+        bool sorted;
+    };
+
+    static uint32 getListKey(uint16 clientId, int z) { return ((uint32)clientId << 4) | z; }
+    static uint32 packPosition(const Position& pos) { return ((uint32)pos.y << 16) | pos.x; }
+    void sort(PositionList& list);
+
+    std::unordered_map<uint32, PositionList> m_lists;
+};
+
+#endif
@@ -41,7 +41,6 @@ void ItemType::unserialize(const BinaryTreePtr& node)
 
     node->getU32(); // flags
 
-    static uint16 lastId = 99;
     while(node->canRead()) {
         uint8 attr = node->getU8();
         if(attr == 0 || attr == 0xFF)
@@ -49,33 +48,10 @@ void ItemType::unserialize(const BinaryTreePtr& node)
 
         uint16 len = node->getU16();
         switch(attr) {
-            case ItemTypeAttrServerId: {
-                uint16 serverId = node->getU16();
-                if(g_game.getClientVersion() < 960) {
-                    if(serverId > 20000 && serverId < 20100) {
-                        serverId -= 20000;
-                    } else if(lastId > 99 && lastId != serverId - 1) {
-                        while(lastId != serverId - 1) {
-                            ItemTypePtr tmp(new ItemType);
-                            tmp->setServerId(lastId++);
-                            g_things.addItemType(tmp);
-                        }
-                    }
-                } else {
-                    if(serverId > 30000 && serverId < 30100) {
-                        serverId -= 30000;
-                    } else if(lastId > 99 && lastId != serverId - 1) {
-                        while(lastId != serverId - 1) {
-                            ItemTypePtr tmp(new ItemType);
-                            tmp->setServerId(lastId++);
-                            g_things.addItemType(tmp);
-                        }
-                    }
-                }
-                setServerId(serverId);
-                lastId = serverId;
+            // remapped by ThingTypeManager::loadOtb, which sees all types in order
+            case ItemTypeAttrServerId:
+                setServerId(node->getU16());
                 break;
-            }
             case ItemTypeAttrClientId:
                 setClientId(node->getU16());
                 break;
@@ -91,3 +67,28 @@ void ItemType::unserialize(const BinaryTreePtr& node)
         }
     }
 }
+
+void ItemType::serializeCache(const FileStreamPtr& fout)
+{
+    fout->addU8((m_null ? 1 : 0) | (isWritable() ? 2 : 0));
+    fout->addU8(m_category);
+    fout->addU16(getServerId());
+    fout->addU16(getClientId());
+    fout->addString(getName());
+}
+
+void ItemType::unserializeCache(const FileStreamPtr& fin)
+{
+    uint8 flags = fin->getU8();
+    m_null = (flags & 1) != 0;
+    if(flags & 2)
+        m_attribs.set(ItemTypeAttrWritable, true);
+    m_category = (ItemCategory)fin->getU8();
+    setServerId(fin->getU16());
+    uint16 clientId = fin->getU16();
+    if(clientId)
+        setClientId(clientId);
+    std::string name = fin->getString();
+    if(!name.empty())
+        setName(name);
+}
@@ -133,6 +133,9 @@ public:
     ItemType();
 
     void unserialize(const BinaryTreePtr& node);
+    // fields kept from the otb, for the cache of ThingTypeManager::loadOtb
+    void serializeCache(const FileStreamPtr& fout);
+    void unserializeCache(const FileStreamPtr& fin);
 
     void setServerId(uint16 serverId) { m_attribs.set(ItemTypeAttrServerId, serverId); }
     uint16 getServerId() { return m_attribs.get<uint16>(ItemTypeAttrServerId); }
@@ -27,11 +27,6 @@
 #include <framework/graphics/painter.h>
 #include <framework/graphics/image.h>
 
-enum {
-    MAX_LIGHT_INTENSITY = 8,
-    MAX_AMBIENT_LIGHT_INTENSITY = 255
-};
-
 LightView::LightView()
 {
     m_lightbuffer = g_framebuffers.createFrameBuffer();
@@ -43,17 +38,13 @@ LightView::LightView()
 TexturePtr LightView::generateLightBubble(float centerFactor)
 {
     int bubbleRadius = 256;
-    int centerRadius = bubbleRadius * centerFactor;
     int bubbleDiameter = bubbleRadius * 2;
     ImagePtr lightImage = ImagePtr(new Image(Size(bubbleDiameter, bubbleDiameter)));
 
     for(int x = 0; x < bubbleDiameter; x++) {
         for(int y = 0; y < bubbleDiameter; y++) {
             float radius = std::sqrt((bubbleRadius - x)*(bubbleRadius - x) + (bubbleRadius - y)*(bubbleRadius - y));
-            float intensity = stdext::clamp<float>((bubbleRadius - radius) / (float)(bubbleRadius - centerRadius), 0.0f, 1.0f);
-
-            // light intensity varies inversely with the square of the distance
-            intensity = intensity * intensity;
+            float intensity = getBubbleIntensity(radius, bubbleRadius, centerFactor);
             uint8_t colorByte = intensity * 0xff;
 
             uint8_t pixel[4] = {colorByte,colorByte,colorByte,0xff};
@@ -66,6 +57,15 @@ TexturePtr LightView::generateLightBubble(float centerFactor)
     return tex;
 }
 
+float LightView::getBubbleIntensity(float radius, float bubbleRadius, float centerFactor)
+{
+    int centerRadius = bubbleRadius * centerFactor;
+    float intensity = stdext::clamp<float>((bubbleRadius - radius) / (float)(bubbleRadius - centerRadius), 0.0f, 1.0f);
+
+    // light intensity varies inversely with the square of the distance
+    return intensity * intensity;
+}
+
 void LightView::reset()
 {
     m_lightMap.clear();
@@ -80,13 +80,7 @@ void LightView::addLightSource(const Point& center, float scaleFactor, const Lig
 {
     int intensity = std::min<int>(light.intensity, MAX_LIGHT_INTENSITY);
     int radius = intensity * Otc::TILE_PIXELS * scaleFactor;
-
-    Color color = Color::from8bit(light.color);
-    float brightness = 0.5f + (intensity/(float)MAX_LIGHT_INTENSITY)*0.5f;
-
-    color.setRed(color.rF() * brightness);
-    color.setGreen(color.gF() * brightness);
-    color.setBlue(color.bF() * brightness);
+    Color color = getSourceColor(light);
 
     if(m_blendEquation == Painter::BlendEquation_Add && m_lightMap.size() > 0) {
         LightSource prevSource = m_lightMap.back();
@@ -101,13 +95,31 @@ void LightView::addLightSource(const Point& center, float scaleFactor, const Lig
     m_lightMap.push_back(source);
 }
 
-void LightView::drawGlobalLight(const Light& light)
+Color LightView::getSourceColor(const Light& light)
+{
+    int intensity = std::min<int>(light.intensity, MAX_LIGHT_INTENSITY);
+    Color color = Color::from8bit(light.color);
+    float brightness = 0.5f + (intensity/(float)MAX_LIGHT_INTENSITY)*0.5f;
+
+    color.setRed(color.rF() * brightness);
+    color.setGreen(color.gF() * brightness);
+    color.setBlue(color.bF() * brightness);
+    return color;
+}
+
+Color LightView::getGlobalLightColor(const Light& light)
 {
     Color color = Color::from8bit(light.color);
     float brightness = light.intensity / (float)MAX_AMBIENT_LIGHT_INTENSITY;
     color.setRed(color.rF() * brightness);
     color.setGreen(color.gF() * brightness);
     color.setBlue(color.bF() * brightness);
+    return color;
+}
+
+void LightView::drawGlobalLight(const Light& light)
+{
+    Color color = getGlobalLightColor(light);
     g_painter->setColor(color);
     g_painter->drawFilledRect(Rect(0,0,m_lightbuffer->getSize()));
 }
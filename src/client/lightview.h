@@ -28,6 +28,11 @@
 #include <framework/graphics/painter.h>
 #include "thingtype.h"
 
+enum {
+    MAX_LIGHT_INTENSITY = 8,
+    MAX_AMBIENT_LIGHT_INTENSITY = 255
+};
+
 struct LightSource {
     Color color;
     Point center;
@@ -47,6 +52,10 @@ public:
 
     void setBlendEquation(Painter::BlendEquation blendEquation) { m_blendEquation = blendEquation; }
 
+    static float getBubbleIntensity(float radius, float bubbleRadius, float centerFactor);
+    static Color getSourceColor(const Light& light);
+    static Color getGlobalLightColor(const Light& light);
+
 private:
     void drawGlobalLight(const Light& light);
     void drawLightSource(const Point& center, const Color& color, int radius);
@@ -37,6 +37,8 @@
 #include "localplayer.h"
 #include "map.h"
 #include "minimap.h"
+#include "tileserver.h"
+#include "mapjob.h"
 #include "thingtypemanager.h"
 #include "spritemanager.h"
 #include "shadermanager.h"
@@ -58,6 +60,9 @@ void Client::registerLuaFunctions()
     g_lua.bindSingletonFunction("g_things", "loadDat", &ThingTypeManager::loadDat, &g_things);
     g_lua.bindSingletonFunction("g_things", "saveDat", &ThingTypeManager::saveDat, &g_things);
     g_lua.bindSingletonFunction("g_things", "loadOtb", &ThingTypeManager::loadOtb, &g_things);
+    g_lua.bindSingletonFunction("g_things", "loadOtbAsync", &ThingTypeManager::loadOtbAsync, &g_things);
+    g_lua.bindSingletonFunction("g_things", "setOtbCacheEnabled", &ThingTypeManager::setOtbCacheEnabled, &g_things);
+    g_lua.bindSingletonFunction("g_things", "isOtbCacheEnabled", &ThingTypeManager::isOtbCacheEnabled, &g_things);
     g_lua.bindSingletonFunction("g_things", "loadXml", &ThingTypeManager::loadXml, &g_things);
     g_lua.bindSingletonFunction("g_things", "loadOtml", &ThingTypeManager::loadOtml, &g_things);
     g_lua.bindSingletonFunction("g_things", "isDatLoaded", &ThingTypeManager::isDatLoaded, &g_things);
@@ -101,12 +106,34 @@ void Client::registerLuaFunctions()
     g_lua.bindSingletonFunction("g_sprites", "isLoaded", &SpriteManager::isLoaded, &g_sprites);
     g_lua.bindSingletonFunction("g_sprites", "getSprSignature", &SpriteManager::getSignature, &g_sprites);
     g_lua.bindSingletonFunction("g_sprites", "getSpritesCount", &SpriteManager::getSpritesCount, &g_sprites);
+    g_lua.bindSingletonFunction("g_sprites", "setNumaReplication", &SpriteManager::setNumaReplication, &g_sprites);
+    g_lua.bindSingletonFunction("g_sprites", "isNumaReplication", &SpriteManager::isNumaReplication, &g_sprites);
 
     g_lua.registerSingletonClass("g_map");
     g_lua.bindSingletonFunction("g_map", "initializeMapGenerator", &Map::initializeMapGenerator, &g_map);
     g_lua.bindSingletonFunction("g_map", "isThreadRunning", &Map::isThreadRunning, &g_map);
     g_lua.bindSingletonFunction("g_map", "startThread", &Map::startThread, &g_map);
+    g_lua.bindSingletonFunction("g_map", "stopMapGenerator", &Map::stopMapGenerator, &g_map);
+    g_lua.bindSingletonFunction("g_map", "setWorkerAffinity", &Map::setWorkerAffinity, &g_map);
+    g_lua.bindSingletonFunction("g_map", "isWorkerAffinity", &Map::isWorkerAffinity, &g_map);
+    g_lua.bindSingletonFunction("g_map", "renderAsync", &Map::renderAsync, &g_map);
     g_lua.bindSingletonFunction("g_map", "drawMap", &Map::drawMap, &g_map);
+    g_lua.bindSingletonFunction("g_map", "setAnimatedOutput", &Map::setAnimatedOutput, &g_map);
+    g_lua.bindSingletonFunction("g_map", "openTileArchive", &Map::openTileArchive, &g_map);
+    g_lua.bindSingletonFunction("g_map", "closeTileArchive", &Map::closeTileArchive, &g_map);
+    g_lua.bindSingletonFunction("g_map", "isTileArchiveOutput", &Map::isTileArchiveOutput, &g_map);
+    g_lua.bindSingletonFunction("g_map", "isAnimatedOutput", &Map::isAnimatedOutput, &g_map);
+    g_lua.bindSingletonFunction("g_map", "setPagedTileIndex", &Map::setPagedTileIndex, &g_map);
+    g_lua.bindSingletonFunction("g_map", "isPagedTileIndex", &Map::isPagedTileIndex, &g_map);
+    g_lua.bindSingletonFunction("g_map", "setBakedLighting", &Map::setBakedLighting, &g_map);
+    g_lua.bindSingletonFunction("g_map", "isBakedLighting", &Map::isBakedLighting, &g_map);
+    g_lua.bindSingletonFunction("g_map", "setBakedAmbientLight", &Map::setBakedAmbientLight, &g_map);
+    g_lua.bindSingletonFunction("g_map", "getBakedAmbientLight", &Map::getBakedAmbientLight, &g_map);
+    g_lua.bindSingletonFunction("g_map", "planRenderJob", &Map::planRenderJob, &g_map);
+    g_lua.bindSingletonFunction("g_map", "startRenderJob", &Map::startRenderJob, &g_map);
+    g_lua.bindSingletonFunction("g_map", "isRenderJobRunning", &Map::isRenderJobRunning, &g_map);
+    g_lua.bindSingletonFunction("g_map", "getRenderJobShardCount", &Map::getRenderJobShardCount, &g_map);
+    g_lua.bindSingletonFunction("g_map", "getRenderJobCompletedShards", &Map::getRenderJobCompletedShards, &g_map);
 
     g_lua.bindSingletonFunction("g_map", "isLookPossible", &Map::isLookPossible, &g_map);
     g_lua.bindSingletonFunction("g_map", "isCovered", &Map::isCovered, &g_map);
@@ -129,8 +156,12 @@ void Client::registerLuaFunctions()
     g_lua.bindSingletonFunction("g_map", "getSpectators", &Map::getSpectators, &g_map);
     g_lua.bindSingletonFunction("g_map", "findPath", &Map::findPath, &g_map);
     g_lua.bindSingletonFunction("g_map", "loadOtbm", &Map::loadOtbm, &g_map);
+    g_lua.bindSingletonFunction("g_map", "loadOtbmAsync", &Map::loadOtbmAsync, &g_map);
+    g_lua.bindSingletonFunction("g_map", "indexOtbm", &Map::indexOtbm, &g_map);
+    g_lua.bindSingletonFunction("g_map", "loadOtbmRegion", &Map::loadOtbmRegion, &g_map);
     g_lua.bindSingletonFunction("g_map", "saveOtbm", &Map::saveOtbm, &g_map);
     g_lua.bindSingletonFunction("g_map", "loadOtcm", &Map::loadOtcm, &g_map);
+    g_lua.bindSingletonFunction("g_map", "loadOtcmRegion", &Map::loadOtcmRegion, &g_map);
     g_lua.bindSingletonFunction("g_map", "saveOtcm", &Map::saveOtcm, &g_map);
     g_lua.bindSingletonFunction("g_map", "getHouseFile", &Map::getHouseFile, &g_map);
     g_lua.bindSingletonFunction("g_map", "setHouseFile", &Map::setHouseFile, &g_map);
@@ -158,12 +189,28 @@ void Client::registerLuaFunctions()
     g_lua.bindSingletonFunction("g_map", "beginGhostMode", &Map::beginGhostMode, &g_map);
     g_lua.bindSingletonFunction("g_map", "endGhostMode", &Map::endGhostMode, &g_map);
     g_lua.bindSingletonFunction("g_map", "findItemsById", &Map::findItemsById, &g_map);
+    g_lua.bindSingletonFunction("g_map", "findItemsByIds", &Map::findItemsByIds, &g_map);
+    g_lua.bindSingletonFunction("g_map", "buildRouteMap", &Map::buildRouteMap, &g_map);
+    g_lua.bindSingletonFunction("g_map", "setItemIndexEnabled", &Map::setItemIndexEnabled, &g_map);
+    g_lua.bindSingletonFunction("g_map", "isItemIndexEnabled", &Map::isItemIndexEnabled, &g_map);
+    g_lua.bindSingletonFunction("g_map", "setArenaAllocation", &Map::setArenaAllocation, &g_map);
+    g_lua.bindSingletonFunction("g_map", "isArenaAllocation", &Map::isArenaAllocation, &g_map);
+    g_lua.bindSingletonFunction("g_map", "getArenaMemoryUsage", &Map::getArenaMemoryUsage, &g_map);
+
+    g_lua.registerSingletonClass("g_tileServer");
+    g_lua.bindSingletonFunction("g_tileServer", "start", &TileServer::start, &g_tileServer);
+    g_lua.bindSingletonFunction("g_tileServer", "stop", &TileServer::stop, &g_tileServer);
+    g_lua.bindSingletonFunction("g_tileServer", "isRunning", &TileServer::isRunning, &g_tileServer);
+    g_lua.bindSingletonFunction("g_tileServer", "setCacheLimit", &TileServer::setCacheLimit, &g_tileServer);
+    g_lua.bindSingletonFunction("g_tileServer", "clearCache", &TileServer::clearCache, &g_tileServer);
+    g_lua.bindSingletonFunction("g_tileServer", "getStats", &TileServer::getStats, &g_tileServer);
 
     g_lua.registerSingletonClass("g_minimap");
     g_lua.bindSingletonFunction("g_minimap", "clean", &Minimap::clean, &g_minimap);
     g_lua.bindSingletonFunction("g_minimap", "loadImage", &Minimap::loadImage, &g_minimap);
     g_lua.bindSingletonFunction("g_minimap", "saveImage", &Minimap::saveImage, &g_minimap);
     g_lua.bindSingletonFunction("g_minimap", "loadOtmm", &Minimap::loadOtmm, &g_minimap);
+    g_lua.bindSingletonFunction("g_minimap", "loadOtmmRegion", &Minimap::loadOtmmRegion, &g_minimap);
     g_lua.bindSingletonFunction("g_minimap", "saveOtmm", &Minimap::saveOtmm, &g_minimap);
 
     g_lua.registerSingletonClass("g_creatures");
@@ -390,6 +437,20 @@ void Client::registerLuaFunctions()
     g_lua.bindClassMemberFunction<Thing>("getParentContainer", &Thing::getParentContainer);
     g_lua.bindClassMemberFunction<Thing>("getMarketData", &Thing::getMarketData);
 
+    g_lua.registerClass<MapJob>();
+    g_lua.bindClassMemberFunction<MapJob>("cancel", &MapJob::cancel);
+    g_lua.bindClassMemberFunction<MapJob>("pause", &MapJob::pause);
+    g_lua.bindClassMemberFunction<MapJob>("resume", &MapJob::resume);
+    g_lua.bindClassMemberFunction<MapJob>("isPaused", &MapJob::isPaused);
+    g_lua.bindClassMemberFunction<MapJob>("getName", &MapJob::getName);
+    g_lua.bindClassMemberFunction<MapJob>("getDone", &MapJob::getDone);
+    g_lua.bindClassMemberFunction<MapJob>("getTotal", &MapJob::getTotal);
+    g_lua.bindClassMemberFunction<MapJob>("isCancelled", &MapJob::isCancelled);
+    g_lua.bindClassMemberFunction<MapJob>("isFinished", &MapJob::isFinished);
+    g_lua.bindClassMemberFunction<MapJob>("isSucceeded", &MapJob::isSucceeded);
+    g_lua.bindClassMemberFunction<MapJob>("getError", &MapJob::getError);
+    g_lua.bindClassMemberFunction<MapJob>("getElapsedMillis", &MapJob::getElapsedMillis);
+
     g_lua.registerClass<House>();
     g_lua.bindClassStaticFunction<House>("create", []{ return HousePtr(new House); });
     g_lua.bindClassMemberFunction<House>("setId", &House::setId);
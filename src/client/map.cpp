@@ -29,6 +29,7 @@
 #include "statictext.h"
 #include "mapview.h"
 #include "minimap.h"
+#include "thingtypemanager.h"
 
 #include <framework/core/eventdispatcher.h>
 #include <framework/core/application.h>
@@ -40,13 +41,112 @@ void Map::init()
 {
     resetAwareRange();
     m_animationFlags |= Animation_Show;
+    m_animatedOutput = false;
+    m_bakedLighting = false;
+    m_itemIndexEnabled = false;
+    m_arenaAllocation = false;
+    m_tileUpdatesDeferred = false;
 }
 
 void Map::terminate()
 {
+    stopMapGenerator();
+    closeTileArchive();
     clean();
 }
 
+TileBlock& TileBlockIndex::operator[](uint index)
+{
+    if(TileBlock *block = find(index))
+        return *block;
+
+    m_blocks.push_back(std::make_pair(index, TileBlock()));
+    TileBlock *block = &m_blocks.back().second;
+    insert(index, block);
+    return *block;
+}
+
+void TileBlockIndex::insert(uint index, TileBlock *block)
+{
+    if(m_paged) {
+        std::unique_ptr<TileBlock*[]>& page = m_pages[getPageIndex(index)];
+        if(!page) {
+            page.reset(new TileBlock*[PAGE_SIZE * PAGE_SIZE]);
+            std::fill(page.get(), page.get() + PAGE_SIZE * PAGE_SIZE, nullptr);
+        }
+        page[getPageSlot(index)] = block;
+    } else
+        m_hash[index] = block;
+}
+
+void TileBlockIndex::clear()
+{
+    m_hash.clear();
+    for(auto& page : m_pages)
+        page.reset();
+    m_blocks.clear();
+}
+
+void TileBlockIndex::setPaged(bool paged)
+{
+    if(paged == m_paged)
+        return;
+
+    m_paged = paged;
+    m_hash.clear();
+    m_pages.clear();
+    if(m_paged)
+        m_pages.resize(PAGES_PER_SIDE * PAGES_PER_SIDE);
+    for(auto& it : m_blocks)
+        insert(it.first, &it.second);
+}
+
+size_t TileBlockIndex::getIndexMemoryUsage()
+{
+    if(m_paged) {
+        size_t usage = m_pages.size() * sizeof(std::unique_ptr<TileBlock*[]>);
+        for(const auto& page : m_pages) {
+            if(page)
+                usage += PAGE_SIZE * PAGE_SIZE * sizeof(TileBlock*);
+        }
+        return usage;
+    }
+    // buckets plus one node (next pointer, key, value) per block
+    return m_hash.bucket_count() * sizeof(void*) + m_hash.size() * (sizeof(void*) + sizeof(std::pair<const uint, TileBlock*>));
+}
+
+TileRange::iterator::iterator(const TileRange *range) : m_range(range), m_z(0), m_tile(0)
+{
+    if(!m_range)
+        return;
+    m_z = m_range->m_minZ;
+    m_block = m_range->m_floors[m_z].begin();
+    settle();
+}
+
+// moves to the first existing tile of the range at or after the current one
+void TileRange::iterator::settle()
+{
+    while(m_range) {
+        if(m_block == m_range->m_floors[m_z].end()) {
+            if(++m_z > m_range->m_maxZ) {
+                m_range = nullptr;
+                return;
+            }
+            m_block = m_range->m_floors[m_z].begin();
+            m_tile = 0;
+        } else if(m_tile >= BLOCK_SIZE * BLOCK_SIZE || (m_tile == 0 && !m_range->intersectsBlock(m_block->first))) {
+            ++m_block;
+            m_tile = 0;
+        } else {
+            const TilePtr& tile = m_block->second.getTiles()[m_tile];
+            if(tile && m_range->m_rect.contains(Point(tile->getPosition().x, tile->getPosition().y)))
+                return;
+            ++m_tile;
+        }
+    }
+}
+
 void Map::addMapView(const MapViewPtr& mapView)
 {
     m_mapViews.push_back(mapView);
@@ -61,7 +161,8 @@ void Map::removeMapView(const MapViewPtr& mapView)
 
 void Map::notificateTileUpdate(const Position& pos)
 {
-    if(!pos.isMapPosition())
+    // set while loadOtbmAsync fills the map on another thread
+    if(!pos.isMapPosition() || m_tileUpdatesDeferred)
         return;
 
     for(const MapViewPtr& mapView : m_mapViews)
@@ -69,6 +170,14 @@ void Map::notificateTileUpdate(const Position& pos)
     g_minimap.updateTile(pos, getTile(pos));
 }
 
+void Map::notificateLoadedTiles()
+{
+    for(const MapViewPtr& mapView : m_mapViews)
+        mapView->requestVisibleTilesCacheUpdate();
+    for(const TilePtr& tile : getTileRange())
+        g_minimap.updateTile(tile->getPosition(), tile);
+}
+
 void Map::clean()
 {
     cleanDynamicThings();
@@ -77,11 +186,40 @@ void Map::clean()
         m_tileBlocks[i].clear();
 
     m_waypoints.clear();
+    m_bakedLight.clear();
+    m_itemIndex.clear();
+    m_routeMap.clear();
 
     g_towns.clear();
     g_houses.clear();
     g_creatures.clearSpawns();
     m_tilesRect = Rect(65534, 65534, 0, 0);
+    {
+        std::lock_guard<std::mutex> lock(m_mapSignatureMutex);
+        m_mapSignature.clear();
+    }
+
+    // frees the arenas in one go unless something still holds loaded tiles or items
+    Tile::getArena().trim();
+    Item::getArena().trim();
+}
+
+std::string Map::getMapSignature()
+{
+    std::lock_guard<std::mutex> lock(m_mapSignatureMutex);
+    return m_mapSignature;
+}
+
+// maps loaded on top of each other get a signature of their own
+void Map::addMapSignature(const std::string& signature)
+{
+    std::lock_guard<std::mutex> lock(m_mapSignatureMutex);
+    if(m_mapSignature.empty())
+        m_mapSignature = signature;
+    else {
+        std::string combined = m_mapSignature + "+" + signature;
+        m_mapSignature = stdext::format("%08x", stdext::adler32((const uint8*)combined.data(), combined.size()));
+    }
 }
 
 void Map::cleanDynamicThings()
@@ -111,8 +249,11 @@ void Map::addThing(const ThingPtr& thing, const Position& pos, int stackPos)
 
     if(thing->isItem() || thing->isCreature() || thing->isEffect()) {
         const TilePtr& tile = getOrCreateTile(pos);
-        if(tile)
+        if(tile) {
             tile->addThing(thing, stackPos);
+            if(m_itemIndexEnabled && thing->isItem())
+                m_itemIndex.add(thing->getId(), pos);
+        }
     } else {
         if(thing->isMissile()) {
             m_floorMissiles[pos.z].push_back(thing->static_self_cast<Missile>());
@@ -203,8 +344,11 @@ bool Map::removeThing(const ThingPtr& thing)
             m_staticTexts.erase(it);
             ret = true;
         }
-    } else if(const TilePtr& tile = thing->getTile())
+    } else if(const TilePtr& tile = thing->getTile()) {
         ret = tile->removeThing(thing);
+        if(ret && m_itemIndexEnabled && thing->isItem())
+            m_itemIndex.remove(thing->getId(), tile->getPosition());
+    }
 
     notificateTileUpdate(thing->getPosition());
     return ret;
@@ -312,53 +456,55 @@ const TilePtr& Map::getTile(const Position& pos)
 {
     if(!pos.isMapPosition())
         return m_nulltile;
-    auto it = m_tileBlocks[pos.z].find(getBlockIndex(pos));
-    if(it != m_tileBlocks[pos.z].end())
-        return it->second.get(pos);
+    if(TileBlock *block = m_tileBlocks[pos.z].find(getBlockIndex(pos)))
+        return block->get(pos);
     return m_nulltile;
 }
 
+void Map::setPagedTileIndex(bool enable)
+{
+    for(int z = 0; z <= Otc::MAX_Z; ++z)
+        m_tileBlocks[z].setPaged(enable);
+}
+
+size_t Map::getTileIndexMemoryUsage()
+{
+    size_t usage = 0;
+    for(int z = 0; z <= Otc::MAX_Z; ++z)
+        usage += m_tileBlocks[z].getIndexMemoryUsage();
+    return usage;
+}
+
 const TileList Map::getTiles(int floor/* = -1*/)
 {
     TileList tiles;
-    if(floor > Otc::MAX_Z) {
-        return tiles;
-    }
-    else if(floor < 0) {
-        // Search all floors
-        for(uint8_t z = 0; z <= Otc::MAX_Z; ++z) {
-            for(const auto& pair : m_tileBlocks[z]) {
-                const TileBlock& block = pair.second;
-                for(const TilePtr& tile : block.getTiles()) {
-                    if(tile != nullptr)
-                        tiles.push_back(tile);
-                }
-            }
-        }
-    }
-    else {
-        for(const auto& pair : m_tileBlocks[floor]) {
-            const TileBlock& block = pair.second;
-            for(const TilePtr& tile : block.getTiles()) {
-                if(tile != nullptr)
-                    tiles.push_back(tile);
-            }
-        }
-    }
+    for(const TilePtr& tile : getTileRange(floor))
+        tiles.push_back(tile);
     return tiles;
 }
 
+TileRange Map::getTileRange(int floor/* = -1*/)
+{
+    if(floor < 0)
+        return getTileRange(Rect(0, 0, 65536, 65536), 0, Otc::MAX_Z);
+    return getTileRange(Rect(0, 0, 65536, 65536), floor, floor);
+}
+
 void Map::cleanTile(const Position& pos)
 {
     if(!pos.isMapPosition())
         return;
-    auto it = m_tileBlocks[pos.z].find(getBlockIndex(pos));
-    if(it != m_tileBlocks[pos.z].end()) {
-        TileBlock& block = it->second;
-        if(const TilePtr& tile = block.get(pos)) {
+    if(TileBlock *block = m_tileBlocks[pos.z].find(getBlockIndex(pos))) {
+        if(const TilePtr& tile = block->get(pos)) {
+            if(m_itemIndexEnabled) {
+                for(const ThingPtr& thing : tile->rawGetThings()) {
+                    if(thing->isItem())
+                        m_itemIndex.remove(thing->getId(), pos);
+                }
+            }
             tile->clean();
             if(tile->canErase())
-                block.remove(pos);
+                block->remove(pos);
 
             notificateTileUpdate(pos);
         }
@@ -444,26 +590,106 @@ std::map<Position, ItemPtr> Map::findItemsById(uint16 clientId, uint32 max)
 {
     std::map<Position, ItemPtr> ret;
     uint32 count = 0;
-    for(uint8_t z = 0; z <= Otc::MAX_Z; ++z) {
-        for(const auto& pair : m_tileBlocks[z]) {
-            const TileBlock& block = pair.second;
-            for(const TilePtr& tile : block.getTiles()) {
-                if(unlikely(!tile || tile->isEmpty()))
+    auto addItems = [&](const TilePtr& tile) {
+        for(const ThingPtr& thing : tile->rawGetThings()) {
+            if(thing->isItem() && thing->getId() == clientId) {
+                ret.insert(std::make_pair(tile->getPosition(), thing->static_self_cast<Item>()));
+                if(++count >= max)
+                    return false;
+            }
+        }
+        return true;
+    };
+
+    if(m_itemIndexEnabled) {
+        for(const Position& pos : m_itemIndex.find(clientId)) {
+            const TilePtr& tile = getTile(pos);
+            if(tile && !addItems(tile))
+                break;
+        }
+        return ret;
+    }
+
+    for(const TilePtr& tile : getTileRange()) {
+        if(!tile->isEmpty() && !addItems(tile))
+            break;
+    }
+
+    return ret;
+}
+
+std::map<int, std::vector<Position>> Map::findItemsByIds(const std::vector<int>& ids, uint32 maxPerId, bool serverIds)
+{
+    std::map<int, std::vector<Position>> ret;
+    auto getItemId = [serverIds](const ThingPtr& thing) {
+        Item *item = static_cast<Item*>(thing.get());
+        return (int)(serverIds ? item->getServerId() : item->getId());
+    };
+
+    if(m_itemIndexEnabled) {
+        for(int id : ids) {
+            uint16 clientId = id;
+            if(serverIds) {
+                const ItemTypePtr& itemType = g_things.getItemType(id);
+                if(itemType->isNull())
                     continue;
-                for(const ItemPtr& item : tile->getItems()) {
-                    if(item->getId() == clientId) {
-                        ret.insert(std::make_pair(tile->getPosition(), item));
-                        if(++count >= max)
-                            break;
+                clientId = itemType->getClientId();
+            }
+
+            std::vector<Position>& positions = ret[id];
+            for(const Position& pos : m_itemIndex.find(clientId)) {
+                const TilePtr& tile = getTile(pos);
+                if(!tile)
+                    continue;
+                for(const ThingPtr& thing : tile->rawGetThings()) {
+                    if(thing->isItem() && getItemId(thing) == id) {
+                        positions.push_back(pos);
+                        break;
                     }
                 }
+                if(positions.size() >= maxPerId)
+                    break;
             }
         }
+        return ret;
     }
 
+    // without the index every tile is visited once for all ids
+    std::set<int> wanted(ids.begin(), ids.end());
+    for(int id : ids)
+        ret[id];
+    for(const TilePtr& tile : getTileRange()) {
+        int lastId = -1;
+        for(const ThingPtr& thing : tile->rawGetThings()) {
+            if(!thing->isItem())
+                continue;
+            int id = getItemId(thing);
+            if(id == lastId || !wanted.count(id))
+                continue;
+            std::vector<Position>& positions = ret[id];
+            if(positions.size() < maxPerId && (positions.empty() || positions.back() != tile->getPosition()))
+                positions.push_back(tile->getPosition());
+            lastId = id;
+        }
+    }
     return ret;
 }
 
+void Map::setItemIndexEnabled(bool enable)
+{
+    m_itemIndex.clear();
+    m_itemIndexEnabled = enable;
+    if(!enable)
+        return;
+
+    for(const TilePtr& tile : getTileRange()) {
+        for(const ThingPtr& thing : tile->rawGetThings()) {
+            if(thing->isItem())
+                m_itemIndex.add(thing->getId(), tile->getPosition());
+        }
+    }
+}
+
 void Map::addCreature(const CreaturePtr& creature)
 {
     m_knownCreatures[creature->getId()] = creature;
@@ -689,172 +915,7 @@ int Map::getLastAwareFloor()
 
 std::tuple<std::vector<Otc::Direction>, Otc::PathFindResult> Map::findPath(const Position& startPos, const Position& goalPos, int maxComplexity, int flags)
 {
-    // pathfinding using A* search algorithm
-    // as described in http://en.wikipedia.org/wiki/A*_search_algorithm
-
-    struct Node {
-        Node(const Position& pos) : cost(0), totalCost(0), pos(pos), prev(nullptr), dir(Otc::InvalidDirection) { }
-        float cost;
-        float totalCost;
-        Position pos;
-        Node *prev;
-        Otc::Direction dir;
-    };
-
-    struct LessNode : std::binary_function<std::pair<Node*, float>, std::pair<Node*, float>, bool> {
-        bool operator()(std::pair<Node*, float> a, std::pair<Node*, float> b) const {
-            return b.second < a.second;
-        }
-    };
-
-    std::tuple<std::vector<Otc::Direction>, Otc::PathFindResult> ret;
-    std::vector<Otc::Direction>& dirs = std::get<0>(ret);
-    Otc::PathFindResult& result = std::get<1>(ret);
-
-    result = Otc::PathFindResultNoWay;
-
-    if(startPos == goalPos) {
-        result = Otc::PathFindResultSamePosition;
-        return ret;
-    }
-
-    if(startPos.z != goalPos.z) {
-        result = Otc::PathFindResultImpossible;
-        return ret;
-    }
-
-    // check the goal pos is walkable
-    if(g_map.isAwareOfPosition(goalPos)) {
-        const TilePtr goalTile = getTile(goalPos);
-        if(!goalTile || !goalTile->isWalkable()) {
-            return ret;
-        }
-    }
-    else {
-        const MinimapTile& goalTile = g_minimap.getTile(goalPos);
-        if(goalTile.hasFlag(MinimapTileNotWalkable)) {
-            return ret;
-        }
-    }
-
-    std::unordered_map<Position, Node*, PositionHasher> nodes;
-    std::priority_queue<std::pair<Node*, float>, std::vector<std::pair<Node*, float>>, LessNode> searchList;
-
-    Node *currentNode = new Node(startPos);
-    currentNode->pos = startPos;
-    nodes[startPos] = currentNode;
-    Node *foundNode = nullptr;
-    while(currentNode) {
-        if((int)nodes.size() > maxComplexity) {
-            result = Otc::PathFindResultTooFar;
-            break;
-        }
-
-        // path found
-        if(currentNode->pos == goalPos && (!foundNode || currentNode->cost < foundNode->cost))
-            foundNode = currentNode;
-
-        // cost too high
-        if(foundNode && currentNode->totalCost >= foundNode->cost)
-            break;
-
-        for(int i=-1;i<=1;++i) {
-            for(int j=-1;j<=1;++j) {
-                if(i == 0 && j == 0)
-                    continue;
-
-                bool wasSeen = false;
-                bool hasCreature = false;
-                bool isNotWalkable = true;
-                bool isNotPathable = true;
-                int speed = 100;
-
-                Position neighborPos = currentNode->pos.translated(i, j);
-                if(g_map.isAwareOfPosition(neighborPos)) {
-                    wasSeen = true;
-                    if(const TilePtr& tile = getTile(neighborPos)) {
-                        hasCreature = tile->hasCreature();
-                        isNotWalkable = !tile->isWalkable();
-                        isNotPathable = !tile->isPathable();
-                        speed = tile->getGroundSpeed();
-                    }
-                } else {
-                    const MinimapTile& mtile = g_minimap.getTile(neighborPos);
-                    wasSeen = mtile.hasFlag(MinimapTileWasSeen);
-                    isNotWalkable = mtile.hasFlag(MinimapTileNotWalkable);
-                    isNotPathable = mtile.hasFlag(MinimapTileNotPathable);
-                    if(isNotWalkable || isNotPathable)
-                        wasSeen = true;
-                    speed = mtile.getSpeed();
-                }
-
-                float walkFactor = 0;
-                if(neighborPos != goalPos) {
-                    if(!(flags & Otc::PathFindAllowNotSeenTiles) && !wasSeen)
-                        continue;
-                    if(wasSeen) {
-                        if(!(flags & Otc::PathFindAllowCreatures) && hasCreature)
-                            continue;
-                        if(!(flags & Otc::PathFindAllowNonPathable) && isNotPathable)
-                            continue;
-                        if(!(flags & Otc::PathFindAllowNonWalkable) && isNotWalkable)
-                            continue;
-                    }
-                } else {
-                    if(!(flags & Otc::PathFindAllowNotSeenTiles) && !wasSeen)
-                        continue;
-                    if(wasSeen) {
-                        if(!(flags & Otc::PathFindAllowNonWalkable) && isNotWalkable)
-                            continue;
-                    }
-                }
-
-                Otc::Direction walkDir = currentNode->pos.getDirectionFromPosition(neighborPos);
-                if(walkDir >= Otc::NorthEast)
-                    walkFactor += 3.0f;
-                else
-                    walkFactor += 1.0f;
-
-                float cost = currentNode->cost + (speed * walkFactor) / 100.0f;
-
-                Node *neighborNode;
-                if(nodes.find(neighborPos) == nodes.end()) {
-                    neighborNode = new Node(neighborPos);
-                    nodes[neighborPos] = neighborNode;
-                } else {
-                    neighborNode = nodes[neighborPos];
-                    if(neighborNode->cost <= cost)
-                        continue;
-                }
-
-                neighborNode->prev = currentNode;
-                neighborNode->cost = cost;
-                neighborNode->totalCost = neighborNode->cost + neighborPos.distance(goalPos);
-                neighborNode->dir = walkDir;
-                searchList.push(std::make_pair(neighborNode, neighborNode->totalCost));
-            }
-        }
-
-        if(!searchList.empty()) {
-            currentNode = searchList.top().first;
-            searchList.pop();
-        } else
-            currentNode = nullptr;
-    }
-
-    if(foundNode) {
-        currentNode = foundNode;
-        while(currentNode) {
-            dirs.push_back(currentNode->dir);
-            currentNode = currentNode->prev;
-        }
-        dirs.pop_back();
-        std::reverse(dirs.begin(), dirs.end());
-        result = Otc::PathFindResultOk;
-    }
-
-    for(auto it : nodes)
-        delete it.second;
-
-    return ret;
+    if(flags & Otc::PathFindHierarchical)
+        return m_routeMap.findPath(startPos, goalPos, maxComplexity);
+    return m_pathFinder.findPath(startPos, goalPos, maxComplexity, flags);
 }
@@ -30,6 +30,11 @@
 #include "animatedtext.h"
 #include "statictext.h"
 #include "tile.h"
+#include "maplight.h"
+#include "itemindex.h"
+#include "pathfinder.h"
+#include "routemap.h"
+#include "tilearchive.h"
 
 #include <framework/core/clock.h>
 
@@ -86,13 +91,25 @@ enum OTBM_NodeTypes_t
 
 enum {
     OTCM_SIGNATURE = 0x4D43544F,
-    OTCM_VERSION = 1
+    OTCM_VERSION = 2,
+    OTCM_COMPRESS_LEVEL = 3
+};
+
+enum {
+    OTBM_WRITE_BUFFER_SIZE = 1024 * 1024,
+    OTBM_INDEX_SIGNATURE = 0x4942544F,
+    OTBM_INDEX_VERSION = 3
 };
 
 enum {
     BLOCK_SIZE = 32
 };
 
+enum {
+    MAPGEN_ANIMATION_MAX_DURATION = 10000,
+    MAPGEN_ANIMATION_MAX_FRAMES = 64
+};
+
 enum : uint8 {
     Animation_Force,
     Animation_Show
@@ -124,6 +141,96 @@ private:
     std::array<TilePtr, BLOCK_SIZE*BLOCK_SIZE> m_tiles;
 };
 
+// Tile blocks of one floor. Lookups go through a hash map or, when paged, through a
+// two-level page table covering the whole 2048x2048 block index space.
+class TileBlockIndex {
+public:
+    typedef std::deque<std::pair<uint, TileBlock>> BlockList;
+
+    enum {
+        BLOCKS_PER_SIDE = 65536 / BLOCK_SIZE,
+        PAGE_SIZE = 64,
+        PAGES_PER_SIDE = BLOCKS_PER_SIDE / PAGE_SIZE
+    };
+
+    TileBlockIndex() : m_paged(false) { }
+
+    TileBlock *find(uint index) {
+        if(m_paged) {
+            const std::unique_ptr<TileBlock*[]>& page = m_pages[getPageIndex(index)];
+            return page ? page[getPageSlot(index)] : nullptr;
+        }
+        auto it = m_hash.find(index);
+        return it != m_hash.end() ? it->second : nullptr;
+    }
+    TileBlock& operator[](uint index);
+
+    void clear();
+    void setPaged(bool paged);
+    bool isPaged() { return m_paged; }
+    size_t size() const { return m_blocks.size(); }
+    // bytes used by the lookup structure, excluding the blocks themselves
+    size_t getIndexMemoryUsage();
+
+    BlockList::iterator begin() { return m_blocks.begin(); }
+    BlockList::iterator end() { return m_blocks.end(); }
+    BlockList::const_iterator begin() const { return m_blocks.begin(); }
+    BlockList::const_iterator end() const { return m_blocks.end(); }
+
+private:
+    static uint getPageIndex(uint index) { return (index / BLOCKS_PER_SIDE / PAGE_SIZE) * PAGES_PER_SIDE + (index % BLOCKS_PER_SIDE) / PAGE_SIZE; }
+    static uint getPageSlot(uint index) { return (index / BLOCKS_PER_SIDE % PAGE_SIZE) * PAGE_SIZE + (index % BLOCKS_PER_SIDE) % PAGE_SIZE; }
+    void insert(uint index, TileBlock *block);
+
+    BlockList m_blocks;
+    std::unordered_map<uint, TileBlock*> m_hash;
+    std::vector<std::unique_ptr<TileBlock*[]>> m_pages;
+    bool m_paged;
+};
+
+// Existing tiles of a floor range, optionally only those inside of a rect, iterated
+// in place without copying tile pointers. The map must not change while iterating.
+class TileRange {
+public:
+    class iterator : public std::iterator<std::forward_iterator_tag, const TilePtr> {
+    public:
+        iterator() : m_range(nullptr), m_z(0), m_tile(0) { }
+        iterator(const TileRange *range);
+
+        const TilePtr& operator*() const { return m_block->second.getTiles()[m_tile]; }
+        const TilePtr *operator->() const { return &**this; }
+        iterator& operator++() { ++m_tile; settle(); return *this; }
+        bool operator==(const iterator& other) const {
+            return m_range == other.m_range && (!m_range || (m_z == other.m_z && m_block == other.m_block && m_tile == other.m_tile));
+        }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+        void settle();
+
+        const TileRange *m_range;
+        int m_z;
+        TileBlockIndex::BlockList::const_iterator m_block;
+        int m_tile;
+    };
+
+    TileRange(const TileBlockIndex *floors, int minZ, int maxZ, const Rect& rect) :
+        m_floors(floors), m_minZ(minZ), m_maxZ(maxZ), m_rect(rect) { }
+
+    iterator begin() const { return iterator(m_minZ <= m_maxZ ? this : nullptr); }
+    iterator end() const { return iterator(); }
+
+private:
+    bool intersectsBlock(uint index) const {
+        return m_rect.intersects(Rect(index % TileBlockIndex::BLOCKS_PER_SIDE * BLOCK_SIZE, index / TileBlockIndex::BLOCKS_PER_SIDE * BLOCK_SIZE, BLOCK_SIZE, BLOCK_SIZE));
+    }
+
+    const TileBlockIndex *m_floors;
+    int m_minZ;
+    int m_maxZ;
+    Rect m_rect;
+};
+
 struct AwareRange
 {
     int top;
@@ -147,14 +254,58 @@ public:
     void notificateTileUpdate(const Position& pos);
 
     bool loadOtcm(const std::string& fileName);
+    bool loadOtcmRegion(const std::string& fileName, const Rect& area, int minZ, int maxZ);
     void saveOtcm(const std::string& fileName);
 
     void initializeMapGenerator();
+    // waits for queued areas of startThread/startRenderJob and stops the generator threads
+    void stopMapGenerator();
+    // pins generator and render job threads to cpus, filling one numa node after another
+    void setWorkerAffinity(bool enable);
+    bool isWorkerAffinity();
     bool isThreadRunning(int threadId);
     void startThread(int threadId, int minx, int miny, int minz, int maxx, int maxy, int maxz);
-    void drawMap(std::string fileName, int sx, int sy, int sz, int size);
-
-    void loadOtbm(const std::string& fileName);
+    // renders every 8x8 tile chunk of the area (in tiles) to map/x_y_z.png on its own threads
+    MapJobPtr renderAsync(int minX, int minY, int minZ, int maxX, int maxY, int maxZ, int threads);
+    // returns false when the area is empty and nothing was saved
+    bool drawMap(const std::string& fileName, int sx, int sy, int sz, int size);
+    ImagePtr renderMapImage(int sx, int sy, int sz, int size, int animationTicks = 0);
+    // same as renderMapImage, but reuses the pixels of image
+    void drawMapImage(const ImagePtr& image, int sx, int sy, int sz, int size, int animationTicks = 0);
+    // png (or apng with animated output) of the area, false when it has nothing to draw. The images
+    // and encoder buffers are kept per thread, so after the first chunks of a thread it does not allocate
+    bool encodeMapImage(std::string& data, int sx, int sy, int sz, int size);
+    std::vector<int> getAnimationTimeline(int sx, int sy, int sz, int size);
+    void setAnimatedOutput(bool enable) { m_animatedOutput = enable; }
+    // drawMap appends chunks to the archive in dir instead of writing png files until it is closed,
+    // both fail while a render is running
+    bool openTileArchive(const std::string& dir);
+    bool closeTileArchive();
+    bool isTileArchiveOutput() { return !!getTileArchive(); }
+    bool isAnimatedOutput() { return m_animatedOutput; }
+    void setPagedTileIndex(bool enable);
+    bool isPagedTileIndex() { return m_tileBlocks[0].isPaged(); }
+    size_t getTileIndexMemoryUsage();
+    size_t getTileBlockCount(int z) { return m_tileBlocks[z].size(); }
+    void setBakedLighting(bool enable) { m_bakedLighting = enable; m_bakedLight.clear(); }
+    bool isBakedLighting() { return m_bakedLighting; }
+    void setBakedAmbientLight(const Light& light) { m_bakedLight.setAmbientLight(light); }
+    Light getBakedAmbientLight() { return m_bakedLight.getAmbientLight(); }
+
+    bool planRenderJob(const std::string& dir, int minx, int miny, int minz, int maxx, int maxy, int maxz, int shardSize);
+    // the job completes when the threads find no shard left to claim, cancel() leaves shards at their checkpoints
+    MapJobPtr startRenderJob(const std::string& dir, int threads);
+    bool isRenderJobRunning();
+    int getRenderJobShardCount();
+    int getRenderJobCompletedShards();
+
+    bool loadOtbm(const std::string& fileName);
+    // loads on an async dispatcher thread, the map must not be used until the job completes,
+    // the minimap and map views are updated on the main thread when it finishes
+    MapJobPtr loadOtbmAsync(const std::string& fileName);
+    // writes <fileName>.idx with offsets of all tile areas, loadOtbmRegion creates it when missing
+    bool indexOtbm(const std::string& fileName);
+    bool loadOtbmRegion(const std::string& fileName, const Rect& area, int minZ, int maxZ);
     void saveOtbm(const std::string& fileName);
 
     // otbm attributes (description, size, etc.)
@@ -192,6 +343,8 @@ public:
     const TilePtr& getOrCreateTile(const Position& pos);
     const TilePtr& getTile(const Position& pos);
     const TileList getTiles(int floor = -1);
+    TileRange getTileRange(int floor = -1);
+    TileRange getTileRange(const Rect& rect, int minZ, int maxZ) { return TileRange(m_tileBlocks, std::max(minZ, 0), std::min(maxZ, (int)Otc::MAX_Z), rect); }
     void cleanTile(const Position& pos);
 
     // tile zone related
@@ -215,6 +368,15 @@ public:
     void endGhostMode();
 
     std::map<Position, ItemPtr> findItemsById(uint16 clientId, uint32 max);
+    std::map<int, std::vector<Position>> findItemsByIds(const std::vector<int>& ids, uint32 maxPerId, bool serverIds);
+    void setItemIndexEnabled(bool enable);
+    bool isItemIndexEnabled() { return m_itemIndexEnabled; }
+    // tiles and items created by map loaders come from arenas freed by clean()
+    void setArenaAllocation(bool enable) { m_arenaAllocation = enable; }
+    bool isArenaAllocation() { return m_arenaAllocation; }
+    size_t getArenaMemoryUsage() { return Tile::getArena().getMemoryUsage() + Item::getArena().getMemoryUsage(); }
+    // identifies the loaded map files and regions, empty when nothing was loaded since clean()
+    std::string getMapSignature();
 
     // known creature related
     void addCreature(const CreaturePtr& creature);
@@ -247,12 +409,23 @@ public:
     std::vector<StaticTextPtr> getStaticTexts() { return m_staticTexts; }
 
     std::tuple<std::vector<Otc::Direction>, Otc::PathFindResult> findPath(const Position& start, const Position& goal, int maxComplexity, int flags = 0);
+    void buildRouteMap() { m_routeMap.build(); }
 
 private:
     void removeUnawareThings();
+    bool readOtbm(const std::string& fileName, const MapJobStatePtr& state);
+    bool readOtcm(const std::string& fileName, const Rect& area, int minZ, int maxZ);
+    // updates the minimap and map views with every tile, after a load that deferred their tile updates
+    void notificateLoadedTiles();
+    void addMapSignature(const std::string& signature);
+    // render threads read the archive while the main thread opens and closes it
+    std::shared_ptr<TileArchiveWriter> getTileArchive() { return std::atomic_load(&m_tileArchive); }
+    bool drawMapChunk(const std::string& fileName, int sx, int sy, int sz, int size, const std::shared_ptr<TileArchiveWriter>& archive);
+    void buildAnimationTimeline(std::vector<int>& timeline, int sx, int sy, int sz, int size);
+    void readOtbmTileArea(const BinaryTreePtr& nodeMapData, const Rect& area, int minZ, int maxZ, Position& minPos, Position& maxPos);
     uint getBlockIndex(const Position& pos) { return ((pos.y / BLOCK_SIZE) * (65536 / BLOCK_SIZE)) + (pos.x / BLOCK_SIZE); }
 
-    std::unordered_map<uint, TileBlock> m_tileBlocks[Otc::MAX_Z+1];
+    TileBlockIndex m_tileBlocks[Otc::MAX_Z+1];
     std::unordered_map<uint32, CreaturePtr> m_knownCreatures;
     std::array<std::vector<MissilePtr>, Otc::MAX_Z+1> m_floorMissiles;
     std::vector<AnimatedTextPtr> m_animatedTexts;
@@ -261,6 +434,18 @@ private:
     std::unordered_map<Position, std::string, PositionHasher> m_waypoints;
 
     uint8 m_animationFlags;
+    bool m_animatedOutput;
+    bool m_bakedLighting;
+    bool m_itemIndexEnabled;
+    bool m_arenaAllocation;
+    std::atomic<bool> m_tileUpdatesDeferred;
+    std::string m_mapSignature;
+    std::mutex m_mapSignatureMutex;
+    ItemIndex m_itemIndex;
+    PathFinder m_pathFinder;
+    RouteMap m_routeMap;
+    std::shared_ptr<TileArchiveWriter> m_tileArchive;
+    MapLight m_bakedLight;
     uint32 m_zoneFlags;
     std::map<uint32, Color> m_zoneColors;
     float m_zoneOpacity;
@@ -0,0 +1,967 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "mapbenchmark.h"
+#include "map.h"
+#include "game.h"
+#include "itemtype.h"
+#include "thingtypemanager.h"
+#include "spritemanager.h"
+#include "workerplacement.h"
+
+#include <framework/core/resourcemanager.h>
+#include <framework/core/filestream.h>
+#include <framework/core/binarytree.h>
+#include <framework/graphics/image.h>
+#include <framework/graphics/apngloader.h>
+#include <framework/platform/platform.h>
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <random>
+
+MapBenchmark g_mapBenchmark;
+std::atomic<uint64> g_mapBenchmarkAllocations(0);
+
+namespace {
+
+enum FixtureKind {
+    FixtureGround,
+    FixtureBorder,
+    FixtureBottom,
+    FixtureCommon,
+    FixtureTop
+};
+
+struct FixtureItemType
+{
+    FixtureKind kind;
+    uint8 size;
+    uint8 phases;
+    uint16 elevation;
+    uint16 light;
+};
+
+// server id and client id of the n-th entry are both 100 + n
+const FixtureItemType fixtureItems[] = {
+    { FixtureGround, 1, 1, 0, 0 }, { FixtureGround, 1, 1, 0, 0 }, { FixtureGround, 1, 1, 0, 0 },
+    { FixtureGround, 1, 1, 0, 0 }, { FixtureGround, 1, 1, 0, 0 }, { FixtureGround, 1, 1, 0, 0 },
+    { FixtureBorder, 1, 1, 0, 0 }, { FixtureBorder, 1, 1, 0, 0 }, { FixtureBorder, 1, 1, 0, 0 },
+    { FixtureBorder, 1, 1, 0, 0 },
+    { FixtureBottom, 1, 1, 0, 0 }, { FixtureBottom, 1, 1, 0, 0 }, { FixtureBottom, 2, 1, 0, 0 },
+    { FixtureBottom, 2, 1, 0, 0 },
+    { FixtureCommon, 1, 1, 0, 0 }, { FixtureCommon, 1, 1, 0, 0 }, { FixtureCommon, 1, 1, 8, 0 },
+    { FixtureCommon, 2, 1, 0, 0 },
+    // animated
+    { FixtureCommon, 1, 3, 0, 0 }, { FixtureCommon, 1, 3, 0, 0 }, { FixtureCommon, 1, 4, 0, 0 },
+    // light sources
+    { FixtureCommon, 1, 1, 0, 4 }, { FixtureCommon, 1, 1, 0, 6 }, { FixtureCommon, 1, 2, 0, 3 },
+    { FixtureTop, 1, 1, 0, 0 }, { FixtureTop, 1, 1, 0, 0 }
+};
+
+const int fixtureItemCount = sizeof(fixtureItems) / sizeof(fixtureItems[0]);
+const uint16 fixtureFirstId = 100;
+const uint32 fixtureOtbMajorVersion = 3;
+const uint32 fixtureOtbMinorVersion = 57;
+
+int fixtureSpriteCount(const FixtureItemType& type)
+{
+    return type.size * type.size * type.phases;
+}
+
+std::vector<uint16> fixtureItemsOfKind(FixtureKind kind)
+{
+    std::vector<uint16> ids;
+    for(int i = 0; i < fixtureItemCount; ++i) {
+        if(fixtureItems[i].kind == kind)
+            ids.push_back(fixtureFirstId + i);
+    }
+    return ids;
+}
+
+// 10.x dat files have every attribute above 15 shifted by one
+void addDatAttr(const FileStreamPtr& fin, uint8 attr)
+{
+    fin->addU8(attr >= 16 ? attr + 1 : attr);
+}
+
+// sprites are stored as runs of transparent and rgb colored pixels
+std::string encodeSprite(const std::vector<uint8>& pixels)
+{
+    std::string data;
+    uint8 tmp[2];
+    int pos = 0;
+    const int count = pixels.size() / 4;
+    while(pos < count) {
+        int transparent = 0, colored = 0;
+        while(pos + transparent < count && pixels[(pos + transparent) * 4 + 3] == 0)
+            transparent++;
+        while(pos + transparent + colored < count && pixels[(pos + transparent + colored) * 4 + 3] != 0)
+            colored++;
+
+        stdext::writeULE16(tmp, transparent);
+        data.append((const char*)tmp, 2);
+        stdext::writeULE16(tmp, colored);
+        data.append((const char*)tmp, 2);
+        for(int i = pos + transparent; i < pos + transparent + colored; ++i)
+            data.append((const char*)&pixels[i * 4], 3);
+        pos += transparent + colored;
+    }
+    return data;
+}
+
+std::string toJson(const std::map<std::string, std::string>& object)
+{
+    std::string json = "{";
+    for(auto it = object.begin(); it != object.end(); ++it) {
+        if(it != object.begin())
+            json += ", ";
+        json += "\"" + it->first + "\": " + it->second;
+    }
+    return json + "}";
+}
+
+std::string toJsonMillis(ticks_t micros)
+{
+    return stdext::format("%.3f", micros / 1000.0);
+}
+
+// golden files of the source tree are plain files, others are inside the write directory
+bool isHostGoldenFile(const std::string& fileName, bool writing)
+{
+    boost::filesystem::path path(fileName);
+    if(writing)
+        return path.has_parent_path() && boost::filesystem::is_directory(path.parent_path()) && path.parent_path() != path.root_path();
+    return boost::filesystem::is_regular_file(path);
+}
+
+std::string readGoldenFile(const std::string& fileName)
+{
+    if(!isHostGoldenFile(fileName, false))
+        return g_resources.readFileContents(fileName);
+
+    std::ifstream in(fileName.c_str(), std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    if(!in.good())
+        stdext::throw_exception(stdext::format("unable to read '%s'", fileName));
+    return contents.str();
+}
+
+bool writeGoldenFile(const std::string& fileName, const std::string& contents)
+{
+    if(!isHostGoldenFile(fileName, true))
+        return g_resources.writeFileContents(fileName, contents);
+
+    std::ofstream out(fileName.c_str(), std::ios::binary | std::ios::trunc);
+    out << contents;
+    out.close();
+    return !out.fail();
+}
+
+}
+
+void MapBenchmark::generateFixture(const std::string& dir, const MapBenchmarkFixture& fixture)
+{
+    try {
+        if(fixture.width <= 0 || fixture.height <= 0 || fixture.floors <= 0 || fixture.floors > MAPBENCH_GROUND_FLOOR + 1)
+            stdext::throw_exception("invalid fixture dimensions");
+
+        g_resources.makeDir(dir);
+        writeDat(dir + "/Tibia.dat");
+        writeSpr(dir + "/Tibia.spr", fixture.seed);
+        writeOtb(dir + "/items.otb");
+        writeOtbm(dir + "/map.otbm", fixture);
+        g_logger.info(stdext::format("Generated map benchmark fixture %dx%dx%d (seed %d) in '%s'",
+                                     fixture.width, fixture.height, fixture.floors, fixture.seed, dir));
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Failed to generate map benchmark fixture in '%s': %s", dir, e.what()));
+    }
+}
+
+void MapBenchmark::writeDat(const std::string& fileName)
+{
+    FileStreamPtr fin = g_resources.createFile(fileName);
+    fin->cache();
+
+    fin->addU32(0x4D42454E); // signature
+    fin->addU16(fixtureFirstId + fixtureItemCount - 1);
+    fin->addU16(0); // creatures
+    fin->addU16(0); // effects
+    fin->addU16(0); // missiles
+
+    uint32 spriteId = 1;
+    for(const FixtureItemType& type : fixtureItems) {
+        switch(type.kind) {
+        case FixtureGround:
+            addDatAttr(fin, ThingAttrGround);
+            fin->addU16(150); // speed
+            break;
+        case FixtureBorder:
+            addDatAttr(fin, ThingAttrGroundBorder);
+            break;
+        case FixtureBottom:
+            addDatAttr(fin, ThingAttrOnBottom);
+            addDatAttr(fin, ThingAttrNotWalkable);
+            addDatAttr(fin, ThingAttrNotMoveable);
+            break;
+        case FixtureTop:
+            addDatAttr(fin, ThingAttrOnTop);
+            break;
+        default:
+            break;
+        }
+        if(type.elevation > 0) {
+            addDatAttr(fin, ThingAttrElevation);
+            fin->addU16(type.elevation);
+        }
+        if(type.light > 0) {
+            addDatAttr(fin, ThingAttrLight);
+            fin->addU16(type.light);
+            fin->addU16(215);
+        }
+        if(type.phases > 1)
+            addDatAttr(fin, ThingAttrAnimateAlways);
+        fin->addU8(ThingLastAttr);
+
+        fin->addU8(type.size); // width
+        fin->addU8(type.size); // height
+        if(type.size > 1)
+            fin->addU8(type.size * 32); // exact size
+        fin->addU8(1); // layers
+        fin->addU8(1); // pattern x
+        fin->addU8(1); // pattern y
+        fin->addU8(1); // pattern z
+        fin->addU8(type.phases);
+        if(type.phases > 1) {
+            fin->addU8(1); // synchronized
+            fin->add32(0); // loop count
+            fin->add8(0); // start phase
+            for(int i = 0; i < type.phases; ++i) {
+                fin->addU32(200 + i * 50);
+                fin->addU32(300 + i * 50);
+            }
+        }
+
+        for(int i = 0; i < fixtureSpriteCount(type); ++i)
+            fin->addU32(spriteId++);
+    }
+
+    fin->flush();
+    fin->close();
+}
+
+void MapBenchmark::writeSpr(const std::string& fileName, uint32 seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<std::string> sprites;
+    std::vector<uint8> pixels(32 * 32 * 4);
+
+    for(const FixtureItemType& type : fixtureItems) {
+        for(int s = 0; s < fixtureSpriteCount(type); ++s) {
+            uint8 r = rng() % 256, g = rng() % 256, b = rng() % 256;
+            int radius = 6 + rng() % 10;
+            for(int y = 0; y < 32; ++y) {
+                for(int x = 0; x < 32; ++x) {
+                    uint8 *pixel = &pixels[(y * 32 + x) * 4];
+                    bool opaque;
+                    if(type.kind == FixtureGround)
+                        opaque = true;
+                    else if(type.kind == FixtureBorder)
+                        opaque = x < 6 || y < 6;
+                    else
+                        opaque = std::abs(x - 16) + std::abs(y - 16) <= radius;
+
+                    int shade = ((x + y + s) % 4) * 8;
+                    pixel[0] = std::max<int>(r - shade, 0);
+                    pixel[1] = std::max<int>(g - shade, 0);
+                    pixel[2] = std::max<int>(b - shade, 0);
+                    pixel[3] = opaque ? 0xFF : 0x00;
+                }
+            }
+            sprites.push_back(encodeSprite(pixels));
+        }
+    }
+
+    FileStreamPtr fin = g_resources.createFile(fileName);
+    fin->cache();
+
+    fin->addU32(0x4D42454E); // signature
+    fin->addU32(sprites.size());
+    uint32 address = 8 + sprites.size() * 4;
+    for(const std::string& sprite : sprites) {
+        fin->addU32(address);
+        address += 5 + sprite.size();
+    }
+    for(const std::string& sprite : sprites) {
+        // color key
+        fin->addU8(0xFF);
+        fin->addU8(0x00);
+        fin->addU8(0xFF);
+        fin->addU16(sprite.size());
+        fin->write(sprite.data(), sprite.size());
+    }
+
+    fin->flush();
+    fin->close();
+}
+
+void MapBenchmark::writeOtb(const std::string& fileName)
+{
+    FileStreamPtr fin = g_resources.createFile(fileName);
+    fin->cache();
+
+    fin->addU32(0); // signature
+    OutputBinaryTreePtr root(new OutputBinaryTree(fin));
+    {
+        root->addU32(0); // signature
+        root->addU8(0x01); // OTB_ROOT_ATTR_VERSION
+        root->addU16(4 + 4 + 4 + 128);
+        root->addU32(fixtureOtbMajorVersion);
+        root->addU32(fixtureOtbMinorVersion);
+        root->addU32(1); // build number
+        for(int i = 0; i < 128; ++i)
+            root->addU8(0); // description
+
+        for(int i = 0; i < fixtureItemCount; ++i) {
+            root->startNode(fixtureItems[i].kind == FixtureGround ? ItemCategoryGround : ItemCategoryInvalid);
+            root->addU32(0); // flags
+            root->addU8(ItemTypeAttrServerId);
+            root->addU16(2);
+            root->addU16(fixtureFirstId + i);
+            root->addU8(ItemTypeAttrClientId);
+            root->addU16(2);
+            root->addU16(fixtureFirstId + i);
+            root->endNode();
+        }
+    }
+    root->endNode();
+
+    fin->flush();
+    fin->close();
+}
+
+void MapBenchmark::writeOtbm(const std::string& fileName, const MapBenchmarkFixture& fixture)
+{
+    std::mt19937 rng(fixture.seed);
+    const std::vector<uint16> grounds = fixtureItemsOfKind(FixtureGround);
+    const std::vector<uint16> borders = fixtureItemsOfKind(FixtureBorder);
+    const std::vector<uint16> bottoms = fixtureItemsOfKind(FixtureBottom);
+    const std::vector<uint16> commons = fixtureItemsOfKind(FixtureCommon);
+    const std::vector<uint16> tops = fixtureItemsOfKind(FixtureTop);
+
+    FileStreamPtr fin = g_resources.createFile(fileName);
+    fin->cache();
+
+    fin->addU32(0); // file version
+    OutputBinaryTreePtr root(new OutputBinaryTree(fin));
+    {
+        root->addU32(2); // otbm version
+        root->addU16(MAPBENCH_ORIGIN + fixture.width);
+        root->addU16(MAPBENCH_ORIGIN + fixture.height);
+        root->addU32(fixtureOtbMajorVersion);
+        root->addU32(fixtureOtbMinorVersion);
+
+        root->startNode(OTBM_MAP_DATA);
+        {
+            // the fixture parameters are read back from the description by MapBenchmark::run
+            root->addU8(OTBM_ATTR_DESCRIPTION);
+            root->addString(stdext::format("mapbench %d %d %d %d %d", MAPBENCH_CLIENT_VERSION,
+                                           fixture.width, fixture.height, fixture.floors, fixture.seed));
+
+            const int minx = MAPBENCH_ORIGIN, maxx = MAPBENCH_ORIGIN + fixture.width - 1;
+            const int miny = MAPBENCH_ORIGIN, maxy = MAPBENCH_ORIGIN + fixture.height - 1;
+            for(int z = MAPBENCH_GROUND_FLOOR; z > MAPBENCH_GROUND_FLOOR - fixture.floors; --z) {
+                for(int ay = miny & 0xFF00; ay <= maxy; ay += 256) {
+                    for(int ax = minx & 0xFF00; ax <= maxx; ax += 256) {
+                        root->startNode(OTBM_TILE_AREA);
+                        root->addPos(ax, ay, z);
+                        for(int y = std::max(ay, miny); y <= std::min(ay + 255, maxy); ++y) {
+                            for(int x = std::max(ax, minx); x <= std::min(ax + 255, maxx); ++x) {
+                                // upper floors are sparse, like buildings over the ground floor
+                                if(z != MAPBENCH_GROUND_FLOOR && rng() % 4 != 0)
+                                    continue;
+
+                                root->startNode(OTBM_TILE);
+                                root->addPoint(Point(x, y) & 0xFF);
+                                root->addU8(OTBM_ATTR_ITEM);
+                                root->addU16(grounds[rng() % grounds.size()]);
+
+                                std::vector<uint16> items;
+                                if(rng() % 5 == 0)
+                                    items.push_back(borders[rng() % borders.size()]);
+                                if(rng() % 12 == 0)
+                                    items.push_back(bottoms[rng() % bottoms.size()]);
+                                if(rng() % 6 == 0)
+                                    items.push_back(commons[rng() % commons.size()]);
+                                if(rng() % 40 == 0)
+                                    items.push_back(tops[rng() % tops.size()]);
+                                for(uint16 id : items) {
+                                    root->startNode(OTBM_ITEM);
+                                    root->addU16(id);
+                                    root->endNode();
+                                }
+                                root->endNode(); // OTBM_TILE
+                            }
+                        }
+                        root->endNode(); // OTBM_TILE_AREA
+                    }
+                }
+            }
+
+            root->startNode(OTBM_TOWNS);
+            root->endNode();
+            root->startNode(OTBM_WAYPOINTS);
+            root->endNode();
+        }
+        root->endNode(); // OTBM_MAP_DATA
+    }
+    root->endNode();
+
+    fin->flush();
+    fin->close();
+}
+
+bool MapBenchmark::readFixture(MapBenchmarkFixture& fixture)
+{
+    std::vector<std::string> descriptions = g_map.getDescriptions();
+    if(descriptions.empty())
+        return false;
+
+    std::istringstream in(descriptions[0]);
+    std::string tag;
+    int version;
+    in >> tag >> version >> fixture.width >> fixture.height >> fixture.floors >> fixture.seed;
+    return !in.fail() && tag == "mapbench" && version == MAPBENCH_CLIENT_VERSION;
+}
+
+void MapBenchmark::loadMap(const std::string& dir, int clientVersion, bool sprites, std::map<std::string, std::string>& loadReport)
+{
+    // items.otb can't be loaded twice in the same process
+    if(m_loadedDir == dir)
+        return;
+    if(!m_loadedDir.empty())
+        stdext::throw_exception(stdext::format("map '%s' is already loaded", m_loadedDir));
+
+    g_game.setClientVersion(clientVersion);
+
+    stdext::timer timer;
+    if(!g_things.loadDat(dir + "/Tibia.dat"))
+        stdext::throw_exception("unable to load dat");
+    loadReport["dat_ms"] = toJsonMillis(timer.elapsed_micros());
+
+    if(sprites) {
+        timer.restart();
+        if(!g_sprites.loadSpr(dir + "/Tibia.spr"))
+            stdext::throw_exception("unable to load spr");
+        loadReport["spr_ms"] = toJsonMillis(timer.elapsed_micros());
+    }
+
+    timer.restart();
+    g_things.loadOtb(dir + "/items.otb");
+    if(!g_things.isOtbLoaded())
+        stdext::throw_exception("unable to load otb");
+    loadReport["otb_ms"] = toJsonMillis(timer.elapsed_micros());
+    m_loadedDir = dir;
+
+    g_map.clean();
+    timer.restart();
+    g_map.loadOtbm(dir + "/map.otbm");
+    loadReport["otbm_ms"] = toJsonMillis(timer.elapsed_micros());
+
+    if(sprites) {
+        // first access decodes every sprite of the spr file
+        timer.restart();
+        g_sprites.getSpriteImageCached(1);
+        loadReport["sprite_decode_ms"] = toJsonMillis(timer.elapsed_micros());
+    }
+}
+
+void MapBenchmark::loadFixture(const std::string& dir, MapBenchmarkFixture& fixture, std::map<std::string, std::string>& loadReport)
+{
+    loadMap(dir, MAPBENCH_CLIENT_VERSION, true, loadReport);
+    if(!readFixture(fixture))
+        stdext::throw_exception("map is not a benchmark fixture");
+}
+
+std::vector<Position> MapBenchmark::getChunks(const MapBenchmarkFixture& fixture)
+{
+    std::vector<Position> chunks;
+    for(int z = MAPBENCH_GROUND_FLOOR; z > MAPBENCH_GROUND_FLOOR - fixture.floors; --z) {
+        for(int x = MAPBENCH_ORIGIN / MAPBENCH_CHUNK_SIZE; x <= (MAPBENCH_ORIGIN + fixture.width - 1) / MAPBENCH_CHUNK_SIZE; ++x) {
+            for(int y = MAPBENCH_ORIGIN / MAPBENCH_CHUNK_SIZE; y <= (MAPBENCH_ORIGIN + fixture.height - 1) / MAPBENCH_CHUNK_SIZE; ++y)
+                chunks.push_back(Position(x, y, z));
+        }
+    }
+    return chunks;
+}
+
+std::string MapBenchmark::run(const std::string& dir, const std::vector<int>& threadCounts, const std::vector<std::string>& placements)
+{
+    try {
+        std::map<std::string, std::string> report, fixtureReport, loadReport;
+
+        MapBenchmarkFixture fixture;
+        loadFixture(dir, fixture, loadReport);
+        std::vector<Position> chunks = getChunks(fixture);
+
+        fixtureReport["chunks"] = stdext::to_string(chunks.size());
+        fixtureReport["client_version"] = stdext::to_string(MAPBENCH_CLIENT_VERSION);
+        fixtureReport["floors"] = stdext::to_string(fixture.floors);
+        fixtureReport["height"] = stdext::to_string(fixture.height);
+        fixtureReport["seed"] = stdext::to_string(fixture.seed);
+        fixtureReport["sprites"] = stdext::to_string(g_sprites.getSpritesCount());
+        fixtureReport["tiles"] = stdext::to_string(g_map.getTiles().size());
+        fixtureReport["width"] = stdext::to_string(fixture.width);
+
+        stdext::timer timer;
+        struct RenderStats {
+            RenderStats() : renderTime(0), encodeTime(0), outputBytes(0), written(0) { }
+            ticks_t renderTime;
+            ticks_t encodeTime;
+            uint64 outputBytes;
+            int written;
+        };
+
+        fixtureReport["cpus"] = stdext::to_string(g_workerPlacement.getCpuCount());
+        fixtureReport["numa_nodes"] = stdext::to_string(g_workerPlacement.getNodeCount());
+
+        std::string renderReports;
+        for(const std::string& placement : placements) {
+            // free: threads float and share one chunk counter, pinned: threads are pinned and render contiguous
+            // chunk ranges, numa: pinned with a sprite copy per numa node
+            if(placement != "free" && placement != "pinned" && placement != "numa")
+                stdext::throw_exception(stdext::format("unknown placement '%s'", placement));
+            bool pinned = placement != "free";
+            g_workerPlacement.setAffinityEnabled(pinned);
+            g_sprites.setNumaReplication(placement == "numa");
+
+            double baseChunksPerSecond = 0;
+            int baseThreads = 0;
+            for(int threads : threadCounts) {
+                if(threads <= 0)
+                    continue;
+
+                std::vector<RenderStats> stats(threads);
+                std::atomic<size_t> nextChunk(0);
+                WorkerRanges ranges(chunks.size(), threads);
+                std::vector<std::thread> workers;
+
+                // sprite copies of every node are made before the timed run
+                if(placement == "numa") {
+                    for(int t = 0; t < threads; ++t) {
+                        workers.emplace_back([t]() {
+                            g_workerPlacement.place(t);
+                            g_sprites.getSpriteImageCached(1);
+                        });
+                    }
+                    for(std::thread& worker : workers)
+                        worker.join();
+                    workers.clear();
+                }
+
+                uint64 allocations = g_mapBenchmarkAllocations;
+                timer.restart();
+                for(int t = 0; t < threads; ++t) {
+                    workers.emplace_back([&, t]() {
+                        RenderStats& stat = stats[t];
+                        g_workerPlacement.place(t);
+                        // reused by every chunk of the thread, like the buffers of Map::drawMap
+                        ImagePtr image(new Image(Size(1, 1)));
+                        png_encoder *encoder = create_png_encoder();
+                        std::string data;
+                        size_t i;
+                        while(pinned ? ranges.next(t, i) : (i = nextChunk.fetch_add(1)) < chunks.size()) {
+                            const Position& chunk = chunks[i];
+                            stdext::timer chunkTimer;
+                            g_map.drawMapImage(image, chunk.x * MAPBENCH_CHUNK_SIZE, chunk.y * MAPBENCH_CHUNK_SIZE, chunk.z, MAPBENCH_CHUNK_SIZE);
+                            stat.renderTime += chunkTimer.elapsed_micros();
+
+                            chunkTimer.restart();
+                            if(image->encodePNG(data, encoder)) {
+                                stat.outputBytes += data.size();
+                                stat.written++;
+                            }
+                            stat.encodeTime += chunkTimer.elapsed_micros();
+                        }
+                        free_png_encoder(encoder);
+                    });
+                }
+                for(std::thread& worker : workers)
+                    worker.join();
+                ticks_t wallTime = timer.elapsed_micros();
+                allocations = g_mapBenchmarkAllocations - allocations;
+
+                RenderStats total;
+                for(const RenderStats& stat : stats) {
+                    total.renderTime += stat.renderTime;
+                    total.encodeTime += stat.encodeTime;
+                    total.outputBytes += stat.outputBytes;
+                    total.written += stat.written;
+                }
+
+                // scaling against the first thread count of the placement
+                double chunksPerSecond = chunks.size() * 1000000.0 / std::max<ticks_t>(wallTime, 1);
+                if(baseThreads == 0) {
+                    baseChunksPerSecond = chunksPerSecond;
+                    baseThreads = threads;
+                }
+                double speedup = chunksPerSecond / baseChunksPerSecond;
+
+                std::map<std::string, std::string> renderReport;
+                renderReport["allocations"] = stdext::to_string(allocations);
+                renderReport["chunks_per_second"] = stdext::format("%.3f", chunksPerSecond);
+                renderReport["efficiency"] = stdext::format("%.3f", speedup * baseThreads / threads);
+                renderReport["encode_ms"] = toJsonMillis(total.encodeTime);
+                renderReport["output_bytes"] = stdext::to_string(total.outputBytes);
+                renderReport["placement"] = "\"" + placement + "\"";
+                renderReport["render_ms"] = toJsonMillis(total.renderTime);
+                renderReport["speedup"] = stdext::format("%.3f", speedup);
+                renderReport["threads"] = stdext::to_string(threads);
+                renderReport["wall_ms"] = toJsonMillis(wallTime);
+                renderReport["written_chunks"] = stdext::to_string(total.written);
+
+                if(!renderReports.empty())
+                    renderReports += ", ";
+                renderReports += toJson(renderReport);
+            }
+        }
+        g_workerPlacement.setAffinityEnabled(false);
+        g_sprites.setNumaReplication(false);
+
+        // Map::encodeMapImage after its thread buffers are warm must not allocate at all, png and apng output
+        bool animatedOutput = g_map.isAnimatedOutput();
+        for(bool animated : { false, true }) {
+            g_map.setAnimatedOutput(animated);
+            std::vector<Position> sample(chunks.begin(), chunks.begin() + (animated ? std::min<size_t>(chunks.size(), MAPBENCH_ANIMATED_SAMPLE) : chunks.size()));
+            std::string data;
+            for(const Position& chunk : sample)
+                g_map.encodeMapImage(data, chunk.x * MAPBENCH_CHUNK_SIZE, chunk.y * MAPBENCH_CHUNK_SIZE, chunk.z, MAPBENCH_CHUNK_SIZE);
+            uint64 allocations = g_mapBenchmarkAllocations;
+            for(const Position& chunk : sample)
+                g_map.encodeMapImage(data, chunk.x * MAPBENCH_CHUNK_SIZE, chunk.y * MAPBENCH_CHUNK_SIZE, chunk.z, MAPBENCH_CHUNK_SIZE);
+            report[animated ? "steady_state_allocations_per_animated_chunk" : "steady_state_allocations_per_chunk"] =
+                stdext::format("%.3f", (double)(g_mapBenchmarkAllocations - allocations) / std::max<size_t>(sample.size(), 1));
+        }
+        g_map.setAnimatedOutput(animatedOutput);
+
+        report["fixture"] = toJson(fixtureReport);
+        report["load"] = toJson(loadReport);
+        report["peak_memory_bytes"] = stdext::format("%.0f", g_platform.getPeakMemoryUsage());
+        report["render"] = "[" + renderReports + "]";
+        report["version"] = stdext::to_string(MAPBENCH_REPORT_VERSION);
+        return toJson(report);
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Map benchmark failed: %s", e.what()));
+        return std::string();
+    }
+}
+
+std::vector<uint64> MapBenchmark::renderDigests(const std::vector<Position>& chunks, int threads, int offset)
+{
+    std::vector<uint64> digests(chunks.size(), 0);
+    std::atomic<size_t> nextChunk(0);
+    std::vector<std::thread> workers;
+
+    for(int t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            size_t n;
+            while((n = nextChunk.fetch_add(1)) < chunks.size()) {
+                // start every round somewhere else so chunks meet different neighbours in other threads
+                size_t i = (n + offset) % chunks.size();
+                const Position& chunk = chunks[i];
+                ImagePtr image = g_map.renderMapImage(chunk.x * MAPBENCH_CHUNK_SIZE, chunk.y * MAPBENCH_CHUNK_SIZE, chunk.z, MAPBENCH_CHUNK_SIZE);
+                if(!image->isBlited())
+                    continue;
+
+                // fnv-1a over size and pixels
+                uint64 digest = 14695981039346656037ULL;
+                auto hash = [&digest](const uint8* data, size_t size) {
+                    for(size_t b = 0; b < size; ++b) {
+                        digest ^= data[b];
+                        digest *= 1099511628211ULL;
+                    }
+                };
+                uint8 size[4];
+                stdext::writeULE16(size, image->getWidth());
+                stdext::writeULE16(size + 2, image->getHeight());
+                hash(size, 4);
+                hash(image->getPixelData(), image->getPixels().size());
+                digests[i] = digest;
+            }
+        });
+    }
+    for(std::thread& worker : workers)
+        worker.join();
+    return digests;
+}
+
+bool MapBenchmark::verify(const std::string& dir, const std::string& goldenFile, bool updateGolden, int threads, int rounds)
+{
+    try {
+        std::map<std::string, std::string> loadReport;
+        MapBenchmarkFixture fixture;
+        loadFixture(dir, fixture, loadReport);
+        std::vector<Position> chunks = getChunks(fixture);
+        const std::string header = stdext::format("mapbench %d %d %d %d %d", MAPBENCH_CLIENT_VERSION,
+                                                  fixture.width, fixture.height, fixture.floors, fixture.seed);
+
+        std::vector<uint64> reference = renderDigests(chunks, 1, 0);
+
+        int mismatches = 0;
+        auto reportMismatch = [&](size_t i, uint64 expected, uint64 got, const std::string& where) {
+            if(mismatches++ < 10)
+                g_logger.error(stdext::format("chunk %d %d %d differs %s: expected %016llx, got %016llx",
+                                              chunks[i].x, chunks[i].y, (int)chunks[i].z, where, (unsigned long long)expected, (unsigned long long)got));
+        };
+
+        for(int round = 0; round < rounds; ++round) {
+            std::vector<uint64> digests = renderDigests(chunks, threads, round * (chunks.size() / std::max<int>(rounds, 1)));
+            for(size_t i = 0; i < chunks.size(); ++i) {
+                if(digests[i] != reference[i])
+                    reportMismatch(i, reference[i], digests[i], stdext::format("with %d threads (round %d)", threads, round));
+            }
+        }
+
+        if(updateGolden) {
+            std::stringstream golden;
+            golden << header << "\n";
+            for(size_t i = 0; i < chunks.size(); ++i)
+                golden << chunks[i].x << " " << chunks[i].y << " " << (int)chunks[i].z << " " << stdext::format("%016llx", (unsigned long long)reference[i]) << "\n";
+            if(!writeGoldenFile(goldenFile, golden.str()))
+                stdext::throw_exception(stdext::format("unable to write '%s'", goldenFile));
+            g_logger.info(stdext::format("Golden digests of %d chunks written to '%s'", (int)chunks.size(), goldenFile));
+        } else {
+            std::stringstream golden(readGoldenFile(goldenFile));
+            std::string line;
+            std::getline(golden, line);
+            stdext::trim(line);
+            if(line != header)
+                stdext::throw_exception(stdext::format("golden file '%s' was recorded for '%s', fixture is '%s'", goldenFile, line, header));
+
+            std::map<std::tuple<int, int, int>, uint64> expected;
+            int x, y, z;
+            std::string digest;
+            while(golden >> x >> y >> z >> digest)
+                expected[std::make_tuple(x, y, z)] = stdext::hex_to_dec(digest);
+
+            if(expected.size() != chunks.size())
+                stdext::throw_exception(stdext::format("golden file has %d chunks, fixture has %d", (int)expected.size(), (int)chunks.size()));
+
+            for(size_t i = 0; i < chunks.size(); ++i) {
+                auto it = expected.find(std::make_tuple((int)chunks[i].x, (int)chunks[i].y, (int)chunks[i].z));
+                uint64 golden = it != expected.end() ? it->second : 0;
+                if(golden != reference[i])
+                    reportMismatch(i, golden, reference[i], "from golden file");
+            }
+        }
+
+        if(mismatches > 0) {
+            g_logger.error(stdext::format("Map image verification failed: %d chunk digests differ", mismatches));
+            return false;
+        }
+        g_logger.info(stdext::format("Map image verification passed: %d chunks, %d threads, %d rounds", (int)chunks.size(), threads, rounds));
+        return true;
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Map image verification failed: %s", e.what()));
+        return false;
+    }
+}
+
+std::string MapBenchmark::benchmarkTileIndex(const std::string& dir, int clientVersion, int rounds)
+{
+    try {
+        std::map<std::string, std::string> report, loadReport;
+        loadMap(dir, clientVersion, false, loadReport);
+
+        // every tile and its neighbours, like the renderer and Item::calculatePatterns probe them
+        std::vector<Position> probes;
+        size_t blocks = 0;
+        const TileList tiles = g_map.getTiles();
+        for(const TilePtr& tile : tiles) {
+            const Position& pos = tile->getPosition();
+            for(int dx = -1; dx <= 1; ++dx) {
+                for(int dy = -1; dy <= 1; ++dy)
+                    probes.push_back(Position(pos.x + dx, pos.y + dy, pos.z));
+            }
+        }
+
+        bool wasPaged = g_map.isPagedTileIndex();
+        for(bool paged : { false, true }) {
+            stdext::timer timer;
+            g_map.setPagedTileIndex(paged);
+            ticks_t buildTime = timer.elapsed_micros();
+
+            size_t found = 0;
+            timer.restart();
+            for(int round = 0; round < rounds; ++round) {
+                for(const Position& pos : probes) {
+                    if(g_map.getTile(pos))
+                        found++;
+                }
+            }
+            ticks_t lookupTime = timer.elapsed_micros();
+
+            std::map<std::string, std::string> indexReport;
+            indexReport["build_ms"] = toJsonMillis(buildTime);
+            indexReport["found"] = stdext::to_string(found);
+            indexReport["lookup_ms"] = toJsonMillis(lookupTime);
+            indexReport["lookups_per_second"] = stdext::format("%.0f", probes.size() * (double)rounds * 1000000.0 / std::max<ticks_t>(lookupTime, 1));
+            indexReport["memory_bytes"] = stdext::to_string(g_map.getTileIndexMemoryUsage());
+            report[paged ? "paged" : "hash"] = toJson(indexReport);
+        }
+        g_map.setPagedTileIndex(wasPaged);
+
+        for(int z = 0; z <= Otc::MAX_Z; ++z)
+            blocks += g_map.getTileBlockCount(z);
+
+        report["blocks"] = stdext::to_string(blocks);
+        report["load"] = toJson(loadReport);
+        report["lookups"] = stdext::to_string(probes.size() * rounds);
+        report["tiles"] = stdext::to_string(tiles.size());
+        report["version"] = stdext::to_string(MAPBENCH_REPORT_VERSION);
+        return toJson(report);
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Tile index benchmark failed: %s", e.what()));
+        return std::string();
+    }
+}
+
+std::string MapBenchmark::benchmarkMapLoading(const std::string& dir, int clientVersion, int rounds)
+{
+    try {
+        std::map<std::string, std::string> report, loadReport;
+        loadMap(dir, clientVersion, false, loadReport);
+        size_t tiles = g_map.getTiles().size();
+
+        bool wasArena = g_map.isArenaAllocation();
+        g_map.clean();
+        for(bool arena : { false, true }) {
+            g_map.setArenaAllocation(arena);
+
+            ticks_t loadTime = 0, cleanTime = 0;
+            uint64 loadAllocations = 0;
+            size_t arenaMemory = 0;
+            for(int round = 0; round < rounds; ++round) {
+                uint64 allocations = g_mapBenchmarkAllocations;
+                stdext::timer timer;
+                g_map.loadOtbm(dir + "/map.otbm");
+                loadTime += timer.elapsed_micros();
+                loadAllocations += g_mapBenchmarkAllocations - allocations;
+                arenaMemory = g_map.getArenaMemoryUsage();
+
+                timer.restart();
+                g_map.clean();
+                cleanTime += timer.elapsed_micros();
+            }
+
+            std::map<std::string, std::string> modeReport;
+            modeReport["arena_bytes"] = stdext::to_string(arenaMemory);
+            modeReport["clean_ms"] = toJsonMillis(cleanTime / std::max(rounds, 1));
+            modeReport["load_allocations"] = stdext::to_string(loadAllocations / std::max(rounds, 1));
+            modeReport["load_ms"] = toJsonMillis(loadTime / std::max(rounds, 1));
+            report[arena ? "arena" : "heap"] = toJson(modeReport);
+        }
+        g_map.setArenaAllocation(wasArena);
+        g_map.loadOtbm(dir + "/map.otbm");
+
+        for(std::string format : { "otbm", "otcm" }) {
+            uint64 allocations = g_mapBenchmarkAllocations;
+            stdext::timer timer;
+            if(format == "otbm")
+                g_map.saveOtbm(dir + "/save.otbm");
+            else
+                g_map.saveOtcm(dir + "/save.otcm");
+
+            std::map<std::string, std::string> saveReport;
+            saveReport["allocations"] = stdext::to_string(g_mapBenchmarkAllocations - allocations);
+            saveReport["ms"] = toJsonMillis(timer.elapsed_micros());
+            report["save_" + format] = toJson(saveReport);
+        }
+
+        report["load"] = toJson(loadReport);
+        report["rounds"] = stdext::to_string(rounds);
+        report["tile_bytes"] = stdext::to_string(sizeof(Tile));
+        report["tiles"] = stdext::to_string(tiles);
+        report["version"] = stdext::to_string(MAPBENCH_REPORT_VERSION);
+        return toJson(report);
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Map loading benchmark failed: %s", e.what()));
+        return std::string();
+    }
+}
+
+std::string MapBenchmark::benchmarkPathFinding(const std::string& dir, int paths, int maxComplexity)
+{
+    try {
+        std::map<std::string, std::string> report, loadReport;
+        MapBenchmarkFixture fixture;
+        loadFixture(dir, fixture, loadReport);
+
+        // be aware of the whole fixture, so every tile is taken from the map and not the minimap
+        Position center(MAPBENCH_ORIGIN + fixture.width / 2, MAPBENCH_ORIGIN + fixture.height / 2, MAPBENCH_GROUND_FLOOR);
+        AwareRange range;
+        range.left = range.right = fixture.width / 2 + 1;
+        range.top = range.bottom = fixture.height / 2 + 1;
+        g_map.setCentralPosition(center);
+        g_map.setAwareRange(range);
+
+        std::vector<Position> walkable;
+        for(const TilePtr& tile : g_map.getTileRange(MAPBENCH_GROUND_FLOOR)) {
+            if(tile->isWalkable() && tile->isPathable())
+                walkable.push_back(tile->getPosition());
+        }
+        if(walkable.empty())
+            stdext::throw_exception("fixture has no walkable tiles");
+
+        std::mt19937 random(fixture.seed);
+        std::vector<std::pair<Position, Position>> queries;
+        for(int i = 0; i < paths; ++i)
+            queries.push_back(std::make_pair(walkable[random() % walkable.size()], walkable[random() % walkable.size()]));
+
+        std::map<int, int> results;
+        size_t steps = 0;
+        stdext::timer timer;
+        for(const auto& query : queries) {
+            auto path = g_map.findPath(query.first, query.second, maxComplexity, 0);
+            results[std::get<1>(path)]++;
+            steps += std::get<0>(path).size();
+        }
+        ticks_t elapsed = timer.elapsed_micros();
+        g_map.resetAwareRange();
+
+        report["found"] = stdext::to_string(results[Otc::PathFindResultOk]);
+        report["load"] = toJson(loadReport);
+        report["max_complexity"] = stdext::to_string(maxComplexity);
+        report["no_way"] = stdext::to_string(results[Otc::PathFindResultNoWay]);
+        report["paths"] = stdext::to_string(queries.size());
+        report["paths_per_second"] = stdext::format("%.3f", queries.size() * 1000000.0 / std::max<ticks_t>(elapsed, 1));
+        report["steps"] = stdext::to_string(steps);
+        report["too_far"] = stdext::to_string(results[Otc::PathFindResultTooFar]);
+        report["total_ms"] = toJsonMillis(elapsed);
+        report["version"] = stdext::to_string(MAPBENCH_REPORT_VERSION);
+        return toJson(report);
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Path finding benchmark failed: %s", e.what()));
+        return std::string();
+    }
+}
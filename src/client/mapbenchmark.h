@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef MAPBENCHMARK_H
+#define MAPBENCHMARK_H
+
+#include "declarations.h"
+#include "position.h"
+
+enum {
+    MAPBENCH_CLIENT_VERSION = 1076,
+    MAPBENCH_ORIGIN = 1024,
+    MAPBENCH_GROUND_FLOOR = 7,
+    MAPBENCH_CHUNK_SIZE = 8,
+    MAPBENCH_ANIMATED_SAMPLE = 64, // chunks encoded with animated output, every one has many frames
+    MAPBENCH_REPORT_VERSION = 1
+};
+
+struct MapBenchmarkFixture
+{
+    MapBenchmarkFixture() : width(256), height(256), floors(2), seed(1) { }
+    int width;
+    int height;
+    int floors;
+    uint32 seed;
+};
+
+// Generates synthetic dat/spr/otb/otbm fixtures and measures the map image
+// pipeline (load, sprite decode, blit, png encode) against them.
+class MapBenchmark
+{
+public:
+    void generateFixture(const std::string& dir, const MapBenchmarkFixture& fixture);
+    // placements: free (unpinned threads), pinned (pinned threads rendering contiguous chunk ranges), numa (pinned with sprite copies per numa node)
+    std::string run(const std::string& dir, const std::vector<int>& threadCounts, const std::vector<std::string>& placements);
+    // compares pixel digests of every chunk rendered single threaded, by many threads and against a golden file,
+    // which is a file of the source tree when it exists there or else a file of the write directory
+    bool verify(const std::string& dir, const std::string& goldenFile, bool updateGolden, int threads, int rounds);
+    // compares getTile throughput and index memory of the hash and paged tile block index on any map
+    std::string benchmarkTileIndex(const std::string& dir, int clientVersion, int rounds);
+    // paths per second of Map::findPath between random walkable tiles of the fixture
+    std::string benchmarkPathFinding(const std::string& dir, int paths, int maxComplexity);
+    // otbm load and clean times with tiles and items allocated from the heap and from arenas, then otbm/otcm save times
+    std::string benchmarkMapLoading(const std::string& dir, int clientVersion, int rounds);
+
+private:
+    void loadMap(const std::string& dir, int clientVersion, bool sprites, std::map<std::string, std::string>& loadReport);
+    void loadFixture(const std::string& dir, MapBenchmarkFixture& fixture, std::map<std::string, std::string>& loadReport);
+    std::vector<Position> getChunks(const MapBenchmarkFixture& fixture);
+    std::vector<uint64> renderDigests(const std::vector<Position>& chunks, int threads, int offset);
+    void writeDat(const std::string& fileName);
+    void writeSpr(const std::string& fileName, uint32 seed);
+    void writeOtb(const std::string& fileName);
+    void writeOtbm(const std::string& fileName, const MapBenchmarkFixture& fixture);
+    bool readFixture(MapBenchmarkFixture& fixture);
+
+    std::string m_loadedDir;
+};
+
+extern MapBenchmark g_mapBenchmark;
+// counted by the operator new of otclient_mapbench, always 0 in other executables
+extern std::atomic<uint64> g_mapBenchmarkAllocations;
+
+#endif
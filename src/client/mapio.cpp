@@ -23,6 +23,11 @@
 #include "map.h"
 #include "tile.h"
 #include "game.h"
+#include "maprenderjob.h"
+#include "thingtype.h"
+#include "blockdirectory.h"
+#include "mapjob.h"
+#include "workerplacement.h"
 
 #include <framework/core/application.h>
 #include <framework/core/eventdispatcher.h>
@@ -32,6 +37,58 @@
 #include <framework/xml/tinyxml.h>
 #include <framework/ui/uiwidget.h>
 #include <framework/graphics/image.h>
+#include <framework/platform/platform.h>
+
+#include <framework/graphics/apngloader.h>
+
+#include <boost/asio/ip/host_name.hpp>
+#include <boost/thread/tss.hpp>
+#include <zlib.h>
+#include <future>
+
+// buffers of one render thread, reused for every chunk it draws
+struct MapRenderScratch
+{
+    MapRenderScratch() : encoder(create_png_encoder()) { }
+    ~MapRenderScratch() { free_png_encoder(encoder); }
+
+    ImagePtr canvas;
+    png_encoder *encoder;
+    std::string image;
+    std::string path;
+
+    // animated output, frames grow to the longest timeline drawn by the thread
+    std::vector<ImagePtr> frames;
+    std::vector<unsigned char*> framePixels;
+    std::vector<unsigned int> frameDelays;
+    std::vector<int> timeline;
+    std::vector<ThingType*> animatedTypes;
+    std::vector<int> animationCycles;
+};
+
+static boost::thread_specific_ptr<MapRenderScratch> renderScratch;
+
+static MapRenderScratch& getRenderScratch()
+{
+    if(!renderScratch.get())
+        renderScratch.reset(new MapRenderScratch);
+    return *renderScratch;
+}
+
+void mapChunkFile(std::string& path, int x, int y, int z)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "map/%d_%d_%d.png", x, y, z);
+    //snprintf(buffer, sizeof(buffer), "map/%d/%d/%d_%d_%d.png", z, x, z, x, y);
+    path.assign(buffer);
+}
+
+void mapChunkGenerator(int x, int y, int z)
+{
+    MapRenderScratch& scratch = getRenderScratch();
+    mapChunkFile(scratch.path, x, y, z);
+    g_map.drawMap(scratch.path, x * 8, y * 8, z, 8);
+}
 
 void mapPartGenerator(int minx, int miny, int minz, int maxx, int maxy, int maxz)
 {
@@ -45,22 +102,24 @@ void mapPartGenerator(int minx, int miny, int minz, int maxx, int maxy, int maxz
             std::stringstream path2;
             path2 << "map/" << z << "/" << x;
             g_resources.makeDir(path2.str());
-            for(int y = miny; y <= maxy; y++)
-            {
-                std::stringstream path3;
-                path3 << "map/"<< x << "_" << y << "_" << z << ".png";
-                //path3 << "map/" << z << "/" << x << "/" << z << "_" << x << "_" << y << ".png";
-                g_map.drawMap(path3.str(), x * 8, y * 8, z, 8);
-            }
         }
+        for(const Point& chunk : getHilbertChunks(minx, miny, maxx, maxy))
+            mapChunkGenerator(chunk.x, chunk.y, z);
     }
 }
 
 class MapGenWorkItem
 {
 public:
-    static MapGenWorkItem* make(int minx, int miny, int minz, int maxx, int maxy, int maxz) {
-        return new MapGenWorkItem(minx, miny, minz, maxx, maxy, maxz);
+    virtual ~MapGenWorkItem() {}
+    virtual void execute() = 0;
+};
+
+class MapAreaWorkItem : public MapGenWorkItem
+{
+public:
+    static MapAreaWorkItem* make(int minx, int miny, int minz, int maxx, int maxy, int maxz) {
+        return new MapAreaWorkItem(minx, miny, minz, maxx, maxy, maxz);
     }
 
     void execute() {
@@ -69,7 +128,7 @@ public:
 
 private:
     int minx, miny, minz, maxx, maxy, maxz;
-    MapGenWorkItem(int minx, int miny, int minz, int maxx, int maxy, int maxz):
+    MapAreaWorkItem(int minx, int miny, int minz, int maxx, int maxy, int maxz):
         minx(minx),
         miny(miny),
         minz(minz),
@@ -78,19 +137,223 @@ private:
         maxz(maxz) {}
 };
 
+std::atomic<int> activeShardWorkers {0};
+std::atomic<int> activeRenderJobs {0};
+
+// workers of one startRenderJob, the last one to stop finishes its job
+struct MapShardRun
+{
+    MapShardRun(const MapJobStatePtr& state, int workers) : state(state), running(workers) {}
+
+    MapJobStatePtr state;
+    std::atomic<int> running;
+    std::mutex errorMutex;
+    std::string error;
+};
+
+// claims shards of a render job until none is left
+class MapShardWorkItem : public MapGenWorkItem
+{
+public:
+    enum { CHECKPOINT_INTERVAL = 16 };
+
+    static MapShardWorkItem* make(const std::shared_ptr<MapRenderJob>& job, const std::string& owner, const std::shared_ptr<TileArchiveWriter>& archive,
+                                  const std::shared_ptr<MapShardRun>& run) {
+        return new MapShardWorkItem(job, owner, archive, run);
+    }
+
+    void execute() {
+        const MapJobStatePtr& state = run->state;
+        int shard = -1;
+        try {
+            while(state->waitWhilePaused() && (shard = job->claimShard(owner)) >= 0) {
+                const MapRenderShard& area = job->getShard(shard);
+                std::vector<Point> chunks = job->getShardChunks(shard);
+                // chunks before the last checkpoint are already rendered
+                int synced = job->getCheckpoint(shard);
+                int chunk = synced;
+                bool owned = true;
+                while(owned && chunk < (int)chunks.size() && state->waitWhilePaused()) {
+                    mapChunkGenerator(chunks[chunk].x, chunks[chunk].y, area.z);
+                    if(++chunk % CHECKPOINT_INTERVAL == 0) {
+                        syncChunks(chunks, synced, chunk, area.z);
+                        synced = chunk;
+                        owned = job->checkpoint(shard, owner, chunk);
+                    }
+                }
+                if(!owned) // the lock belongs to the new owner, so it is not released
+                    g_logger.warning(stdext::format("Render job worker '%s' lost shard %d to another worker", owner, shard));
+                else if(chunk < (int)chunks.size()) {
+                    // cancelled, the next owner of the shard continues after the chunks rendered so far
+                    syncChunks(chunks, synced, chunk, area.z);
+                    if(job->checkpoint(shard, owner, chunk))
+                        job->release(shard);
+                } else {
+                    syncChunks(chunks, synced, chunks.size(), area.z);
+                    job->complete(shard);
+                    state->done = job->getCompletedCount();
+                }
+                shard = -1;
+            }
+        } catch(std::exception& e) {
+            g_logger.error(stdext::format("Render job worker '%s' failed: %s", owner, e.what()));
+            // other workers can take the shard over right away instead of waiting for the lock to go stale
+            if(shard >= 0)
+                job->release(shard);
+            std::lock_guard<std::mutex> lock(run->errorMutex);
+            if(run->error.empty())
+                run->error = e.what();
+        }
+        activeShardWorkers--;
+
+        if(--run->running == 0) {
+            if(!run->error.empty())
+                state->finish(false, run->error);
+            else if(state->cancelled)
+                state->finish(false, "cancelled");
+            else
+                state->finish(true);
+        }
+    }
+
+private:
+    // waits until the chunks are on disk, chunk images of an archive are there after its next checkpoint
+    void syncChunks(const std::vector<Point>& chunks, int begin, int end, int z) {
+        if(archive) {
+            std::promise<bool> written;
+            std::future<bool> result = written.get_future();
+            archive->addBarrier([&written](bool durable) { written.set_value(durable); }, true);
+            if(!result.get())
+                stdext::throw_exception("tile archive failed");
+            return;
+        }
+
+        std::string fileName;
+        for(int chunk = begin; chunk < end; ++chunk) {
+            mapChunkFile(fileName, chunks[chunk].x, chunks[chunk].y, z);
+            // empty chunks are not saved
+            if(g_resources.fileExists(fileName))
+                g_platform.syncFile(g_resources.getRealPath(fileName));
+        }
+    }
+
+    std::shared_ptr<MapRenderJob> job;
+    std::string owner;
+    std::shared_ptr<TileArchiveWriter> archive;
+    std::shared_ptr<MapShardRun> run;
+    MapShardWorkItem(const std::shared_ptr<MapRenderJob>& job, const std::string& owner, const std::shared_ptr<TileArchiveWriter>& archive,
+                     const std::shared_ptr<MapShardRun>& run):
+        job(job),
+        owner(owner),
+        archive(archive),
+        run(run) {}
+};
+
+struct MapChunkArea
+{
+    int minx, miny, maxx, maxy, z; // chunk coordinates, inclusive
+
+    int getChunkCount() const { return (maxx - minx + 1) * (maxy - miny + 1); }
+    bool contains(const MapChunkArea& other) const {
+        return z == other.z && minx <= other.minx && miny <= other.miny && maxx >= other.maxx && maxy >= other.maxy;
+    }
+};
+
+// Areas rendered by renderAsync, one "z minx miny maxx maxy" line per area. Areas are written
+// only after their images are synced to disk (or to a tile archive checkpoint), so a job started
+// again after a stop or a crash can skip them without losing images.
+class MapRenderProgress
+{
+public:
+    enum { SYNC_INTERVAL = 16 };
+
+    MapRenderProgress(const std::string& fileName) : m_fileName(fileName) {
+        if(!g_resources.fileExists(fileName))
+            return;
+        std::istringstream in(g_resources.readFileContents(fileName));
+        MapChunkArea area;
+        while(in >> area.z >> area.minx >> area.miny >> area.maxx >> area.maxy)
+            m_completed.push_back(area);
+    }
+
+    bool isCompleted(const MapChunkArea& area) {
+        for(const MapChunkArea& completed : m_completed) {
+            if(completed.contains(area))
+                return true;
+        }
+        return false;
+    }
+
+    void complete(const MapChunkArea& area, const std::vector<std::string>& files) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pendingAreas.push_back(area);
+        m_pendingFiles.insert(m_pendingFiles.end(), files.begin(), files.end());
+        if(m_pendingAreas.size() >= SYNC_INTERVAL)
+            sync();
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(!m_pendingAreas.empty())
+            sync();
+    }
+
+private:
+    void sync() {
+        for(const std::string& file : m_pendingFiles)
+            g_platform.syncFile(g_resources.getRealPath(file));
+        m_pendingFiles.clear();
+
+        m_completed.insert(m_completed.end(), m_pendingAreas.begin(), m_pendingAreas.end());
+        m_pendingAreas.clear();
+
+        std::stringstream out;
+        for(const MapChunkArea& area : m_completed)
+            out << area.z << " " << area.minx << " " << area.miny << " " << area.maxx << " " << area.maxy << "\n";
+
+        // replaced at once, a crash while writing keeps the previous list
+        std::string tmpFile = m_fileName + ".tmp";
+        if(!g_resources.writeFileContents(tmpFile, out.str()))
+            return;
+        std::string realTmpFile = g_resources.getRealPath(tmpFile);
+        g_platform.syncFile(realTmpFile);
+        std::string realFile = g_resources.getRealDir(tmpFile) + "/" + m_fileName;
+        if(std::rename(realTmpFile.c_str(), realFile.c_str()) != 0) {
+            // windows does not replace existing files
+            g_platform.removeFile(realFile);
+            if(std::rename(realTmpFile.c_str(), realFile.c_str()) != 0)
+                g_logger.error(stdext::format("Unable to write '%s'", m_fileName));
+        }
+    }
+
+    std::string m_fileName;
+    std::vector<MapChunkArea> m_completed;
+    std::vector<MapChunkArea> m_pendingAreas;
+    std::vector<std::string> m_pendingFiles;
+    std::mutex m_mutex;
+};
+
+// notifications sent while nobody waits are kept, so a worker that found its queue empty
+// just before an item was pushed does not sleep with work pending
 class Monitor {
 public:
 	void wait() {
 		std::unique_lock<std::mutex> lock {mtx};
-		cv.wait(lock);
+		cv.wait(lock, [this]() { return signalled; });
+		signalled = false;
 	}
 
 	void notify() {
+		{
+			std::lock_guard<std::mutex> lock {mtx};
+			signalled = true;
+		}
 		cv.notify_one();
 	}
 private:
 	std::mutex mtx;
 	std::condition_variable cv;
+	bool signalled {false};
 };
 
 template <typename WorkItemType>
@@ -105,7 +368,7 @@ public:
         if (workers.empty()) {
             lastWorkerPushed = 0;
             for (int i = 0; i < workerCount; ++i) {
-                workers.emplace_back(new Worker(itemsPerWorker, *this));
+                workers.emplace_back(new Worker(i, itemsPerWorker, *this));
             }
             return true;
         } else {
@@ -117,6 +380,11 @@ public:
         return completedWorkItems.load(std::memory_order_relaxed);
     }
 
+    // items pushed but not executed yet
+    int64_t getPendingCount() const {
+        return pushedWorkItems.load() - completedWorkItems.load();
+    }
+
     bool completed() const {
         return workers.empty();
     }
@@ -125,14 +393,17 @@ public:
         lastWorkerPushed = (lastWorkerPushed + 1) % workers.size(); //Round-Robin work scheduling
         auto ret = workers[lastWorkerPushed]->workItemQueue.push(workItem);
         if (ret) {
+            pushedWorkItems.fetch_add(1);
             workers[lastWorkerPushed]->notify();
         }
         return ret;
     }
 
+    // workers finish the items already queued before they stop
     void signalCompletion() {
         for(const auto& worker : workers) {
-            while(worker->workItemQueue.push(nullptr));
+            while(!worker->workItemQueue.push(nullptr))
+                std::this_thread::yield();
             worker->notify();
         }
         joinAll();
@@ -155,12 +426,14 @@ private:
     struct Worker : Monitor
     {
         typedef boost::lockfree::spsc_queue<WorkItemType*> WorkItemQueue;
-        Worker(int maxItemsPerWorker, WorkQueue& queue):
+        Worker(int index, int maxItemsPerWorker, WorkQueue& queue):
+            index(index),
             queue(queue),
             workItemQueue(maxItemsPerWorker),
             thread(&Worker::workerLoop, this) {}
 
         void workerLoop() {
+            g_workerPlacement.place(index);
             while(true) {
                 WorkItemHolder work;
                 if(workItemQueue.pop(work.ptr)) {
@@ -182,6 +455,7 @@ private:
             }
         }
 
+        int index;
         WorkQueue& queue;
         WorkItemQueue workItemQueue;
         std::thread thread;
@@ -190,6 +464,7 @@ private:
     std::vector<std::unique_ptr<Worker>> workers;
     int lastWorkerPushed {0};
     std::atomic<int64_t> completedWorkItems {0};
+    std::atomic<int64_t> pushedWorkItems {0};
 };
 
 WorkQueue<MapGenWorkItem> queue;
@@ -198,6 +473,25 @@ void Map::initializeMapGenerator()
     queue.start(16, 1000);
 }
 
+void Map::stopMapGenerator()
+{
+    if(queue.completed())
+        return;
+    queue.signalCompletion();
+    g_logger.info(stdext::format("Map generator stopped, %d work items completed", (int)queue.getCompletedCount()));
+}
+
+void Map::setWorkerAffinity(bool enable)
+{
+    // threads that are already running keep their placement
+    g_workerPlacement.setAffinityEnabled(enable);
+}
+
+bool Map::isWorkerAffinity()
+{
+    return g_workerPlacement.isAffinityEnabled();
+}
+
 bool Map::isThreadRunning(int threadId)
 {
     return false;
@@ -207,13 +501,366 @@ void Map::startThread(int threadId, int minx, int miny, int minz, int maxx, int
 {
     /*threadsStates[threadId] = true;
     threads[threadId] = new boost::thread(mapPartGenerator, threadId, minx, miny, minz, maxx, maxy, maxz);*/
-    while (!queue.tryPush(MapGenWorkItem::make(minx, miny, minz, maxx, maxy, maxz)));
+    while (!queue.tryPush(MapAreaWorkItem::make(minx, miny, minz, maxx, maxy, maxz)));
 }
 
-void Map::drawMap(std::string fileName, int sx, int sy, int sz, int size)
+MapJobPtr Map::renderAsync(int minX, int minY, int minZ, int maxX, int maxY, int maxZ, int threads)
+{
+    g_resources.makeDir("map");
+    std::shared_ptr<MapRenderProgress> progress(new MapRenderProgress("map/completed.txt"));
+
+    // same areas (25x25 chunks of one floor) as generateMap in otclientrc.lua
+    const int areaSize = 25;
+    std::shared_ptr<std::vector<MapChunkArea>> areas(new std::vector<MapChunkArea>);
+    const int firstX = std::max<int>(0, minX) / 8, firstY = std::max<int>(0, minY) / 8;
+    int chunks = 0, skipped = 0;
+    for(int z = std::max<int>(0, minZ); z <= std::min<int>(Otc::MAX_Z, maxZ); ++z) {
+        for(int x = firstX; x <= maxX / 8; x += areaSize) {
+            for(int y = firstY; y <= maxY / 8; y += areaSize) {
+                MapChunkArea area = { x, y, std::min<int>(x + areaSize - 1, maxX / 8), std::min<int>(y + areaSize - 1, maxY / 8), z };
+                // rendered by an earlier job that was stopped
+                if(progress->isCompleted(area)) {
+                    skipped++;
+                    continue;
+                }
+                chunks += area.getChunkCount();
+                areas->push_back(area);
+            }
+        }
+    }
+    if(skipped > 0)
+        g_logger.info(stdext::format("Skipping %d areas listed in map/completed.txt", skipped));
+    // areas along a hilbert curve, so the contiguous area ranges of the workers are compact blobs
+    // instead of strips
+    std::stable_sort(areas->begin(), areas->end(), [=](const MapChunkArea& a, const MapChunkArea& b) {
+        if(a.z != b.z)
+            return a.z < b.z;
+        return stdext::hilbert_index((a.minx - firstX) / areaSize, (a.miny - firstY) / areaSize) <
+               stdext::hilbert_index((b.minx - firstX) / areaSize, (b.miny - firstY) / areaSize);
+    });
+
+    MapJobPtr job(new MapJob("render"));
+    MapJobStatePtr state = job->getState();
+    state->total = chunks;
+    job->start();
+
+    // chunks added to a tile archive are durable only after its writer checkpoints them, the archive
+    // can't be changed until the job finishes
+    std::shared_ptr<TileArchiveWriter> archive = getTileArchive();
+    activeRenderJobs++;
+
+    threads = std::max<int>(1, std::min<int>(threads, std::max<int>(1, areas->size())));
+    // neighbouring areas go to the same worker
+    std::shared_ptr<WorkerRanges> ranges(new WorkerRanges(areas->size(), threads));
+    std::shared_ptr<std::atomic<int>> running(new std::atomic<int>(threads));
+    std::shared_ptr<std::string> error(new std::string);
+    std::shared_ptr<std::mutex> errorMutex(new std::mutex);
+    for(int i = 0; i < threads; ++i) {
+        job->addThread(std::thread([=]() {
+            g_workerPlacement.place(i);
+            try {
+                size_t index;
+                std::string fileName;
+                while(state->waitWhilePaused() && ranges->next(i, index)) {
+                    const MapChunkArea& area = (*areas)[index];
+                    std::vector<std::string> files;
+                    bool completed = true;
+                    for(const Point& chunk : getHilbertChunks(area.minx, area.miny, area.maxx, area.maxy)) {
+                        // a cancelled job finishes the chunk being rendered and leaves the area unrecorded
+                        if(!state->waitWhilePaused()) {
+                            completed = false;
+                            break;
+                        }
+                        mapChunkFile(fileName, chunk.x, chunk.y, area.z);
+                        if(drawMapChunk(fileName, chunk.x * 8, chunk.y * 8, area.z, 8, archive) && !archive)
+                            files.push_back(fileName);
+                        state->advance();
+                    }
+                    if(!completed)
+                        continue;
+                    if(archive) {
+                        MapChunkArea archived = area;
+                        archive->addBarrier([progress, archived](bool durable) {
+                            if(durable)
+                                progress->complete(archived, std::vector<std::string>());
+                        });
+                    } else
+                        progress->complete(area, files);
+                }
+            } catch(std::exception& e) {
+                std::lock_guard<std::mutex> lock(*errorMutex);
+                *error = e.what();
+                state->cancel();
+            }
+
+            if(--(*running) == 0) {
+                auto finish = [progress, state, error](bool durable) {
+                    progress->flush();
+                    activeRenderJobs--;
+                    if(!error->empty())
+                        state->finish(false, *error);
+                    else if(!durable)
+                        state->finish(false, "tile archive failed");
+                    else if(state->cancelled)
+                        state->finish(false, "cancelled");
+                    else
+                        state->finish(true);
+                };
+                // areas of an archive are recorded once the writer passes their barriers, so the job
+                // finishes only after the last of them is in map/completed.txt
+                if(archive)
+                    archive->addBarrier(finish, true);
+                else
+                    finish(true);
+            }
+        }));
+    }
+    return job;
+}
+
+std::shared_ptr<MapRenderJob> renderJob;
+
+bool Map::planRenderJob(const std::string& dir, int minx, int miny, int minz, int maxx, int maxy, int maxz, int shardSize)
+{
+    return MapRenderJob::plan(dir, minx, miny, minz, maxx, maxy, maxz, shardSize);
+}
+
+MapJobPtr Map::startRenderJob(const std::string& dir, int threads)
+{
+    if(activeShardWorkers > 0) {
+        g_logger.error("A render job is already running");
+        return nullptr;
+    }
+
+    std::shared_ptr<MapRenderJob> job(new MapRenderJob);
+    if(!job->load(dir))
+        return nullptr;
+    renderJob = job;
+
+    initializeMapGenerator();
+
+    // progress counts completed shards, also those completed by other clients
+    threads = std::max<int>(1, threads);
+    MapJobPtr mapJob(new MapJob("renderJob"));
+    MapJobStatePtr state = mapJob->getState();
+    state->total = job->getShardCount();
+    state->done = job->getCompletedCount();
+    mapJob->start();
+
+    g_resources.makeDir("map");
+    std::string host = boost::asio::ip::host_name();
+    std::shared_ptr<MapShardRun> run(new MapShardRun(state, threads));
+    for(int i = 0; i < threads; ++i) {
+        activeShardWorkers++;
+        std::string owner = stdext::format("%s:%d:%d", host, g_platform.getProcessId(), i);
+        while (!queue.tryPush(MapShardWorkItem::make(job, owner, getTileArchive(), run)));
+    }
+    g_logger.info(stdext::format("Render job '%s': %d of %d shards done, %d threads started", MapRenderJob::resolveDir(dir),
+                                 (int)state->done, (int)state->total, threads));
+    return mapJob;
+}
+
+bool Map::isRenderJobRunning()
+{
+    return activeShardWorkers > 0;
+}
+
+int Map::getRenderJobShardCount()
+{
+    return renderJob ? renderJob->getShardCount() : 0;
+}
+
+int Map::getRenderJobCompletedShards()
+{
+    return renderJob ? renderJob->getCompletedCount() : 0;
+}
+
+bool Map::drawMap(const std::string& fileName, int sx, int sy, int sz, int size)
+{
+    return drawMapChunk(fileName, sx, sy, sz, size, getTileArchive());
+}
+
+bool Map::drawMapChunk(const std::string& fileName, int sx, int sy, int sz, int size, const std::shared_ptr<TileArchiveWriter>& archive)
+{
+    std::string& data = getRenderScratch().image;
+    // empty images are not saved
+    if(!encodeMapImage(data, sx, sy, sz, size))
+        return false;
+
+    if(archive)
+        archive->add(sx / size, sy / size, sz, 0, data);
+    else if(!g_resources.writeFileContents(fileName, data))
+        stdext::throw_exception(stdext::format("failed to open file '%s' for write", fileName));
+    return true;
+}
+
+bool Map::encodeMapImage(std::string& data, int sx, int sy, int sz, int size)
+{
+    MapRenderScratch& scratch = getRenderScratch();
+    if(m_animatedOutput) {
+        std::vector<int>& timeline = scratch.timeline;
+        buildAnimationTimeline(timeline, sx, sy, sz, size);
+        if(timeline.size() > 2) {
+            int frameCount = timeline.size() - 1;
+            while((int)scratch.frames.size() < frameCount)
+                scratch.frames.push_back(ImagePtr(new Image(Size(32 * (size + 2), 32 * (size + 2)))));
+            scratch.framePixels.clear();
+            scratch.frameDelays.clear();
+            bool blited = false;
+            for(int i = 0; i < frameCount; ++i) {
+                const ImagePtr& frame = scratch.frames[i];
+                drawMapImage(frame, sx, sy, sz, size, timeline[i]);
+                blited = blited || frame->isBlited();
+                scratch.framePixels.push_back(frame->getPixelData());
+                scratch.frameDelays.push_back(timeline[i + 1] - timeline[i]);
+            }
+            // empty when nothing is drawn in any frame, frames of a chunk all have the same size
+            if(!blited)
+                return false;
+            const Size& frameSize = scratch.frames[0]->getSize();
+            save_apng(data, frameSize.width(), frameSize.height(), 4, &scratch.framePixels[0], &scratch.frameDelays[0], frameCount, scratch.encoder);
+            return true;
+        }
+    }
+
+    if(!scratch.canvas)
+        scratch.canvas = ImagePtr(new Image(Size(32 * (size + 2), 32 * (size + 2))));
+    drawMapImage(scratch.canvas, sx, sy, sz, size);
+    return scratch.canvas->encodePNG(data, scratch.encoder);
+}
+
+// chunks of a running render would otherwise go to an archive other than the one its progress expects
+static bool isMapRendering()
+{
+    return activeRenderJobs > 0 || activeShardWorkers > 0 || queue.getPendingCount() > 0;
+}
+
+bool Map::openTileArchive(const std::string& dir)
+{
+    if(isMapRendering()) {
+        g_logger.error("Unable to open a tile archive while the map is rendered");
+        return false;
+    }
+
+    closeTileArchive();
+    std::shared_ptr<TileArchiveWriter> archive(new TileArchiveWriter);
+    if(!archive->open(dir))
+        return false;
+    std::atomic_store(&m_tileArchive, archive);
+    return true;
+}
+
+bool Map::closeTileArchive()
+{
+    if(isMapRendering()) {
+        g_logger.error("Unable to close the tile archive while the map is rendered");
+        return false;
+    }
+
+    std::shared_ptr<TileArchiveWriter> archive = std::atomic_exchange(&m_tileArchive, std::shared_ptr<TileArchiveWriter>());
+    if(!archive)
+        return false;
+    return archive->close();
+}
+
+// returns the ticks at which any animated item of the area changes its phase,
+// the last entry is the length of the loop
+std::vector<int> Map::getAnimationTimeline(int sx, int sy, int sz, int size)
+{
+    std::vector<int> timeline;
+    buildAnimationTimeline(timeline, sx, sy, sz, size);
+    return timeline;
+}
+
+// the work lists are kept by the render thread, so after its first chunks this allocates nothing
+void Map::buildAnimationTimeline(std::vector<int>& timeline, int sx, int sy, int sz, int size)
+{
+    MapRenderScratch& scratch = getRenderScratch();
+    std::vector<ThingType*>& animated = scratch.animatedTypes;
+    std::vector<int>& cycles = scratch.animationCycles;
+    animated.clear();
+    cycles.clear();
+    timeline.clear();
+
+    for(int x = 0; x <= size; x++) {
+        for(int y = 0; y <= size; y++) {
+            const TilePtr& tile = getTile(Position(sx + x, sy + y, sz));
+            if(!tile)
+                continue;
+            for(const ThingPtr& thing : tile->rawGetThings()) {
+                if(thing->isItem() && thing->getAnimationPhases() > 1)
+                    animated.push_back(thing->rawGetThingType());
+            }
+        }
+    }
+    std::sort(animated.begin(), animated.end());
+    animated.erase(std::unique(animated.begin(), animated.end()), animated.end());
+
+    // types without a cycle are dropped from the list
+    int64 loop = 1;
+    size_t cycling = 0;
+    for(ThingType *type : animated) {
+        int cycle = 0;
+        for(int phase = 0; phase < type->getAnimationPhases(); ++phase)
+            cycle += type->getAnimationPhaseDuration(phase);
+        if(cycle <= 0)
+            continue;
+        animated[cycling++] = type;
+        cycles.push_back(cycle);
+        int64 a = loop, b = cycle;
+        while(b) { int64 t = a % b; a = b; b = t; }
+        // anything longer than the maximum duration is cut below
+        loop = std::min<int64>(loop / a * cycle, MAPGEN_ANIMATION_MAX_DURATION + 1);
+    }
+    animated.resize(cycling);
+    if(cycles.empty())
+        return;
+
+    // a capped loop also needs the change at the maximum duration itself, it may be where the loop ends
+    int64 last = loop > MAPGEN_ANIMATION_MAX_DURATION ? (int64)MAPGEN_ANIMATION_MAX_DURATION : loop - 1;
+    for(ThingType *type : animated) {
+        int ticks = 0;
+        for(int phase = 0; ticks <= last; phase = (phase + 1) % type->getAnimationPhases()) {
+            timeline.push_back(ticks);
+            ticks += type->getAnimationPhaseDuration(phase);
+        }
+    }
+    std::sort(timeline.begin(), timeline.end());
+    timeline.erase(std::unique(timeline.begin(), timeline.end()), timeline.end());
+
+    if(loop <= MAPGEN_ANIMATION_MAX_DURATION && timeline.size() <= MAPGEN_ANIMATION_MAX_FRAMES) {
+        timeline.push_back(loop);
+        return;
+    }
+
+    // too long or too many frames: the loop ends at one of the kept changes, so every frame keeps the
+    // real duration of its phase. It ends where most items finish whole cycles, and at the latest such change
+    int end = 0, endCycles = -1;
+    for(size_t i = 1; i < timeline.size() && i <= MAPGEN_ANIMATION_MAX_FRAMES; ++i) {
+        int completed = 0;
+        for(int cycle : cycles)
+            completed += timeline[i] % cycle == 0;
+        if(completed >= endCycles) {
+            end = i;
+            endCycles = completed;
+        }
+    }
+    int endTicks = timeline[end];
+    timeline.resize(end);
+    timeline.push_back(endTicks);
+}
+
+ImagePtr Map::renderMapImage(int sx, int sy, int sz, int size, int animationTicks)
 {
-    Position pros;
     ImagePtr image(new Image(Size(32 * (size+2), 32 * (size+2))));
+    drawMapImage(image, sx, sy, sz, size, animationTicks);
+    return image;
+}
+
+void Map::drawMapImage(const ImagePtr& image, int sx, int sy, int sz, int size, int animationTicks)
+{
+    Position pros;
+    image->clear(Size(32 * (size+2), 32 * (size+2)));
         pros.z = sz;
         for(int x = 0; x <= size; x++)
         {
@@ -224,7 +871,7 @@ void Map::drawMap(std::string fileName, int sx, int sy, int sz, int size)
                 if (const TilePtr& tile = getTile(pros))
                 {
                     Point a((x+1) * 32, (y+1) * 32);
-                    tile->drawToImage(a, image);
+                    tile->drawToImage(a, image, animationTicks);
                 }
                 else
                 {
@@ -240,13 +887,87 @@ void Map::drawMap(std::string fileName, int sx, int sy, int sz, int size)
 
         // reduce image size to size from argument (for generation time image is 2 tiles bigger, because of 64x64 items)
         image->cut();
-        // save to file, save function is modified and will ignore empty images!
-        image->savePNG(fileName);
+        if(m_bakedLighting && image->isBlited())
+            m_bakedLight.apply(image, sx, sy, sz);
 }
 
-void Map::loadOtbm(const std::string& fileName)
+// identifies the contents of a map file without reading all of it, the otbm index is rebuilt when any of these changes
+struct MapFileSignature
+{
+    uint32 size;
+    uint64 mtime;
+    uint32 checksum; // of the first and the last MAP_SIGNATURE_SAMPLE bytes
+};
+
+enum { MAP_SIGNATURE_SAMPLE = 4096 };
+
+static uint32 readMapChecksum(const FileStreamPtr& fin, uint32 pos, uint32 end, uint32 checksum)
+{
+    if(pos >= end)
+        return checksum;
+
+    // the map can be big, so it is summed in chunks instead of being cached
+    std::string buffer(std::min<uint32>(end - pos, 64 * 1024), '\0');
+    fin->seek(pos);
+    while(pos < end) {
+        uint32 chunk = std::min<uint32>(end - pos, buffer.size());
+        if(fin->read(&buffer[0], chunk) != 1)
+            stdext::throw_exception("unable to read map file");
+        checksum = adler32(checksum, (const Bytef*)buffer.data(), chunk);
+        pos += chunk;
+    }
+    return checksum;
+}
+
+static MapFileSignature getMapFileSignature(const std::string& fileName, const FileStreamPtr& fin)
+{
+    MapFileSignature signature;
+    signature.size = fin->size();
+    signature.mtime = g_resources.getFileTime(fileName);
+    uint32 head = std::min<uint32>(signature.size, MAP_SIGNATURE_SAMPLE);
+    uint32 tail = std::max<uint32>(head, signature.size - std::min<uint32>(signature.size, MAP_SIGNATURE_SAMPLE));
+    signature.checksum = readMapChecksum(fin, 0, head, adler32(0, nullptr, 0));
+    signature.checksum = readMapChecksum(fin, tail, signature.size, signature.checksum);
+    fin->seek(0);
+    return signature;
+}
+
+// full pass over the file, only needed when the index is built or the map was touched without changing its size
+static uint32 getMapFileChecksum(const FileStreamPtr& fin)
+{
+    uint32 checksum = readMapChecksum(fin, 0, fin->size(), adler32(0, nullptr, 0));
+    fin->seek(0);
+    return checksum;
+}
+
+static std::string formatMapSignature(const MapFileSignature& signature, const Rect& area, int minZ, int maxZ)
+{
+    return stdext::format("%08x%08x%08x-%d-%d-%d-%d-%d-%d", signature.size, (uint32)signature.mtime, signature.checksum,
+                          area.x(), area.y(), area.width(), area.height(), minZ, maxZ);
+}
+
+MapJobPtr Map::loadOtbmAsync(const std::string& fileName)
+{
+    // the minimap and map views are not thread safe, they get the loaded tiles when the job finishes
+    return MapJob::schedule("loadOtbm", [this, fileName](const MapJobStatePtr& state) {
+        m_tileUpdatesDeferred = true;
+        return readOtbm(fileName, state);
+    }, [this](bool) {
+        m_tileUpdatesDeferred = false;
+        notificateLoadedTiles();
+    });
+}
+
+bool Map::loadOtbm(const std::string& fileName)
+{
+    return readOtbm(fileName, nullptr);
+}
+
+// with a job state, progress counts map data nodes and the load stops between them when the job is cancelled
+bool Map::readOtbm(const std::string& fileName, const MapJobStatePtr& state)
 {
     try {
+        ObjectArena::Scope arenaScope(m_arenaAllocation);
         if(!g_things.isOtbLoaded())
             stdext::throw_exception("OTB isn't loaded yet to load a map.");
 
@@ -254,6 +975,7 @@ void Map::loadOtbm(const std::string& fileName)
         if(!fin)
             stdext::throw_exception(stdext::format("Unable to load map '%s'", fileName));
         fin->cache();
+        MapFileSignature signature = getMapFileSignature(fileName, fin);
 
         char identifier[4];
         if(fin->read(identifier, 1, 4) < 4)
@@ -308,123 +1030,21 @@ void Map::loadOtbm(const std::string& fileName)
             }
         }
 
-        int minx, miny, minz, maxx, maxy, maxz;
-        minx = miny = minz = 999999;
-        maxx = maxy = maxz = -5;
+        Position minPos(0xFFFF, 0xFFFF, 0xFF), maxPos(0, 0, 0);
+
+        BinaryTreeVec children = node->getChildren();
+        if(state)
+            state->total = children.size();
+        for(const BinaryTreePtr& nodeMapData : children) {
+            if(state) {
+                if(!state->waitWhilePaused())
+                    stdext::throw_exception("cancelled");
+                state->advance();
+            }
 
-        for(const BinaryTreePtr& nodeMapData : node->getChildren()) {
             uint8 mapDataType = nodeMapData->getU8();
             if(mapDataType == OTBM_TILE_AREA) {
-                Position basePos;
-                basePos.x = nodeMapData->getU16();
-                basePos.y = nodeMapData->getU16();
-                basePos.z = nodeMapData->getU8();
-
-                for(const BinaryTreePtr &nodeTile : nodeMapData->getChildren()) {
-                    uint8 type = nodeTile->getU8();
-                    if(unlikely(type != OTBM_TILE && type != OTBM_HOUSETILE))
-                        stdext::throw_exception(stdext::format("invalid node tile type %d", (int)type));
-
-                    HousePtr house = nullptr;
-                    uint32 flags = TILESTATE_NONE;
-                    Position pos = basePos + nodeTile->getPoint();
-
-                    if(pos.x < minx)
-                    {
-                        minx = pos.x;
-                    }
-                    if(pos.y < miny)
-                    {
-                        miny = pos.y;
-                    }
-                    if(pos.z < minz)
-                    {
-                        minz = pos.z;
-                    }
-                    if(pos.x > maxx)
-                    {
-                        maxx = pos.x;
-                    }
-                    if(pos.y > maxy)
-                    {
-                        maxy = pos.y;
-                    }
-                    if(pos.z > maxz)
-                    {
-                        maxz = pos.z;
-                    }
-                    if(type == OTBM_HOUSETILE) {
-                        uint32 hId = nodeTile->getU32();
-                        TilePtr tile = getOrCreateTile(pos);
-                        if(!(house = g_houses.getHouse(hId))) {
-                            house = HousePtr(new House(hId));
-                            g_houses.addHouse(house);
-                        }
-                        house->setTile(tile);
-                    }
-
-                    while(nodeTile->canRead()) {
-                        uint8 tileAttr = nodeTile->getU8();
-                        switch(tileAttr) {
-                            case OTBM_ATTR_TILE_FLAGS: {
-                                uint32 _flags = nodeTile->getU32();
-                                if((_flags & TILESTATE_PROTECTIONZONE) == TILESTATE_PROTECTIONZONE)
-                                    flags |= TILESTATE_PROTECTIONZONE;
-                                else if((_flags & TILESTATE_OPTIONALZONE) == TILESTATE_OPTIONALZONE)
-                                    flags |= TILESTATE_OPTIONALZONE;
-                                else if((_flags & TILESTATE_HARDCOREZONE) == TILESTATE_HARDCOREZONE)
-                                    flags |= TILESTATE_HARDCOREZONE;
-
-                                if((_flags & TILESTATE_NOLOGOUT) == TILESTATE_NOLOGOUT)
-                                    flags |= TILESTATE_NOLOGOUT;
-
-                                if((_flags & TILESTATE_REFRESH) == TILESTATE_REFRESH)
-                                    flags |= TILESTATE_REFRESH;
-                                break;
-                            }
-                            case OTBM_ATTR_ITEM: {
-                                addThing(Item::createFromOtb(nodeTile->getU16()), pos);
-                                break;
-                            }
-                            default: {
-                                stdext::throw_exception(stdext::format("invalid tile attribute %d at pos %s",
-                                                                   (int)tileAttr, stdext::to_string(pos)));
-                            }
-                        }
-                    }
-
-                    for(const BinaryTreePtr& nodeItem : nodeTile->getChildren()) {
-                        if(unlikely(nodeItem->getU8() != OTBM_ITEM))
-                            stdext::throw_exception("invalid item node");
-
-                        ItemPtr item = Item::createFromOtb(nodeItem->getU16());
-                        item->unserializeItem(nodeItem);
-
-                        if(item->isContainer()) {
-                            for(const BinaryTreePtr& containerItem : nodeItem->getChildren()) {
-                                if(containerItem->getU8() != OTBM_ITEM)
-                                    stdext::throw_exception("invalid container item node");
-
-                                ItemPtr cItem = Item::createFromOtb(containerItem->getU16());
-                                cItem->unserializeItem(containerItem);
-                                item->addContainerItem(cItem);
-                            }
-                        }
-
-                        if(house && item->isMoveable()) {
-                            g_logger.warning(stdext::format("Moveable item found in house: %d at pos %s - escaping...", item->getId(), stdext::to_string(pos)));
-                            item.reset();
-                        }
-
-                        addThing(item, pos);
-                    }
-
-                    if(const TilePtr& tile = getTile(pos)) {
-                        if(house)
-                            tile->setFlag(TILESTATE_HOUSE);
-                        tile->setFlag(flags);
-                    }
-                }
+                readOtbmTileArea(nodeMapData, Rect(0, 0, 65536, 65536), 0, Otc::MAX_Z, minPos, maxPos);
             } else if(mapDataType == OTBM_TOWNS) {
                 TownPtr town = nullptr;
                 for(const BinaryTreePtr &nodeTown : nodeMapData->getChildren()) {
@@ -461,12 +1081,287 @@ void Map::loadOtbm(const std::string& fileName)
             } else
                 stdext::throw_exception(stdext::format("Unknown map data node %d", (int)mapDataType));
         }
-        g_logger.debug(stdext::format("Example generator of whole map: generateMap(%d, %d, %d, %d, %d, %d, 4) [last 4 = 4 threads to generate]", minx, miny, minz, maxx, maxy, maxz));
+        g_logger.debug(stdext::format("Example generator of whole map: generateMap(%d, %d, %d, %d, %d, %d, 4) [last 4 = 4 threads to generate]",
+                                      minPos.x, minPos.y, minPos.z, maxPos.x, maxPos.y, maxPos.z));
         g_logger.info("These positions are just suggestion. If you know better where is first/last tile then you can use other values.");
 
         fin->close();
+        addMapSignature(formatMapSignature(signature, Rect(0, 0, 65536, 65536), 0, Otc::MAX_Z));
+        return true;
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Failed to load '%s': %s", fileName, e.what()));
+        return false;
+    }
+}
+
+void Map::readOtbmTileArea(const BinaryTreePtr& nodeMapData, const Rect& area, int minZ, int maxZ, Position& minPos, Position& maxPos)
+{
+    Position basePos;
+    basePos.x = nodeMapData->getU16();
+    basePos.y = nodeMapData->getU16();
+    basePos.z = nodeMapData->getU8();
+
+    for(const BinaryTreePtr &nodeTile : nodeMapData->getChildren()) {
+        uint8 type = nodeTile->getU8();
+        if(unlikely(type != OTBM_TILE && type != OTBM_HOUSETILE))
+            stdext::throw_exception(stdext::format("invalid node tile type %d", (int)type));
+
+        HousePtr house = nullptr;
+        uint32 flags = TILESTATE_NONE;
+        Position pos = basePos + nodeTile->getPoint();
+
+        if(pos.z < minZ || pos.z > maxZ || !area.contains(Point(pos.x, pos.y)))
+            continue;
+
+        minPos = Position(std::min(minPos.x, pos.x), std::min(minPos.y, pos.y), std::min(minPos.z, pos.z));
+        maxPos = Position(std::max(maxPos.x, pos.x), std::max(maxPos.y, pos.y), std::max(maxPos.z, pos.z));
+
+        if(type == OTBM_HOUSETILE) {
+            uint32 hId = nodeTile->getU32();
+            TilePtr tile = getOrCreateTile(pos);
+            if(!(house = g_houses.getHouse(hId))) {
+                house = HousePtr(new House(hId));
+                g_houses.addHouse(house);
+            }
+            house->setTile(tile);
+        }
+
+        while(nodeTile->canRead()) {
+            uint8 tileAttr = nodeTile->getU8();
+            switch(tileAttr) {
+                case OTBM_ATTR_TILE_FLAGS: {
+                    uint32 _flags = nodeTile->getU32();
+                    if((_flags & TILESTATE_PROTECTIONZONE) == TILESTATE_PROTECTIONZONE)
+                        flags |= TILESTATE_PROTECTIONZONE;
+                    else if((_flags & TILESTATE_OPTIONALZONE) == TILESTATE_OPTIONALZONE)
+                        flags |= TILESTATE_OPTIONALZONE;
+                    else if((_flags & TILESTATE_HARDCOREZONE) == TILESTATE_HARDCOREZONE)
+                        flags |= TILESTATE_HARDCOREZONE;
+
+                    if((_flags & TILESTATE_NOLOGOUT) == TILESTATE_NOLOGOUT)
+                        flags |= TILESTATE_NOLOGOUT;
+
+                    if((_flags & TILESTATE_REFRESH) == TILESTATE_REFRESH)
+                        flags |= TILESTATE_REFRESH;
+                    break;
+                }
+                case OTBM_ATTR_ITEM: {
+                    addThing(Item::createFromOtb(nodeTile->getU16()), pos);
+                    break;
+                }
+                default: {
+                    stdext::throw_exception(stdext::format("invalid tile attribute %d at pos %s",
+                                                       (int)tileAttr, stdext::to_string(pos)));
+                }
+            }
+        }
+
+        for(const BinaryTreePtr& nodeItem : nodeTile->getChildren()) {
+            if(unlikely(nodeItem->getU8() != OTBM_ITEM))
+                stdext::throw_exception("invalid item node");
+
+            ItemPtr item = Item::createFromOtb(nodeItem->getU16());
+            item->unserializeItem(nodeItem);
+
+            if(item->isContainer()) {
+                for(const BinaryTreePtr& containerItem : nodeItem->getChildren()) {
+                    if(containerItem->getU8() != OTBM_ITEM)
+                        stdext::throw_exception("invalid container item node");
+
+                    ItemPtr cItem = Item::createFromOtb(containerItem->getU16());
+                    cItem->unserializeItem(containerItem);
+                    item->addContainerItem(cItem);
+                }
+            }
+
+            if(house && item->isMoveable()) {
+                g_logger.warning(stdext::format("Moveable item found in house: %d at pos %s - escaping...", item->getId(), stdext::to_string(pos)));
+                item.reset();
+            }
+
+            addThing(item, pos);
+        }
+
+        if(const TilePtr& tile = getTile(pos)) {
+            if(house)
+                tile->setFlag(TILESTATE_HOUSE);
+            tile->setFlag(flags);
+        }
+    }
+}
+
+struct OtbmAreaEntry
+{
+    Position pos;
+    uint32 offset;
+    uint32 size;
+};
+
+static bool readOtbmIndex(const std::string& fileName, const FileStreamPtr& mapFile, const MapFileSignature& signature, Size& mapSize, std::vector<OtbmAreaEntry>& entries)
+{
+    if(!g_resources.fileExists(fileName))
+        return false;
+
+    FileStreamPtr fin = g_resources.openFile(fileName);
+    if(!fin)
+        return false;
+    fin->cache();
+
+    // index of another version or of a modified map
+    if(fin->getU32() != OTBM_INDEX_SIGNATURE || fin->getU16() != OTBM_INDEX_VERSION || fin->getU32() != signature.size)
+        return false;
+    uint64 mtime = fin->getU64();
+    if(fin->getU32() != signature.checksum)
+        return false;
+    // a map copied or touched keeps its index when all of its contents are still the same
+    uint32 checksum = fin->getU32();
+    if(mtime != signature.mtime && checksum != getMapFileChecksum(mapFile))
+        return false;
+
+    mapSize.setWidth(fin->getU16());
+    mapSize.setHeight(fin->getU16());
+
+    uint32 count = fin->getU32();
+    entries.resize(count);
+    for(OtbmAreaEntry& entry : entries) {
+        entry.pos.x = fin->getU16();
+        entry.pos.y = fin->getU16();
+        entry.pos.z = fin->getU8();
+        entry.offset = fin->getU32();
+        entry.size = fin->getU32();
+    }
+    fin->close();
+    return true;
+}
+
+bool Map::indexOtbm(const std::string& fileName)
+{
+    try {
+        stdext::timer indexTimer;
+
+        FileStreamPtr fin = g_resources.openFile(fileName);
+        if(!fin)
+            stdext::throw_exception(stdext::format("Unable to load map '%s'", fileName));
+        fin->cache();
+        MapFileSignature signature = getMapFileSignature(fileName, fin);
+
+        fin->getU32(); // identifier
+        BinaryTreePtr root = fin->getBinaryTree();
+        if(root->getU8())
+            stdext::throw_exception("could not read root property!");
+
+        root->getU32(); // version
+        uint16 width = root->getU16();
+        uint16 height = root->getU16();
+
+        BinaryTreePtr node = root->getChildren()[0];
+        if(node->getU8() != OTBM_MAP_DATA)
+            stdext::throw_exception("Could not read root data node");
+
+        BinaryTreeVec children = node->getChildren();
+        // the map data node end byte follows its last child
+        uint32 dataEnd = fin->tell() - 1;
+
+        std::vector<OtbmAreaEntry> entries;
+        for(size_t i = 0; i < children.size(); ++i) {
+            const BinaryTreePtr& nodeMapData = children[i];
+            if(nodeMapData->getU8() != OTBM_TILE_AREA)
+                continue;
+
+            OtbmAreaEntry entry;
+            entry.pos.x = nodeMapData->getU16();
+            entry.pos.y = nodeMapData->getU16();
+            entry.pos.z = nodeMapData->getU8();
+            // the node start byte is included, so the entry can be read as a tree of its own
+            entry.offset = nodeMapData->getStartPos() - 1;
+            uint32 end = i + 1 < children.size() ? children[i + 1]->getStartPos() - 1 : dataEnd;
+            entry.size = end - entry.offset;
+            entries.push_back(entry);
+        }
+
+        FileStreamPtr fout = g_resources.createFile(fileName + ".idx");
+        if(!fout)
+            stdext::throw_exception("failed to create index file");
+        fout->cache();
+
+        fout->addU32(OTBM_INDEX_SIGNATURE);
+        fout->addU16(OTBM_INDEX_VERSION);
+        fout->addU32(signature.size);
+        fout->addU64(signature.mtime);
+        fout->addU32(signature.checksum);
+        fout->addU32(getMapFileChecksum(fin));
+        fout->addU16(width);
+        fout->addU16(height);
+        fout->addU32(entries.size());
+        for(const OtbmAreaEntry& entry : entries) {
+            fout->addPos(entry.pos.x, entry.pos.y, entry.pos.z);
+            fout->addU32(entry.offset);
+            fout->addU32(entry.size);
+        }
+        fout->flush();
+        fout->close();
+        fin->close();
+
+        g_logger.info(stdext::format("Indexed %d tile areas of '%s' in %.2fs", (int)entries.size(), fileName, indexTimer.elapsed_seconds()));
+        return true;
+    } catch(stdext::exception& e) {
+        g_logger.error(stdext::format("Failed to index '%s': %s", fileName, e.what()));
+        return false;
+    }
+}
+
+bool Map::loadOtbmRegion(const std::string& fileName, const Rect& area, int minZ, int maxZ)
+{
+    try {
+        ObjectArena::Scope arenaScope(m_arenaAllocation);
+        if(!g_things.isOtbLoaded())
+            stdext::throw_exception("OTB isn't loaded yet to load a map.");
+
+        FileStreamPtr fin = g_resources.openFile(fileName);
+        if(!fin)
+            stdext::throw_exception(stdext::format("Unable to load map '%s'", fileName));
+
+        std::string indexFile = fileName + ".idx";
+        std::vector<OtbmAreaEntry> entries;
+        Size mapSize;
+        MapFileSignature signature = getMapFileSignature(fileName, fin);
+        if(!readOtbmIndex(indexFile, fin, signature, mapSize, entries)) {
+            if(!indexOtbm(fileName) || !readOtbmIndex(indexFile, fin, signature, mapSize, entries))
+                stdext::throw_exception("unable to index map");
+        }
+
+        setWidth(mapSize.width());
+        setHeight(mapSize.height());
+
+        Position minPos(0xFFFF, 0xFFFF, 0xFF), maxPos(0, 0, 0);
+        std::string buffer;
+        int loadedAreas = 0;
+        for(const OtbmAreaEntry& entry : entries) {
+            // tile positions inside of an area are 8 bit offsets
+            if(entry.pos.z < minZ || entry.pos.z > maxZ || !area.intersects(Rect(entry.pos.x, entry.pos.y, 256, 256)))
+                continue;
+
+            buffer.resize(entry.size);
+            fin->seek(entry.offset);
+            if(entry.size == 0 || fin->read(&buffer[0], entry.size) != 1)
+                stdext::throw_exception("unable to read tile area, index is corrupted");
+
+            FileStreamPtr areaStream(new FileStream(fileName, buffer));
+            BinaryTreePtr nodeArea = areaStream->getBinaryTree();
+            if(nodeArea->getU8() != OTBM_TILE_AREA)
+                stdext::throw_exception("invalid tile area node, index is corrupted");
+
+            readOtbmTileArea(nodeArea, area, minZ, maxZ, minPos, maxPos);
+            ++loadedAreas;
+        }
+        fin->close();
+        addMapSignature(formatMapSignature(signature, area, minZ, maxZ));
+
+        g_logger.debug(stdext::format("Loaded %d of %d tile areas of '%s'", loadedAreas, (int)entries.size(), fileName));
+        return true;
     } catch(std::exception& e) {
         g_logger.error(stdext::format("Failed to load '%s': %s", fileName, e.what()));
+        return false;
     }
 }
 
@@ -477,7 +1372,7 @@ void Map::saveOtbm(const std::string& fileName)
         if(!fin)
             stdext::throw_exception(stdext::format("failed to open file '%s' for write", fileName));
 
-        fin->cache();
+        fin->setWriteBufferSize(OTBM_WRITE_BUFFER_SIZE);
         std::string dir;
         if(fileName.find_last_of('/') == std::string::npos)
             dir = g_resources.getWorkDir();
@@ -539,60 +1434,70 @@ void Map::saveOtbm(const std::string& fileName)
                 int px = -1, py = -1, pz =-1;
                 bool firstNode = true;
 
+                // blocks never cross an area, so visiting them sorted by (z, area, y, x)
+                // writes exactly one OTBM_TILE_AREA per occupied 256x256 region
+                std::vector<std::tuple<int, int, int, int, int, const TileBlock*>> blocks;
                 for(uint8_t z = 0; z <= Otc::MAX_Z; ++z) {
                     for(const auto& it : m_tileBlocks[z]) {
-                        const TileBlock& block = it.second;
-                        for(const TilePtr& tile : block.getTiles()) {
-                            if(unlikely(!tile || tile->isEmpty()))
-                                continue;
-
-                            const Position& pos = tile->getPosition();
-                            if(unlikely(!pos.isValid()))
-                                continue;
-
-                            if(pos.x < px || pos.x >= px + 256
-                                    || pos.y < py || pos.y >= py + 256
-                                    || pos.z != pz) {
-                                if(!firstNode)
-                                    root->endNode(); /// OTBM_TILE_AREA
-
-                                firstNode = false;
-                                root->startNode(OTBM_TILE_AREA);
-
-                                px = pos.x & 0xFF00;
-                                py = pos.y & 0xFF00;
-                                pz = pos.z;
-                                root->addPos(px, py, pz);
-                            }
-
-                            root->startNode(tile->isHouseTile() ? OTBM_HOUSETILE : OTBM_TILE);
-                            root->addPoint(Point(pos.x, pos.y) & 0xFF);
-                            if(tile->isHouseTile())
-                                root->addU32(tile->getHouseId());
-
-                            if(tile->getFlags()) {
-                                root->addU8(OTBM_ATTR_TILE_FLAGS);
-                                root->addU32(tile->getFlags());
-                            }
-
-                            const auto& itemList = tile->getItems();
-                            const ItemPtr& ground = tile->getGround();
-                            if(ground) {
-                                // Those types are called "complex" needs other stuff to be written.
-                                // For containers, there is container items, for depot, depot it and so on.
-                                if(!ground->isContainer() && !ground->isDepot()
-                                        && !ground->isDoor() && !ground->isTeleport()) {
-                                    root->addU8(OTBM_ATTR_ITEM);
-                                    root->addU16(ground->getServerId());
-                                } else
-                                    ground->serializeItem(root);
-                            }
-                            for(const ItemPtr& item : itemList)
-                                if(!item->isGround())
-                                    item->serializeItem(root);
-
-                            root->endNode(); // OTBM_TILE
+                        int bx = it.first % (65536 / BLOCK_SIZE) * BLOCK_SIZE;
+                        int by = it.first / (65536 / BLOCK_SIZE) * BLOCK_SIZE;
+                        blocks.push_back(std::make_tuple((int)z, by & 0xFF00, bx & 0xFF00, by, bx, &it.second));
+                    }
+                }
+                std::sort(blocks.begin(), blocks.end());
+
+                for(const auto& it : blocks) {
+                    const TileBlock& block = *std::get<5>(it);
+                    for(const TilePtr& tile : block.getTiles()) {
+                        if(unlikely(!tile || tile->isEmpty()))
+                            continue;
+
+                        const Position& pos = tile->getPosition();
+                        if(unlikely(!pos.isValid()))
+                            continue;
+
+                        if(pos.x < px || pos.x >= px + 256
+                                || pos.y < py || pos.y >= py + 256
+                                || pos.z != pz) {
+                            if(!firstNode)
+                                root->endNode(); /// OTBM_TILE_AREA
+
+                            firstNode = false;
+                            root->startNode(OTBM_TILE_AREA);
+
+                            px = pos.x & 0xFF00;
+                            py = pos.y & 0xFF00;
+                            pz = pos.z;
+                            root->addPos(px, py, pz);
                         }
+
+                        root->startNode(tile->isHouseTile() ? OTBM_HOUSETILE : OTBM_TILE);
+                        root->addPoint(Point(pos.x, pos.y) & 0xFF);
+                        if(tile->isHouseTile())
+                            root->addU32(tile->getHouseId());
+
+                        if(tile->getFlags()) {
+                            root->addU8(OTBM_ATTR_TILE_FLAGS);
+                            root->addU32(tile->getFlags());
+                        }
+
+                        const ItemPtr& ground = tile->getGround();
+                        if(ground) {
+                            // Those types are called "complex" needs other stuff to be written.
+                            // For containers, there is container items, for depot, depot it and so on.
+                            if(!ground->isContainer() && !ground->isDepot()
+                                    && !ground->isDoor() && !ground->isTeleport()) {
+                                root->addU8(OTBM_ATTR_ITEM);
+                                root->addU16(ground->getServerId());
+                            } else
+                                ground->serializeItem(root);
+                        }
+                        for(const ThingPtr& thing : tile->rawGetThings()) {
+                            if(thing->isItem() && !thing->isGround())
+                                static_cast<Item*>(thing.get())->serializeItem(root);
+                        }
+
+                        root->endNode(); // OTBM_TILE
                     }
                 }
 
@@ -637,13 +1542,23 @@ void Map::saveOtbm(const std::string& fileName)
 }
 
 bool Map::loadOtcm(const std::string& fileName)
+{
+    return readOtcm(fileName, Rect(0, 0, 65536, 65536), 0, Otc::MAX_Z);
+}
+
+bool Map::loadOtcmRegion(const std::string& fileName, const Rect& area, int minZ, int maxZ)
+{
+    return readOtcm(fileName, area, minZ, maxZ);
+}
+
+bool Map::readOtcm(const std::string& fileName, const Rect& area, int minZ, int maxZ)
 {
     try {
+        ObjectArena::Scope arenaScope(m_arenaAllocation);
         FileStreamPtr fin = g_resources.openFile(fileName);
         if(!fin)
             stdext::throw_exception("unable to open file");
-
-        fin->cache();
+        MapFileSignature fileSignature = getMapFileSignature(fileName, fin);
 
         uint32 signature = fin->getU32();
         if(signature != OTCM_SIGNATURE)
@@ -654,7 +1569,8 @@ bool Map::loadOtcm(const std::string& fileName)
         fin->getU32(); // flags
 
         switch(version) {
-            case 1: {
+            case 1:
+            case 2: {
                 fin->getString(); // description
                 uint32 datSignature = fin->getU32();
                 fin->getU16(); // protocol version
@@ -669,43 +1585,126 @@ bool Map::loadOtcm(const std::string& fileName)
                 stdext::throw_exception("otcm version not supported");
         }
 
-        fin->seek(start);
+        auto inRegion = [&](const Position& pos) {
+            return pos.z >= minZ && pos.z <= maxZ && area.contains(Point(pos.x, pos.y));
+        };
 
-        while(true) {
+        struct ItemRecord {
+            uint16 id;
+            uint8 countOrSubType;
+        };
+        struct TileRecord {
             Position pos;
+            std::vector<ItemRecord> items;
+        };
+        auto addTile = [&](const TileRecord& record) {
+            const TilePtr& tile = createTile(record.pos);
+            int stackPos = 0;
+            for(const ItemRecord& itemRecord : record.items) {
+                ItemPtr item = Item::create(itemRecord.id);
+                item->setCountOrSubType(itemRecord.countOrSubType);
 
-            pos.x = fin->getU16();
-            pos.y = fin->getU16();
-            pos.z = fin->getU8();
-
-            // end of file
-            if(!pos.isValid())
-                break;
+                if(item->isValid()) {
+                    tile->addThing(item, stackPos++);
+                    if(m_itemIndexEnabled)
+                        m_itemIndex.add(item->getId(), record.pos);
+                }
+            }
+            notificateTileUpdate(record.pos);
+        };
 
-            const TilePtr& tile = g_map.createTile(pos);
+        if(version == 1) {
+            fin->cache();
+            fin->seek(start);
 
-            int stackPos = 0;
             while(true) {
-                int id = fin->getU16();
+                TileRecord record;
+                record.pos.x = fin->getU16();
+                record.pos.y = fin->getU16();
+                record.pos.z = fin->getU8();
 
-                // end of tile
-                if(id == 0xFFFF)
+                // end of file
+                if(!record.pos.isValid())
                     break;
 
-                int countOrSubType = fin->getU8();
+                while(true) {
+                    int id = fin->getU16();
 
-                ItemPtr item = Item::create(id);
-                item->setCountOrSubType(countOrSubType);
+                    // end of tile
+                    if(id == 0xFFFF)
+                        break;
 
-                if(item->isValid())
-                    tile->addThing(item, stackPos++);
+                    ItemRecord item;
+                    item.id = id;
+                    item.countOrSubType = fin->getU8();
+                    record.items.push_back(item);
+                }
+
+                if(inRegion(record.pos))
+                    addTile(record);
             }
 
-            g_map.notificateTileUpdate(pos);
+            fin->close();
+            addMapSignature(formatMapSignature(fileSignature, area, minZ, maxZ));
+            return true;
         }
 
+        // only blocks of the region are read from the file
+        fin->seek(start);
+        std::vector<DirectoryBlock> blocks;
+        for(const DirectoryBlock& block : BlockDirectory::read(fin)) {
+            Rect blockRect(block.pos.x, block.pos.y, BLOCK_SIZE, BLOCK_SIZE);
+            if(block.pos.z >= minZ && block.pos.z <= maxZ && area.intersects(blockRect))
+                blocks.push_back(block);
+        }
+        BlockDirectory::load(fin, blocks);
         fin->close();
 
+        // blocks are parsed in parallel, tiles are created on this thread
+        std::vector<std::vector<TileRecord>> records(blocks.size());
+        std::atomic<bool> corrupted(false);
+        BlockDirectory::parallelFor(blocks.size(), [&](size_t i) {
+            const DirectoryBlock& block = blocks[i];
+            const uint8 *data = (const uint8*)block.data.data();
+            size_t size = block.data.size(), pos = 0;
+            while(pos + 2 <= size) {
+                TileRecord record;
+                uint16 index = stdext::readULE16(data + pos);
+                pos += 2;
+                record.pos = Position(block.pos.x + index % BLOCK_SIZE, block.pos.y + index / BLOCK_SIZE, block.pos.z);
+                while(true) {
+                    if(pos + 2 > size) {
+                        corrupted = true;
+                        return;
+                    }
+                    uint16 id = stdext::readULE16(data + pos);
+                    pos += 2;
+
+                    // end of tile
+                    if(id == 0xFFFF)
+                        break;
+
+                    if(pos + 1 > size) {
+                        corrupted = true;
+                        return;
+                    }
+                    ItemRecord item;
+                    item.id = id;
+                    item.countOrSubType = data[pos++];
+                    record.items.push_back(item);
+                }
+                if(inRegion(record.pos))
+                    records[i].push_back(std::move(record));
+            }
+        });
+        if(corrupted)
+            stdext::throw_exception("corrupted tile block");
+
+        for(const std::vector<TileRecord>& blockRecords : records) {
+            for(const TileRecord& record : blockRecords)
+                addTile(record);
+        }
+        addMapSignature(formatMapSignature(fileSignature, area, minZ, maxZ));
         return true;
     } catch(stdext::exception& e) {
         g_logger.error(stdext::format("failed to load OTCM map: %s", e.what()));
@@ -721,7 +1720,6 @@ void Map::saveOtcm(const std::string& fileName)
         FileStreamPtr fin = g_resources.createFile(fileName);
         fin->cache();
 
-        //TODO: compression flag with zlib
         uint32 flags = 0;
 
         // header
@@ -731,7 +1729,7 @@ void Map::saveOtcm(const std::string& fileName)
         fin->addU32(flags);
 
         // version 1 header
-        fin->addString("OTCM 1.0"); // map description
+        fin->addString("OTCM 2.0"); // map description
         fin->addU32(g_things.getDatSignature());
         fin->addU16(g_game.getClientVersion());
         fin->addString(g_game.getWorldName());
@@ -742,40 +1740,47 @@ void Map::saveOtcm(const std::string& fileName)
         fin->addU16(start);
         fin->seek(start);
 
+        std::vector<std::pair<uint, const TileBlock*>> tileBlocks;
+        std::vector<DirectoryBlock> blocks;
         for(uint8_t z = 0; z <= Otc::MAX_Z; ++z) {
             for(const auto& it : m_tileBlocks[z]) {
-                const TileBlock& block = it.second;
-                for(const TilePtr& tile : block.getTiles()) {
-                    if(!tile || tile->isEmpty())
-                        continue;
-
-                    Position pos = tile->getPosition();
-                    fin->addU16(pos.x);
-                    fin->addU16(pos.y);
-                    fin->addU8(pos.z);
+                DirectoryBlock block;
+                block.pos = Position(it.first % (65536 / BLOCK_SIZE) * BLOCK_SIZE, it.first / (65536 / BLOCK_SIZE) * BLOCK_SIZE, z);
+                blocks.push_back(block);
+                tileBlocks.push_back(std::make_pair(it.first, &it.second));
+            }
+        }
 
-                    for(const ThingPtr& thing : tile->getThings()) {
-                        if(thing->isItem()) {
-                            ItemPtr item = thing->static_self_cast<Item>();
-                            fin->addU16(item->getId());
-                            fin->addU8(item->getCountOrSubType());
-                        }
+        // tiles are stored by their index inside the block, followed by their items
+        BlockDirectory::parallelFor(blocks.size(), [&](size_t i) {
+            std::string& data = blocks[i].data;
+            uint8 buffer[2];
+            const auto& tiles = tileBlocks[i].second->getTiles();
+            for(size_t index = 0; index < tiles.size(); ++index) {
+                const TilePtr& tile = tiles[index];
+                if(!tile || tile->isEmpty())
+                    continue;
+
+                stdext::writeULE16(buffer, index);
+                data.append((const char*)buffer, 2);
+                for(const ThingPtr& thing : tile->rawGetThings()) {
+                    if(thing->isItem()) {
+                        Item *item = static_cast<Item*>(thing.get());
+                        stdext::writeULE16(buffer, item->getId());
+                        data.append((const char*)buffer, 2);
+                        data.push_back(item->getCountOrSubType());
                     }
-
-                    // end of tile
-                    fin->addU16(0xFFFF);
                 }
+
+                // end of tile
+                stdext::writeULE16(buffer, 0xFFFF);
+                data.append((const char*)buffer, 2);
             }
-        }
+        });
 
-        // end of file
-        Position invalidPos;
-        fin->addU16(invalidPos.x);
-        fin->addU16(invalidPos.y);
-        fin->addU8(invalidPos.z);
+        BlockDirectory::write(fin, blocks, OTCM_COMPRESS_LEVEL);
 
         fin->flush();
-
         fin->close();
     } catch(stdext::exception& e) {
         g_logger.error(stdext::format("failed to save OTCM map: %s", e.what()));
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "mapjob.h"
+
+#include <framework/core/asyncdispatcher.h>
+#include <framework/core/eventdispatcher.h>
+
+// tasks of map jobs waiting for the one running, the next task is handed to the async
+// dispatcher only when the previous one returns, so no dispatcher thread waits for another job
+static std::mutex pendingTasksMutex;
+static std::deque<std::function<void()>> pendingTasks;
+static bool taskRunning = false;
+
+static void runNextTask()
+{
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock(pendingTasksMutex);
+        if(pendingTasks.empty()) {
+            taskRunning = false;
+            return;
+        }
+        task = std::move(pendingTasks.front());
+        pendingTasks.pop_front();
+    }
+    g_asyncDispatcher.schedule([task]() -> bool {
+        task();
+        runNextTask();
+        return true;
+    });
+}
+
+MapJob::MapJob(const std::string& name) :
+    m_name(name),
+    m_state(new MapJobState),
+    m_reportedDone(0),
+    m_finished(false)
+{
+}
+
+void MapJobState::cancel()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    cancelled = true;
+    m_resumed.notify_all();
+}
+
+void MapJobState::setPaused(bool pause)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    paused = pause;
+    if(!pause)
+        m_resumed.notify_all();
+}
+
+bool MapJobState::waitWhilePaused()
+{
+    if(paused) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_resumed.wait(lock, [this]() { return !paused || cancelled; });
+    }
+    return !cancelled;
+}
+
+MapJob::~MapJob()
+{
+    m_state->cancel();
+    joinThreads();
+}
+
+MapJobPtr MapJob::schedule(const std::string& name, const Task& task, const FinishCallback& onFinish)
+{
+    MapJobPtr job(new MapJob(name));
+    job->setFinishCallback(onFinish);
+    job->start();
+
+    MapJobStatePtr state = job->getState();
+    state->total = 1;
+    // the async dispatcher runs tasks on many threads, jobs still run one after another
+    std::function<void()> run = [task, state]() {
+        if(state->cancelled) {
+            state->finish(false, "cancelled");
+            return;
+        }
+        try {
+            bool result = task(state);
+            // tasks reporting their own progress may stop short of the total
+            state->done = (int)state->total;
+            if(!result && state->cancelled)
+                state->finish(false, "cancelled");
+            else
+                state->finish(result, result ? std::string() : "failed, see log for details");
+        } catch(std::exception& e) {
+            state->finish(false, e.what());
+        }
+    };
+
+    bool start;
+    {
+        std::lock_guard<std::mutex> lock(pendingTasksMutex);
+        pendingTasks.push_back(run);
+        start = !taskRunning;
+        taskRunning = true;
+    }
+    if(start)
+        runNextTask();
+    return job;
+}
+
+void MapJob::start()
+{
+    m_timer.restart();
+    MapJobPtr self = static_self_cast<MapJob>();
+    m_pollEvent = g_dispatcher.cycleEvent([self]() { self->poll(); }, MAPJOB_NOTIFY_INTERVAL);
+}
+
+void MapJob::poll()
+{
+    // read before done, so the last progress is always reported
+    bool finished = m_state->finished;
+
+    int done = m_state->done;
+    if(done != m_reportedDone) {
+        m_reportedDone = done;
+        callLuaField("onProgress", done, (int)m_state->total);
+    }
+
+    if(!finished)
+        return;
+
+    joinThreads();
+    m_finished = true;
+    m_pollEvent->cancel();
+    m_pollEvent = nullptr;
+
+    g_logger.debug(stdext::format("Map job '%s' %s in %d ms", m_name, m_state->succeeded ? "succeeded" : "failed", (int)getElapsedMillis()));
+    if(m_onFinish)
+        m_onFinish(m_state->succeeded);
+    callLuaField("onComplete", m_state->succeeded, m_state->error);
+}
+
+void MapJob::joinThreads()
+{
+    for(std::thread& thread : m_threads) {
+        if(thread.joinable())
+            thread.join();
+    }
+    m_threads.clear();
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef MAPJOB_H
+#define MAPJOB_H
+
+#include "declarations.h"
+#include <framework/core/declarations.h>
+#include <framework/luaengine/luaobject.h>
+
+enum {
+    MAPJOB_NOTIFY_INTERVAL = 100
+};
+
+// Part of a job shared with the threads running it, everything else stays on the main thread.
+struct MapJobState
+{
+    MapJobState() : done(0), total(0), cancelled(false), paused(false), finished(false), succeeded(false) { }
+
+    void advance(int count = 1) { done += count; }
+    void cancel();
+    void setPaused(bool pause);
+    // called by workers between work items, returns false when the job is cancelled
+    bool waitWhilePaused();
+    // must be called exactly once, after the last thread of the job is done with its work
+    void finish(bool result, const std::string& message = std::string()) {
+        succeeded = result;
+        error = message;
+        finished = true;
+    }
+
+    std::atomic<int> done;
+    std::atomic<int> total;
+    std::atomic<bool> cancelled;
+    std::atomic<bool> paused;
+    std::atomic<bool> finished;
+    bool succeeded;
+    std::string error;
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_resumed;
+};
+
+// Handle of a map load or render running in background. Progress and completion are reported
+// on the main thread (by a dispatcher event, every MAPJOB_NOTIFY_INTERVAL ms while the job runs)
+// through the lua fields onProgress(job, done, total) and onComplete(job, succeeded, error).
+class MapJob : public LuaObject
+{
+public:
+    typedef std::function<bool(const MapJobStatePtr&)> Task;
+    typedef std::function<void(bool)> FinishCallback;
+
+    MapJob(const std::string& name);
+    ~MapJob();
+
+    // runs task on an async dispatcher thread after the tasks of earlier jobs, onFinish is called on the main thread before onComplete
+    static MapJobPtr schedule(const std::string& name, const Task& task, const FinishCallback& onFinish = nullptr);
+
+    // starts reporting, threads added later are joined when the job finishes
+    void start();
+    void addThread(std::thread&& thread) { m_threads.push_back(std::move(thread)); }
+    void setFinishCallback(const FinishCallback& onFinish) { m_onFinish = onFinish; }
+
+    // running work items are finished (and their output synced) before the job stops
+    void cancel() { m_state->cancel(); }
+    void pause() { m_state->setPaused(true); }
+    void resume() { m_state->setPaused(false); }
+    bool isPaused() { return m_state->paused; }
+
+    std::string getName() { return m_name; }
+    int getDone() { return m_state->done; }
+    int getTotal() { return m_state->total; }
+    bool isCancelled() { return m_state->cancelled; }
+    bool isFinished() { return m_finished; }
+    bool isSucceeded() { return m_finished && m_state->succeeded; }
+    std::string getError() { return m_finished ? m_state->error : std::string(); }
+    ticks_t getElapsedMillis() { return m_timer.elapsed_millis(); }
+
+    const MapJobStatePtr& getState() { return m_state; }
+
+private:
+    void poll();
+    void joinThreads();
+
+    std::string m_name;
+    MapJobStatePtr m_state;
+    std::vector<std::thread> m_threads;
+    FinishCallback m_onFinish;
+    ScheduledEventPtr m_pollEvent;
+    stdext::timer m_timer;
+    int m_reportedDone;
+    bool m_finished;
+};
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "maplight.h"
+#include "map.h"
+#include "tile.h"
+#include "item.h"
+#include <framework/graphics/image.h>
+
+MapLight::MapLight()
+{
+    m_ambientLight.intensity = MAX_AMBIENT_LIGHT_INTENSITY;
+    m_ambientLight.color = 215;
+
+    // one bubble per light intensity, stored as rows for every vertical distance
+    // from the center, so a source is added with plain row by row multiply-adds
+    for(int intensity = 1; intensity <= MAX_LIGHT_INTENSITY; ++intensity) {
+        int radius = intensity * Otc::TILE_PIXELS;
+        int width = radius * 2 + 1;
+        std::vector<float>& bubble = m_bubbles[intensity];
+        bubble.resize(width * (radius + 1));
+        for(int y = 0; y <= radius; ++y) {
+            for(int x = -radius; x <= radius; ++x)
+                bubble[y * width + x + radius] = LightView::getBubbleIntensity(std::sqrt((float)(x*x + y*y)), radius, 0.1f);
+        }
+    }
+}
+
+void MapLight::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_blockSources.clear();
+}
+
+void MapLight::apply(const ImagePtr& image, int sx, int sy, int sz)
+{
+    int width = image->getWidth();
+    int height = image->getHeight();
+    int tilesWidth = width / Otc::TILE_PIXELS;
+    int tilesHeight = height / Otc::TILE_PIXELS;
+
+    Color ambient = LightView::getGlobalLightColor(m_ambientLight);
+    if(ambient.rF() >= 1.0f && ambient.gF() >= 1.0f && ambient.bF() >= 1.0f)
+        return;
+
+    std::vector<BlockSourcesPtr> blocks;
+    int minbx = (sx - MAX_LIGHT_INTENSITY) / BLOCK_SIZE;
+    int minby = (sy - MAX_LIGHT_INTENSITY) / BLOCK_SIZE;
+    int maxbx = (sx + tilesWidth + MAX_LIGHT_INTENSITY) / BLOCK_SIZE;
+    int maxby = (sy + tilesHeight + MAX_LIGHT_INTENSITY) / BLOCK_SIZE;
+    for(int by = std::max<int>(minby, 0); by <= maxby; ++by) {
+        for(int bx = std::max<int>(minbx, 0); bx <= maxbx; ++bx)
+            blocks.push_back(getBlockSources(bx, by, sz));
+    }
+
+    int pixelCount = width * height;
+    std::vector<float> red(pixelCount, ambient.rF());
+    std::vector<float> green(pixelCount, ambient.gF());
+    std::vector<float> blue(pixelCount, ambient.bF());
+
+    Point origin(sx * Otc::TILE_PIXELS, sy * Otc::TILE_PIXELS);
+    for(const BlockSourcesPtr& sources : blocks) {
+        for(BakedLightSource source : *sources) {
+            source.center -= origin;
+            addSource(&red[0], &green[0], &blue[0], width, height, source);
+        }
+    }
+
+    uint8 *pixels = image->getPixelData();
+    for(int i = 0; i < pixelCount; ++i) {
+        pixels[i*4 + 0] *= std::min<float>(red[i], 1.0f);
+        pixels[i*4 + 1] *= std::min<float>(green[i], 1.0f);
+        pixels[i*4 + 2] *= std::min<float>(blue[i], 1.0f);
+    }
+}
+
+MapLight::BlockSourcesPtr MapLight::getBlockSources(int bx, int by, int bz)
+{
+    uint64 key = ((uint64)bz << 32) | ((uint64)by << 16) | bx;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_blockSources.find(key);
+        if(it != m_blockSources.end())
+            return it->second;
+    }
+
+    // tiles are only read here, so blocks are collected without holding the lock
+    std::shared_ptr<std::vector<BakedLightSource>> blockSources(new std::vector<BakedLightSource>);
+    for(int y = by * BLOCK_SIZE; y < (by + 1) * BLOCK_SIZE; ++y) {
+        for(int x = bx * BLOCK_SIZE; x < (bx + 1) * BLOCK_SIZE; ++x) {
+            const TilePtr& tile = g_map.getTile(Position(x, y, bz));
+            if(!tile)
+                continue;
+            for(const ThingPtr& thing : tile->rawGetThings()) {
+                if(!thing->isItem() || !thing->hasLight())
+                    continue;
+                Light light = thing->getLight();
+                if(light.intensity == 0)
+                    continue;
+
+                Color color = LightView::getSourceColor(light);
+                BakedLightSource source;
+                source.center = Point(x * Otc::TILE_PIXELS + Otc::TILE_PIXELS / 2, y * Otc::TILE_PIXELS + Otc::TILE_PIXELS / 2);
+                source.intensity = std::min<int>(light.intensity, MAX_LIGHT_INTENSITY);
+                source.red = color.rF();
+                source.green = color.gF();
+                source.blue = color.bF();
+                blockSources->push_back(source);
+            }
+        }
+    }
+
+    // another chunk may have collected the same block meanwhile, keep the first one
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_blockSources.insert(std::make_pair(key, BlockSourcesPtr(blockSources))).first->second;
+}
+
+void MapLight::addSource(float *red, float *green, float *blue, int width, int height, const BakedLightSource& source)
+{
+    int radius = source.intensity * Otc::TILE_PIXELS;
+    int minx = std::max<int>(source.center.x - radius, 0);
+    int miny = std::max<int>(source.center.y - radius, 0);
+    int maxx = std::min<int>(source.center.x + radius, width - 1);
+    int maxy = std::min<int>(source.center.y + radius, height - 1);
+    if(minx > maxx || miny > maxy)
+        return;
+
+    const std::vector<float>& bubble = m_bubbles[source.intensity];
+    int bubbleWidth = radius * 2 + 1;
+    int count = maxx - minx + 1;
+    for(int y = miny; y <= maxy; ++y) {
+        const float *row = &bubble[std::abs(y - source.center.y) * bubbleWidth + minx - source.center.x + radius];
+        float *r = red + y * width + minx;
+        float *g = green + y * width + minx;
+        float *b = blue + y * width + minx;
+        // branch free loop over contiguous planes, left for the compiler to vectorize
+        for(int x = 0; x < count; ++x) {
+            r[x] += source.red * row[x];
+            g[x] += source.green * row[x];
+            b[x] += source.blue * row[x];
+        }
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef MAPLIGHT_H
+#define MAPLIGHT_H
+
+#include "declarations.h"
+#include "lightview.h"
+#include <framework/graphics/declarations.h>
+
+struct BakedLightSource {
+    Point center;
+    int intensity;
+    float red;
+    float green;
+    float blue;
+};
+
+// CPU counterpart of LightView for generated map images. Item lights are summed
+// with the LightView bubble falloff into a light buffer that is multiplied into
+// the image. Light sources are collected once per tile block outside the lock,
+// so neighbour chunks reuse them; clear() must be called when tiles change.
+// The ambient light is full until one is set, and full light leaves images untouched.
+class MapLight
+{
+public:
+    MapLight();
+
+    void clear();
+    void apply(const ImagePtr& image, int sx, int sy, int sz);
+
+    void setAmbientLight(const Light& light) { m_ambientLight = light; }
+    Light getAmbientLight() { return m_ambientLight; }
+
+private:
+    typedef std::shared_ptr<const std::vector<BakedLightSource>> BlockSourcesPtr;
+
+    BlockSourcesPtr getBlockSources(int bx, int by, int bz);
+    void addSource(float *red, float *green, float *blue, int width, int height, const BakedLightSource& source);
+
+    Light m_ambientLight;
+    std::mutex m_mutex;
+    std::unordered_map<uint64, BlockSourcesPtr> m_blockSources;
+    std::vector<float> m_bubbles[MAX_LIGHT_INTENSITY + 1];
+};
+
+#endif
@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "maprenderjob.h"
+
+#include <framework/core/resourcemanager.h>
+#include <framework/platform/platform.h>
+
+#include <fstream>
+
+namespace fs = boost::filesystem;
+
+std::string MapRenderJob::resolveDir(const std::string& dir)
+{
+    // relative job directories live in the write directory, absolute ones may be on a shared filesystem
+    fs::path path(dir);
+    if(path.is_absolute())
+        return path.generic_string();
+    return (fs::path(g_resources.getWriteDir()) / path).generic_string();
+}
+
+std::vector<Point> getHilbertChunks(int minx, int miny, int maxx, int maxy)
+{
+    int bits = 0;
+    while((1 << bits) < std::max(maxx - minx + 1, maxy - miny + 1))
+        bits++;
+
+    std::vector<std::pair<uint64, Point>> curve;
+    curve.reserve((maxx - minx + 1) * (maxy - miny + 1));
+    for(int x = minx; x <= maxx; ++x)
+        for(int y = miny; y <= maxy; ++y)
+            curve.push_back(std::make_pair(stdext::hilbert_index(x - minx, y - miny, bits), Point(x, y)));
+    std::sort(curve.begin(), curve.end(), [](const std::pair<uint64, Point>& a, const std::pair<uint64, Point>& b) { return a.first < b.first; });
+
+    std::vector<Point> chunks;
+    chunks.reserve(curve.size());
+    for(const auto& it : curve)
+        chunks.push_back(it.second);
+    return chunks;
+}
+
+bool MapRenderJob::plan(const std::string& dir, int minx, int miny, int minz, int maxx, int maxy, int maxz, int shardSize)
+{
+    try {
+        if(shardSize <= 0 || minx > maxx || miny > maxy || minz > maxz)
+            stdext::throw_exception("invalid job bounds");
+
+        // tile positions to 8x8 tiles chunks
+        std::string bounds = stdext::format("bounds %d %d %d %d %d %d %d", minx / 8, miny / 8, minz, maxx / 8, maxy / 8, maxz, shardSize);
+
+        fs::path path(resolveDir(dir));
+        fs::path manifest = path / "manifest";
+        if(fs::exists(manifest)) {
+            std::ifstream in(manifest.string());
+            std::string header, line;
+            std::getline(in, header);
+            std::getline(in, line);
+            if(line != bounds)
+                stdext::throw_exception(stdext::format("directory already has a job planned with different %s", line));
+            g_logger.info(stdext::format("Render job '%s' is already planned, it will be resumed", path.generic_string()));
+            return true;
+        }
+
+        fs::create_directories(path / "shards");
+
+        std::stringstream data;
+        data << "otclient-map-job " << MAPJOB_VERSION << "\n" << bounds << "\n";
+        int id = 0;
+        // shards are claimed in id order, so workers start on neighbouring shards
+        int shardsX = (maxx / 8 - minx / 8) / shardSize, shardsY = (maxy / 8 - miny / 8) / shardSize;
+        for(int z = minz; z <= maxz; ++z) {
+            for(const Point& shard : getHilbertChunks(0, 0, shardsX, shardsY)) {
+                int x = minx / 8 + shard.x * shardSize, y = miny / 8 + shard.y * shardSize;
+                data << "shard " << id++ << " " << x << " " << y << " "
+                     << std::min(x + shardSize - 1, maxx / 8) << " " << std::min(y + shardSize - 1, maxy / 8) << " " << z << "\n";
+            }
+        }
+        writeFileAtomic(manifest, data.str());
+        g_logger.info(stdext::format("Planned render job '%s' with %d shards", path.generic_string(), id));
+        return true;
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Failed to plan render job '%s': %s", dir, e.what()));
+        return false;
+    }
+}
+
+bool MapRenderJob::load(const std::string& dir)
+{
+    try {
+        m_dir = resolveDir(dir);
+        m_shards.clear();
+
+        std::ifstream in((m_dir / "manifest").string());
+        if(!in)
+            stdext::throw_exception("missing manifest, plan the job first");
+
+        std::string tag;
+        int version;
+        in >> tag >> version;
+        if(tag != "otclient-map-job" || version < 1 || version > MAPJOB_VERSION)
+            stdext::throw_exception("invalid manifest");
+        m_version = version;
+
+        std::string line;
+        std::getline(in, line);
+        while(std::getline(in, line)) {
+            std::istringstream shardLine(line);
+            MapRenderShard shard;
+            if(shardLine >> tag && tag == "shard" && shardLine >> shard.id >> shard.minx >> shard.miny >> shard.maxx >> shard.maxy >> shard.z)
+                m_shards.push_back(shard);
+        }
+        return true;
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Failed to load render job '%s': %s", dir, e.what()));
+        return false;
+    }
+}
+
+int MapRenderJob::claimShard(const std::string& owner, int staleSeconds)
+{
+    for(int shard = 0; shard < (int)m_shards.size(); ++shard) {
+        if(isCompleted(shard))
+            continue;
+
+        if(!createLock(shard, owner)) {
+            if(!isStale(shard, staleSeconds) || !reclaimLock(shard, owner, staleSeconds))
+                continue;
+            g_logger.info(stdext::format("Reclaimed stale render job shard %d", shard));
+        }
+
+        // finished by another process between the checks
+        if(isCompleted(shard)) {
+            release(shard);
+            continue;
+        }
+        return shard;
+    }
+    return -1;
+}
+
+bool MapRenderJob::createLock(int shard, const std::string& owner)
+{
+    boost::system::error_code ec;
+    fs::path lock = getShardPath(shard, ".lock");
+    // some boost versions report a missing path as an error, so only the status is checked, a lock
+    // that can't be checked makes the rename below fail
+    if(fs::exists(fs::status(lock, ec)))
+        return false;
+
+    // the lock is renamed into place together with its owner file, so it never exists without an owner
+    // and renaming onto the lock of another process fails (directory renames never replace non empty ones)
+    fs::path tmp = getShardPath(shard, ".lock." + fs::unique_path().string() + ".tmp");
+    if(!fs::create_directory(tmp, ec))
+        return false;
+    try {
+        writeFileAtomic(tmp / "owner", owner);
+    } catch(...) {
+        fs::remove_all(tmp, ec);
+        throw;
+    }
+    fs::rename(tmp, lock, ec);
+    if(ec) {
+        fs::remove_all(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+bool MapRenderJob::reclaimLock(int shard, const std::string& owner, int staleSeconds)
+{
+    boost::system::error_code ec;
+    fs::path lock = getShardPath(shard, ".lock");
+    fs::path token = lock / "owner";
+
+    if(!fs::exists(token, ec)) {
+        // a process died while reclaiming the lock and left its renamed token as the only file. Every
+        // rename changes the lock directory, so when it is unchanged before and after listing nobody is
+        // reclaiming it right now and the listed file is that token, which is put back first
+        auto unchanged = [&]() {
+            std::time_t changed = fs::last_write_time(lock, ec);
+            return !ec && std::time(nullptr) - changed > staleSeconds;
+        };
+        if(!unchanged())
+            return false;
+        std::vector<fs::path> files;
+        for(fs::directory_iterator it(lock, ec), end; !ec && it != end; it.increment(ec))
+            files.push_back(it->path());
+        if(ec || files.size() != 1 || !unchanged())
+            return false;
+        fs::rename(files[0], token, ec);
+        if(ec)
+            return false;
+    }
+
+    // only one process can rename the token away, and it checks the renamed file again: the owner
+    // may have renewed it or another process may have reclaimed the lock since the staleness check
+    std::string staleOwner = readFile(token);
+    fs::path taken = lock / ("owner." + fs::unique_path().string() + ".reclaim");
+    fs::rename(token, taken, ec);
+    if(ec)
+        return false;
+    std::time_t heartbeat = fs::last_write_time(taken, ec);
+    if(ec || std::time(nullptr) - heartbeat <= staleSeconds || readFile(taken) != staleOwner) {
+        fs::rename(taken, lock / "owner", ec);
+        return false;
+    }
+
+    // the new owner is written before the token is removed, so the lock is never empty
+    writeFileAtomic(lock / "owner", owner);
+    fs::remove(taken, ec);
+    return true;
+}
+
+std::vector<Point> MapRenderJob::getShardChunks(int shard)
+{
+    const MapRenderShard& area = m_shards[shard];
+    if(m_version >= 2)
+        return getHilbertChunks(area.minx, area.miny, area.maxx, area.maxy);
+
+    std::vector<Point> chunks;
+    for(int x = area.minx; x <= area.maxx; ++x)
+        for(int y = area.miny; y <= area.maxy; ++y)
+            chunks.push_back(Point(x, y));
+    return chunks;
+}
+
+int MapRenderJob::getCheckpoint(int shard)
+{
+    std::ifstream in(getShardPath(shard, ".progress").string());
+    int completedChunks = 0;
+    if(in >> completedChunks)
+        return completedChunks;
+    return 0;
+}
+
+bool MapRenderJob::checkpoint(int shard, const std::string& owner, int completedChunks)
+{
+    fs::path token = getShardPath(shard, ".lock") / "owner";
+    if(readFile(token) != owner)
+        return false;
+    // rewriting the owner file is also the heartbeat that keeps the lock from going stale, it is renewed
+    // before the progress so the lock can't be reclaimed while the progress is written
+    writeFileAtomic(token, owner);
+    writeFileAtomic(getShardPath(shard, ".progress"), stdext::to_string(completedChunks));
+    return true;
+}
+
+void MapRenderJob::complete(int shard)
+{
+    writeFileAtomic(getShardPath(shard, ".done"), "done");
+    boost::system::error_code ec;
+    fs::remove(getShardPath(shard, ".progress"), ec);
+    release(shard);
+}
+
+void MapRenderJob::release(int shard)
+{
+    // moved away before it is removed, so a process claiming the shard meanwhile never gets its new
+    // lock removed with this one
+    boost::system::error_code ec;
+    fs::path released = getShardPath(shard, ".lock." + fs::unique_path().string() + ".released");
+    fs::rename(getShardPath(shard, ".lock"), released, ec);
+    if(!ec)
+        fs::remove_all(released, ec);
+}
+
+bool MapRenderJob::isCompleted(int shard)
+{
+    boost::system::error_code ec;
+    return fs::exists(getShardPath(shard, ".done"), ec);
+}
+
+int MapRenderJob::getCompletedCount()
+{
+    int count = 0;
+    for(int shard = 0; shard < (int)m_shards.size(); ++shard) {
+        if(isCompleted(shard))
+            count++;
+    }
+    return count;
+}
+
+fs::path MapRenderJob::getShardPath(int shard, const std::string& extension)
+{
+    return m_dir / "shards" / (stdext::to_string(m_shards[shard].id) + extension);
+}
+
+bool MapRenderJob::isStale(int shard, int staleSeconds)
+{
+    boost::system::error_code ec;
+    fs::path lock = getShardPath(shard, ".lock");
+    std::time_t heartbeat = fs::last_write_time(lock / "owner", ec);
+    if(ec)
+        heartbeat = fs::last_write_time(lock, ec);
+    if(ec)
+        return false;
+    return std::time(nullptr) - heartbeat > staleSeconds;
+}
+
+std::string MapRenderJob::readFile(const fs::path& path)
+{
+    std::ifstream in(path.string(), std::ios::binary);
+    std::stringstream data;
+    data << in.rdbuf();
+    return data.str();
+}
+
+void MapRenderJob::writeFileAtomic(const fs::path& path, const std::string& data)
+{
+    fs::path tmp = path;
+    tmp += "." + fs::unique_path().string() + ".tmp";
+    {
+        std::ofstream out(tmp.string(), std::ios::binary | std::ios::trunc);
+        out << data;
+        out.flush();
+        if(!out)
+            stdext::throw_exception(stdext::format("unable to write '%s'", tmp.generic_string()));
+    }
+    g_platform.syncFile(tmp.string());
+    fs::rename(tmp, path);
+}
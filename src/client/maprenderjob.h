@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef MAPRENDERJOB_H
+#define MAPRENDERJOB_H
+
+#include "declarations.h"
+
+#include <boost/filesystem.hpp>
+
+enum {
+    MAPJOB_VERSION = 2, // version 1 jobs rendered shard chunks column by column
+    MAPJOB_STALE_SECONDS = 600
+};
+
+struct MapRenderShard
+{
+    int id;
+    int minx, miny, maxx, maxy; // chunk coordinates, inclusive
+    int z;
+
+    int getChunkCount() const { return (maxx - minx + 1) * (maxy - miny + 1); }
+};
+
+// chunks of a rectangle (inclusive) along a hilbert curve, so consecutive chunks are neighbours
+// and share tile blocks and sprites
+std::vector<Point> getHilbertChunks(int minx, int miny, int maxx, int maxy);
+
+// Durable description of a map render split into shards (rectangles of 8x8 tile chunks on one floor).
+// Everything lives in one directory, so independent processes sharing it (even over a network
+// filesystem) can cooperate: shards are claimed with lock directories, progress inside a shard is
+// checkpointed and finished shards get a done marker, so a killed render resumes where it stopped.
+class MapRenderJob
+{
+public:
+    MapRenderJob() : m_version(MAPJOB_VERSION) { }
+
+    static bool plan(const std::string& dir, int minx, int miny, int minz, int maxx, int maxy, int maxz, int shardSize);
+
+    bool load(const std::string& dir);
+
+    // returns shard index or -1 when every shard is done or claimed by a live owner
+    int claimShard(const std::string& owner, int staleSeconds = MAPJOB_STALE_SECONDS);
+    // chunks in render order, checkpoints count chunks of this list
+    std::vector<Point> getShardChunks(int shard);
+    int getCheckpoint(int shard);
+    // chunks counted by a checkpoint must be on disk already, returns false without writing anything
+    // when owner lost the lock of the shard (it went stale and another worker reclaimed it)
+    bool checkpoint(int shard, const std::string& owner, int completedChunks);
+    void complete(int shard);
+    void release(int shard);
+
+    bool isCompleted(int shard);
+    int getCompletedCount();
+    int getShardCount() { return m_shards.size(); }
+    const MapRenderShard& getShard(int shard) { return m_shards[shard]; }
+
+    static std::string resolveDir(const std::string& dir);
+    // writes a temporary file, syncs it and renames it over path
+    static void writeFileAtomic(const boost::filesystem::path& path, const std::string& data);
+
+private:
+    boost::filesystem::path getShardPath(int shard, const std::string& extension);
+    bool isStale(int shard, int staleSeconds);
+    bool createLock(int shard, const std::string& owner);
+    bool reclaimLock(int shard, const std::string& owner, int staleSeconds);
+    static std::string readFile(const boost::filesystem::path& path);
+
+    boost::filesystem::path m_dir;
+    std::vector<MapRenderShard> m_shards;
+    int m_version;
+};
+
+#endif
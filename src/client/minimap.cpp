@@ -23,6 +23,7 @@
 
 #include "minimap.h"
 #include "tile.h"
+#include "blockdirectory.h"
 
 #include <framework/graphics/image.h>
 #include <framework/graphics/texture.h>
@@ -304,14 +305,22 @@ void Minimap::saveImage(const std::string& fileName, const Rect& mapRect)
 }
 
 bool Minimap::loadOtmm(const std::string& fileName)
+{
+    return readOtmm(fileName, Rect(0, 0, 65536, 65536), 0, Otc::MAX_Z);
+}
+
+bool Minimap::loadOtmmRegion(const std::string& fileName, const Rect& area, int minZ, int maxZ)
+{
+    return readOtmm(fileName, area, minZ, maxZ);
+}
+
+bool Minimap::readOtmm(const std::string& fileName, const Rect& area, int minZ, int maxZ)
 {
     try {
         FileStreamPtr fin = g_resources.openFile(fileName);
         if(!fin)
             stdext::throw_exception("unable to open file");
 
-        fin->cache();
-
         uint32 signature = fin->getU32();
         if(signature != OTMM_SIGNATURE)
             stdext::throw_exception("invalid OTMM file");
@@ -321,7 +330,8 @@ bool Minimap::loadOtmm(const std::string& fileName)
         fin->getU32(); // flags
 
         switch(version) {
-            case 1: {
+            case 1:
+            case 2: {
                 fin->getString(); // description
                 break;
             }
@@ -329,36 +339,63 @@ bool Minimap::loadOtmm(const std::string& fileName)
                 stdext::throw_exception("OTMM version not supported");
         }
 
-        fin->seek(start);
-
         uint blockSize = MMBLOCK_SIZE * MMBLOCK_SIZE * sizeof(MinimapTile);
-        std::vector<uchar> compressBuffer(compressBound(blockSize));
-        std::vector<uchar> decompressBuffer(blockSize);
+        auto inRegion = [&](const Position& pos) {
+            return pos.z >= minZ && pos.z <= maxZ && area.intersects(Rect(pos.x, pos.y, MMBLOCK_SIZE, MMBLOCK_SIZE));
+        };
+        auto setBlock = [&](const Position& pos, const uchar *tiles) {
+            MinimapBlock& block = getBlock(pos);
+            memcpy((uchar*)&block.getTiles(), tiles, blockSize);
+            block.mustUpdate();
+            block.justSaw();
+        };
 
-        while(true) {
-            Position pos;
-            pos.x = fin->getU16();
-            pos.y = fin->getU16();
-            pos.z = fin->getU8();
+        if(version == 1) {
+            fin->cache();
+            fin->seek(start);
 
-            // end of file or file is corrupted
-            if(!pos.isValid() || pos.z >= Otc::MAX_Z+1)
-                break;
+            std::vector<uchar> compressBuffer(compressBound(blockSize));
+            std::vector<uchar> decompressBuffer(blockSize);
 
-            MinimapBlock& block = getBlock(pos);
-            ulong len = fin->getU16();
-            ulong destLen = blockSize;
-            fin->read(compressBuffer.data(), len);
-            int ret = uncompress(decompressBuffer.data(), &destLen, compressBuffer.data(), len);
-            if(ret != Z_OK || destLen != blockSize)
-                break;
+            while(true) {
+                Position pos;
+                pos.x = fin->getU16();
+                pos.y = fin->getU16();
+                pos.z = fin->getU8();
 
-            memcpy((uchar*)&block.getTiles(), decompressBuffer.data(), blockSize);
-            block.mustUpdate();
-            block.justSaw();
+                // end of file or file is corrupted
+                if(!pos.isValid() || pos.z >= Otc::MAX_Z+1)
+                    break;
+
+                ulong len = fin->getU16();
+                ulong destLen = blockSize;
+                fin->read(compressBuffer.data(), len);
+                int ret = uncompress(decompressBuffer.data(), &destLen, compressBuffer.data(), len);
+                if(ret != Z_OK || destLen != blockSize)
+                    break;
+
+                if(inRegion(pos))
+                    setBlock(pos, decompressBuffer.data());
+            }
+
+            fin->close();
+            return true;
         }
 
+        // only blocks of the region are read and they are decompressed in parallel
+        fin->seek(start);
+        std::vector<DirectoryBlock> blocks;
+        for(const DirectoryBlock& block : BlockDirectory::read(fin)) {
+            if(block.rawSize != blockSize)
+                stdext::throw_exception("invalid block size");
+            if(inRegion(block.pos))
+                blocks.push_back(block);
+        }
+        BlockDirectory::load(fin, blocks);
         fin->close();
+
+        for(const DirectoryBlock& block : blocks)
+            setBlock(block.pos, (const uchar*)block.data.data());
         return true;
     } catch(stdext::exception& e) {
         g_logger.error(stdext::format("failed to load OTMM minimap: %s", e.what()));
@@ -374,7 +411,6 @@ void Minimap::saveOtmm(const std::string& fileName)
         FileStreamPtr fin = g_resources.createFile(fileName);
         fin->cache();
 
-        //TODO: compression flag with zlib
         uint32 flags = 0;
 
         // header
@@ -384,7 +420,7 @@ void Minimap::saveOtmm(const std::string& fileName)
         fin->addU32(flags);
 
         // version 1 header
-        fin->addString("OTMM 1.0"); // description
+        fin->addString("OTMM 2.0"); // description
 
         // go back and rewrite where the map data starts
         uint32 start = fin->tell();
@@ -393,34 +429,23 @@ void Minimap::saveOtmm(const std::string& fileName)
         fin->seek(start);
 
         uint blockSize = MMBLOCK_SIZE * MMBLOCK_SIZE * sizeof(MinimapTile);
-        std::vector<uchar> compressBuffer(compressBound(blockSize));
         const int COMPRESS_LEVEL = 3;
 
+        std::vector<DirectoryBlock> blocks;
         for(uint8_t z = 0; z <= Otc::MAX_Z; ++z) {
             for(auto& it : m_tileBlocks[z]) {
-                int index = it.first;
                 MinimapBlock& block = it.second;
                 if(!block.wasSeen())
                     continue;
 
-                Position pos = getIndexPosition(index, z);
-                fin->addU16(pos.x);
-                fin->addU16(pos.y);
-                fin->addU8(pos.z);
-
-                ulong len = blockSize;
-                int ret = compress2(compressBuffer.data(), &len, (uchar*)&block.getTiles(), blockSize, COMPRESS_LEVEL);
-                assert(ret == Z_OK);
-                fin->addU16(len);
-                fin->write(compressBuffer.data(), len);
+                DirectoryBlock directoryBlock;
+                directoryBlock.pos = getIndexPosition(it.first, z);
+                directoryBlock.data.assign((const char*)&block.getTiles(), blockSize);
+                blocks.push_back(directoryBlock);
             }
         }
 
-        // end of file
-        Position invalidPos;
-        fin->addU16(invalidPos.x);
-        fin->addU16(invalidPos.y);
-        fin->addU8(invalidPos.z);
+        BlockDirectory::write(fin, blocks, COMPRESS_LEVEL);
 
         fin->flush();
 
@@ -30,7 +30,7 @@
 enum {
     MMBLOCK_SIZE = 64,
     OTMM_SIGNATURE = 0x4D4d544F,
-    OTMM_VERSION = 1
+    OTMM_VERSION = 2
 };
 
 enum MinimapTileFlags {
@@ -95,9 +95,11 @@ public:
     bool loadImage(const std::string& fileName, const Position& topLeft, float colorFactor);
     void saveImage(const std::string& fileName, const Rect& mapRect);
     bool loadOtmm(const std::string& fileName);
+    bool loadOtmmRegion(const std::string& fileName, const Rect& area, int minZ, int maxZ);
     void saveOtmm(const std::string& fileName);
 
 private:
+    bool readOtmm(const std::string& fileName, const Rect& area, int minZ, int maxZ);
     Rect calcMapRect(const Rect& screenRect, const Position& mapCenter, float scale);
     bool hasBlock(const Position& pos) { return m_tileBlocks[pos.z].find(getBlockIndex(pos)) != m_tileBlocks[pos.z].end(); }
     MinimapBlock& getBlock(const Position& pos) { return m_tileBlocks[pos.z][getBlockIndex(pos)]; }
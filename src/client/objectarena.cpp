@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "objectarena.h"
+#include <boost/thread/tss.hpp>
+
+// scopes live on the stack of their thread, so nothing is deleted at thread exit
+static void keepScope(ObjectArena::Scope*) { }
+static boost::thread_specific_ptr<ObjectArena::Scope> threadScope(&keepScope);
+
+ObjectArena::ObjectArena(size_t objectSize, size_t objectsPerChunk) :
+    m_slotSize(HEADER_SIZE + ((objectSize + HEADER_SIZE - 1) / HEADER_SIZE) * HEADER_SIZE),
+    m_objectSize(objectSize),
+    m_objectsPerChunk(objectsPerChunk),
+    m_scopes(0),
+    m_freeSlots(nullptr),
+    m_liveObjects(0)
+{
+}
+
+ObjectArena::~ObjectArena()
+{
+    // objects still alive at exit keep their memory
+    trim();
+}
+
+void *ObjectArena::allocate(size_t size)
+{
+    Scope *scope = threadScope.get();
+    if(!scope || size > m_objectSize) {
+        uint8 *block = (uint8*)::operator new(HEADER_SIZE + size);
+        ((Header*)block)->arena = nullptr;
+        return block + HEADER_SIZE;
+    }
+
+    ThreadCache& cache = scope->getCache(this);
+    // slots freed by any thread are taken all at once, so popping them needs no lock
+    if(!cache.freeSlots && m_freeSlots.load(std::memory_order_relaxed))
+        cache.freeSlots = m_freeSlots.exchange(nullptr, std::memory_order_acquire);
+
+    uint8 *slot;
+    if(cache.freeSlots) {
+        slot = (uint8*)cache.freeSlots;
+        cache.freeSlots = cache.freeSlots->next;
+    } else {
+        if(cache.left == 0)
+            refill(cache);
+        slot = cache.next;
+        cache.next += m_slotSize;
+        cache.left--;
+    }
+    ((Header*)slot)->arena = this;
+    m_liveObjects++;
+    return slot + HEADER_SIZE;
+}
+
+void ObjectArena::deallocate(void *p)
+{
+    if(!p)
+        return;
+
+    uint8 *block = (uint8*)p - HEADER_SIZE;
+    if(ObjectArena *arena = ((Header*)block)->arena)
+        arena->release(block);
+    else
+        ::operator delete(block);
+}
+
+void ObjectArena::refill(ThreadCache& cache)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(!m_spans.empty()) {
+        cache.next = m_spans.back().begin;
+        cache.left = m_spans.back().count;
+        m_spans.pop_back();
+    } else {
+        m_chunks.push_back((uint8*)::operator new(m_slotSize * m_objectsPerChunk));
+        cache.next = m_chunks.back();
+        cache.left = m_objectsPerChunk;
+    }
+}
+
+void ObjectArena::returnCache(ThreadCache& cache)
+{
+    if(cache.freeSlots) {
+        FreeSlot *last = cache.freeSlots;
+        while(last->next)
+            last = last->next;
+        last->next = m_freeSlots.load(std::memory_order_relaxed);
+        while(!m_freeSlots.compare_exchange_weak(last->next, cache.freeSlots, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // the rest of the span is kept for the next scope
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(cache.left > 0) {
+        Span span;
+        span.begin = cache.next;
+        span.count = cache.left;
+        m_spans.push_back(span);
+    }
+    m_scopes--;
+}
+
+void ObjectArena::release(uint8 *slot)
+{
+    FreeSlot *freeSlot = (FreeSlot*)slot;
+    freeSlot->next = m_freeSlots.load(std::memory_order_relaxed);
+    while(!m_freeSlots.compare_exchange_weak(freeSlot->next, freeSlot, std::memory_order_release, std::memory_order_relaxed));
+    m_liveObjects--;
+}
+
+bool ObjectArena::trim()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_liveObjects > 0 || m_scopes > 0)
+        return false;
+
+    for(uint8 *chunk : m_chunks)
+        ::operator delete(chunk);
+    m_chunks.clear();
+    m_spans.clear();
+    m_freeSlots = nullptr;
+    return true;
+}
+
+size_t ObjectArena::getMemoryUsage()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_chunks.size() * m_slotSize * m_objectsPerChunk;
+}
+
+ObjectArena::Scope::Scope(bool enable) : m_enabled(enable), m_previous(nullptr)
+{
+    if(!m_enabled)
+        return;
+    m_previous = threadScope.get();
+    threadScope.reset(this);
+}
+
+ObjectArena::Scope::~Scope()
+{
+    if(!m_enabled)
+        return;
+    for(ThreadCache& cache : m_caches)
+        cache.arena->returnCache(cache);
+    threadScope.reset(m_previous);
+}
+
+ObjectArena::ThreadCache& ObjectArena::Scope::getCache(ObjectArena *arena)
+{
+    for(ThreadCache& cache : m_caches) {
+        if(cache.arena == arena)
+            return cache;
+    }
+
+    {
+        // trim() must not free chunks while a scope allocates from them
+        std::lock_guard<std::mutex> lock(arena->m_mutex);
+        arena->m_scopes++;
+    }
+    ThreadCache cache;
+    cache.arena = arena;
+    cache.next = nullptr;
+    cache.left = 0;
+    cache.freeSlots = nullptr;
+    m_caches.push_back(cache);
+    return m_caches.back();
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef OBJECTARENA_H
+#define OBJECTARENA_H
+
+#include <framework/global.h>
+
+// Fixed size slots carved from big chunks for tiles and items created while a map
+// is loaded. Slots are kept in a free list when objects die, so reloading a map
+// reuses them, and all chunks are released at once by trim() when the arena is
+// empty. Every allocation carries a small header with its arena, so objects
+// allocated outside of a Scope (or too big for a slot) go to the heap and are
+// freed by the same deallocate().
+//
+// Each thread inside a Scope bumps through a span of slots of its own and
+// takes freed slots in batches, so allocating takes no lock. Any thread can
+// free a slot by pushing it onto a lock free stack.
+class ObjectArena
+{
+    struct FreeSlot {
+        FreeSlot *next;
+    };
+
+    // slots one scope allocates from without locking
+    struct ThreadCache {
+        ObjectArena *arena;
+        uint8 *next;
+        size_t left;
+        FreeSlot *freeSlots;
+    };
+
+public:
+    ObjectArena(size_t objectSize, size_t objectsPerChunk = 4096);
+    ~ObjectArena();
+
+    void *allocate(size_t size);
+    static void deallocate(void *p);
+
+    // releases every chunk when no object of the arena is alive and no scope uses it
+    bool trim();
+    size_t getLiveObjects() { return m_liveObjects; }
+    size_t getMemoryUsage();
+
+    // objects allocated by the thread that opened the scope come from arenas,
+    // scopes of different threads are independent and scopes can be nested
+    class Scope
+    {
+    public:
+        Scope(bool enable);
+        ~Scope();
+
+    private:
+        ThreadCache& getCache(ObjectArena *arena);
+
+        bool m_enabled;
+        Scope *m_previous;
+        std::vector<ThreadCache> m_caches;
+
+        friend class ObjectArena;
+    };
+
+private:
+    struct Header {
+        ObjectArena *arena;
+    };
+    struct Span {
+        uint8 *begin;
+        size_t count;
+    };
+    enum { HEADER_SIZE = 16 };
+
+    void refill(ThreadCache& cache);
+    void returnCache(ThreadCache& cache);
+    void release(uint8 *slot);
+
+    size_t m_slotSize;
+    size_t m_objectSize;
+    size_t m_objectsPerChunk;
+    std::vector<uint8*> m_chunks;
+    std::vector<Span> m_spans;
+    int m_scopes;
+    std::atomic<FreeSlot*> m_freeSlots;
+    std::atomic<size_t> m_liveObjects;
+    std::mutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "pathfinder.h"
+#include "map.h"
+#include "minimap.h"
+
+std::tuple<std::vector<Otc::Direction>, Otc::PathFindResult> PathFinder::findPath(const Position& startPos, const Position& goalPos, int maxComplexity, int flags)
+{
+    // pathfinding using A* search algorithm
+    // as described in http://en.wikipedia.org/wiki/A*_search_algorithm
+
+    std::tuple<std::vector<Otc::Direction>, Otc::PathFindResult> ret;
+    std::vector<Otc::Direction>& dirs = std::get<0>(ret);
+    Otc::PathFindResult& result = std::get<1>(ret);
+
+    result = Otc::PathFindResultNoWay;
+
+    if(startPos == goalPos) {
+        result = Otc::PathFindResultSamePosition;
+        return ret;
+    }
+
+    if(startPos.z != goalPos.z) {
+        result = Otc::PathFindResultImpossible;
+        return ret;
+    }
+
+    // a new stamp invalidates every grid cell of the previous search
+    if(m_grid.empty() || ++m_stamp == 0) {
+        Cell empty = Cell();
+        m_grid.assign(GRID_SIZE * GRID_SIZE, empty);
+        m_stamp = 1;
+    }
+    // a node can't be further from the start than the number of nodes allowed
+    m_radius = std::min<int>(std::max<int>(maxComplexity, 1), GRID_RADIUS);
+    m_origin = startPos;
+    m_nodes.clear();
+    m_heap.clear();
+    m_farNodes.clear();
+
+    // check the goal pos is walkable
+    TileInfo goalInfo = getTileInfo(goalPos);
+    if(goalInfo.flags & TileNotWalkable)
+        return ret;
+
+    int currentNode = getNode(startPos, true);
+    int foundNode = -1;
+    while(currentNode >= 0) {
+        if((int)m_nodes.size() > maxComplexity) {
+            result = Otc::PathFindResultTooFar;
+            break;
+        }
+
+        const Node current = m_nodes[currentNode];
+
+        // path found
+        if(current.pos == goalPos && (foundNode < 0 || current.cost < m_nodes[foundNode].cost))
+            foundNode = currentNode;
+
+        // cost too high
+        if(foundNode >= 0 && current.totalCost >= m_nodes[foundNode].cost)
+            break;
+
+        for(int i=-1;i<=1;++i) {
+            for(int j=-1;j<=1;++j) {
+                if(i == 0 && j == 0)
+                    continue;
+
+                Position neighborPos = current.pos.translated(i, j);
+                TileInfo info = getTileInfo(neighborPos);
+                bool wasSeen = info.flags & TileWasSeen;
+
+                if(!(flags & Otc::PathFindAllowNotSeenTiles) && !wasSeen)
+                    continue;
+                if(wasSeen) {
+                    if(neighborPos != goalPos) {
+                        if(!(flags & Otc::PathFindAllowCreatures) && (info.flags & TileHasCreature))
+                            continue;
+                        if(!(flags & Otc::PathFindAllowNonPathable) && (info.flags & TileNotPathable))
+                            continue;
+                    }
+                    if(!(flags & Otc::PathFindAllowNonWalkable) && (info.flags & TileNotWalkable))
+                        continue;
+                }
+
+                Otc::Direction walkDir = current.pos.getDirectionFromPosition(neighborPos);
+                float walkFactor = walkDir >= Otc::NorthEast ? 3.0f : 1.0f;
+                float cost = current.cost + (info.speed * walkFactor) / 100.0f;
+
+                int neighborNode = getNode(neighborPos, false);
+                if(neighborNode < 0)
+                    neighborNode = getNode(neighborPos, true);
+                else if(m_nodes[neighborNode].cost <= cost)
+                    continue;
+
+                Node& neighbor = m_nodes[neighborNode];
+                neighbor.prev = currentNode;
+                neighbor.cost = cost;
+                neighbor.totalCost = cost + neighborPos.distance(goalPos);
+                neighbor.dir = walkDir;
+                if(neighbor.heapIndex < 0)
+                    pushHeap(neighborNode);
+                else
+                    updateHeap(neighborNode);
+            }
+        }
+
+        currentNode = m_heap.empty() ? -1 : popHeap();
+    }
+
+    if(foundNode >= 0) {
+        for(int node = foundNode; m_nodes[node].prev >= 0; node = m_nodes[node].prev)
+            dirs.push_back(m_nodes[node].dir);
+        std::reverse(dirs.begin(), dirs.end());
+        result = Otc::PathFindResultOk;
+    }
+
+    return ret;
+}
+
+PathFinder::Cell *PathFinder::getCell(const Position& pos)
+{
+    int dx = pos.x - m_origin.x;
+    int dy = pos.y - m_origin.y;
+    if(std::abs(dx) > m_radius || std::abs(dy) > m_radius)
+        return nullptr;
+    return &m_grid[(dy + GRID_RADIUS) * GRID_SIZE + dx + GRID_RADIUS];
+}
+
+int PathFinder::getNode(const Position& pos, bool create)
+{
+    Cell *cell = getCell(pos);
+    if(cell && cell->nodeStamp == m_stamp)
+        return cell->node;
+    if(!cell) {
+        auto it = m_farNodes.find(pos);
+        if(it != m_farNodes.end())
+            return it->second;
+    }
+    if(!create)
+        return -1;
+
+    Node node;
+    node.cost = 0;
+    node.totalCost = 0;
+    node.pos = pos;
+    node.prev = -1;
+    node.heapIndex = -1;
+    node.dir = Otc::InvalidDirection;
+    m_nodes.push_back(node);
+
+    int index = m_nodes.size() - 1;
+    if(cell) {
+        cell->nodeStamp = m_stamp;
+        cell->node = index;
+    } else
+        m_farNodes[pos] = index;
+    return index;
+}
+
+PathFinder::TileInfo PathFinder::getTileInfo(const Position& pos)
+{
+    Cell *cell = getCell(pos);
+    if(cell && cell->infoStamp == m_stamp)
+        return cell->info;
+
+    TileInfo info;
+    info.flags = 0;
+    info.speed = 100;
+    if(g_map.isAwareOfPosition(pos)) {
+        info.flags |= TileWasSeen | TileNotWalkable | TileNotPathable;
+        if(const TilePtr& tile = g_map.getTile(pos)) {
+            if(tile->hasCreature())
+                info.flags |= TileHasCreature;
+            if(tile->isWalkable())
+                info.flags &= ~TileNotWalkable;
+            if(tile->isPathable())
+                info.flags &= ~TileNotPathable;
+            info.speed = tile->getGroundSpeed();
+        }
+    } else {
+        const MinimapTile& mtile = g_minimap.getTile(pos);
+        if(mtile.hasFlag(MinimapTileWasSeen))
+            info.flags |= TileWasSeen;
+        if(mtile.hasFlag(MinimapTileNotWalkable))
+            info.flags |= TileNotWalkable | TileWasSeen;
+        if(mtile.hasFlag(MinimapTileNotPathable))
+            info.flags |= TileNotPathable | TileWasSeen;
+        info.speed = mtile.getSpeed();
+    }
+
+    if(cell) {
+        cell->infoStamp = m_stamp;
+        cell->info = info;
+    }
+    return info;
+}
+
+void PathFinder::pushHeap(int node)
+{
+    m_nodes[node].heapIndex = m_heap.size();
+    m_heap.push_back(node);
+    siftUp(m_heap.size() - 1);
+}
+
+int PathFinder::popHeap()
+{
+    int node = m_heap.front();
+    m_nodes[node].heapIndex = -1;
+    m_heap.front() = m_heap.back();
+    m_heap.pop_back();
+    if(!m_heap.empty()) {
+        m_nodes[m_heap.front()].heapIndex = 0;
+        siftDown(0);
+    }
+    return node;
+}
+
+void PathFinder::updateHeap(int node)
+{
+    // costs only decrease while a node is queued
+    siftUp(m_nodes[node].heapIndex);
+}
+
+void PathFinder::siftUp(int index)
+{
+    int node = m_heap[index];
+    float totalCost = m_nodes[node].totalCost;
+    while(index > 0) {
+        int parent = (index - 1) / 2;
+        if(m_nodes[m_heap[parent]].totalCost <= totalCost)
+            break;
+        m_heap[index] = m_heap[parent];
+        m_nodes[m_heap[index]].heapIndex = index;
+        index = parent;
+    }
+    m_heap[index] = node;
+    m_nodes[node].heapIndex = index;
+}
+
+void PathFinder::siftDown(int index)
+{
+    int node = m_heap[index];
+    float totalCost = m_nodes[node].totalCost;
+    int size = m_heap.size();
+    while(true) {
+        int child = index * 2 + 1;
+        if(child >= size)
+            break;
+        if(child + 1 < size && m_nodes[m_heap[child + 1]].totalCost < m_nodes[m_heap[child]].totalCost)
+            child++;
+        if(m_nodes[m_heap[child]].totalCost >= totalCost)
+            break;
+        m_heap[index] = m_heap[child];
+        m_nodes[m_heap[index]].heapIndex = index;
+        index = child;
+    }
+    m_heap[index] = node;
+    m_nodes[node].heapIndex = index;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef PATHFINDER_H
+#define PATHFINDER_H
+
+#include "declarations.h"
+#include "position.h"
+
+// A* search used by Map::findPath. Buffers are kept between searches: nodes live in
+// a pool, positions near the start are looked up in a grid stamped per search (with
+// a hash map for the rest) and tile walkability is read once per search and position.
+class PathFinder
+{
+public:
+    PathFinder() : m_stamp(0), m_radius(0) { }
+
+    std::tuple<std::vector<Otc::Direction>, Otc::PathFindResult> findPath(const Position& startPos, const Position& goalPos, int maxComplexity, int flags);
+
+private:
+    enum {
+        GRID_RADIUS = 127,
+        GRID_SIZE = GRID_RADIUS * 2 + 1
+    };
+
+    enum TileFlags : uint8 {
+        TileWasSeen = 1,
+        TileHasCreature = 2,
+        TileNotWalkable = 4,
+        TileNotPathable = 8
+    };
+
+    struct Node {
+        float cost;
+        float totalCost;
+        Position pos;
+        int prev;
+        int heapIndex;
+        Otc::Direction dir;
+    };
+
+    struct TileInfo {
+        uint8 flags;
+        uint16 speed;
+    };
+
+    struct Cell {
+        uint32 nodeStamp;
+        uint32 infoStamp;
+        int node;
+        TileInfo info;
+    };
+
+    Cell *getCell(const Position& pos);
+    int getNode(const Position& pos, bool create);
+    TileInfo getTileInfo(const Position& pos);
+
+    void pushHeap(int node);
+    int popHeap();
+    void updateHeap(int node);
+    void siftUp(int index);
+    void siftDown(int index);
+
+    std::vector<Node> m_nodes;
+    std::vector<int> m_heap;
+    std::vector<Cell> m_grid;
+    std::unordered_map<Position, int, PositionHasher> m_farNodes;
+    uint32 m_stamp;
+    int m_radius;
+    Position m_origin;
+};
+
+#endif
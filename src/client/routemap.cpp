@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "routemap.h"
+#include "map.h"
+#include <framework/core/clock.h>
+#include <queue>
+
+namespace {
+
+const float infinity = std::numeric_limits<float>::max();
+
+Otc::Direction getDirection(const Point& from, const Point& to)
+{
+    return Position(from.x, from.y, 0).getDirectionFromPosition(Position(to.x, to.y, 0));
+}
+
+}
+
+Rect RouteMap::Floor::getClusterRect(int cluster) const
+{
+    int x = (cluster % clustersX) * ROUTEMAP_CLUSTER_SIZE;
+    int y = (cluster / clustersX) * ROUTEMAP_CLUSTER_SIZE;
+    return Rect(x, y, std::min<int>(ROUTEMAP_CLUSTER_SIZE, width - x), std::min<int>(ROUTEMAP_CLUSTER_SIZE, height - y));
+}
+
+void RouteMap::clear()
+{
+    for(int z = 0; z <= Otc::MAX_Z; ++z)
+        m_floors[z] = Floor();
+    m_nodes.clear();
+    m_built = false;
+}
+
+void RouteMap::build()
+{
+    ticks_t start = g_clock.millis();
+    clear();
+
+    int minSpeed = 0;
+    for(int z = 0; z <= Otc::MAX_Z; ++z) {
+        buildFloor(z);
+        const Floor& floor = m_floors[z];
+        for(int i = 0; i < floor.width * floor.height; ++i) {
+            if(floor.isWalkable(Point(i % floor.width, i / floor.width)) && (minSpeed == 0 || floor.speed[i] * 10 < minSpeed))
+                minSpeed = floor.speed[i] * 10;
+        }
+    }
+    // keeps the portal graph heuristic admissible
+    m_minStepCost = std::max<int>(minSpeed, 10) / 100.0f;
+    m_built = true;
+
+    g_logger.info(stdext::format("Route map built with %d portals in %d ms", (int)m_nodes.size(), (int)(g_clock.millis() - start)));
+}
+
+void RouteMap::buildFloor(int z)
+{
+    Floor& floor = m_floors[z];
+    TileRange tiles = g_map.getTileRange(z);
+    if(tiles.begin() == tiles.end())
+        return;
+
+    int right = 0, bottom = 0;
+    floor.left = floor.top = 65535;
+    for(const TilePtr& tile : tiles) {
+        const Position& pos = tile->getPosition();
+        floor.left = std::min<int>(floor.left, pos.x);
+        floor.top = std::min<int>(floor.top, pos.y);
+        right = std::max<int>(right, pos.x);
+        bottom = std::max<int>(bottom, pos.y);
+    }
+    floor.width = right - floor.left + 1;
+    floor.height = bottom - floor.top + 1;
+    floor.walkable.assign((floor.width * floor.height + 63) / 64, 0);
+    floor.speed.assign(floor.width * floor.height, 0);
+
+    for(const TilePtr& tile : tiles) {
+        const Position& pos = tile->getPosition();
+        Point p(pos.x - floor.left, pos.y - floor.top);
+        int i = floor.index(p);
+        if(tile->isWalkable() && tile->isPathable())
+            floor.walkable[i / 64] |= (uint64)1 << (i % 64);
+        floor.speed[i] = stdext::clamp<int>(tile->getGroundSpeed() / 10, 1, 255);
+    }
+
+    floor.clustersX = (floor.width + ROUTEMAP_CLUSTER_SIZE - 1) / ROUTEMAP_CLUSTER_SIZE;
+    floor.clustersY = (floor.height + ROUTEMAP_CLUSTER_SIZE - 1) / ROUTEMAP_CLUSTER_SIZE;
+    floor.clusterNodes.resize(floor.clustersX * floor.clustersY);
+
+    // entrances are runs of walkable tiles on both sides of a cluster border
+    for(int cluster = 0; cluster < (int)floor.clusterNodes.size(); ++cluster) {
+        Rect rect = floor.getClusterRect(cluster);
+        for(int vertical = 0; vertical < 2; ++vertical) {
+            int length = vertical ? rect.height() : rect.width();
+            Point border = vertical ? Point(rect.right(), rect.top()) : Point(rect.left(), rect.bottom());
+            Point step = vertical ? Point(0, 1) : Point(1, 0);
+            Point across = vertical ? Point(1, 0) : Point(0, 1);
+            if(!floor.contains(border + across))
+                continue;
+
+            int runStart = -1;
+            for(int i = 0; i <= length; ++i) {
+                Point p = border + step * i;
+                bool open = i < length && floor.isWalkable(p) && floor.isWalkable(p + across);
+                if(open && runStart < 0)
+                    runStart = i;
+                if(open || runStart < 0)
+                    continue;
+
+                int runEnd = i - 1;
+                if(runEnd - runStart + 1 > ROUTEMAP_MAX_ENTRANCE_WIDTH) {
+                    addEntrance(floor, border + step * runStart, border + step * runStart + across);
+                    addEntrance(floor, border + step * runEnd, border + step * runEnd + across);
+                } else {
+                    int middle = (runStart + runEnd) / 2;
+                    addEntrance(floor, border + step * middle, border + step * middle + across);
+                }
+                runStart = -1;
+            }
+        }
+    }
+
+    // distances between the portals of every cluster
+    std::vector<float> costs;
+    for(int cluster = 0; cluster < (int)floor.clusterNodes.size(); ++cluster) {
+        const std::vector<int>& nodes = floor.clusterNodes[cluster];
+        if(nodes.size() < 2)
+            continue;
+
+        Rect rect = floor.getClusterRect(cluster);
+        for(int from : nodes) {
+            searchArea(floor, rect, m_nodes[from].pos, false, costs);
+            for(int to : nodes) {
+                const Point& pos = m_nodes[to].pos;
+                float cost = costs[(pos.y - rect.top()) * rect.width() + pos.x - rect.left()];
+                if(to != from && cost < infinity)
+                    m_nodes[from].edges.push_back(Edge{to, cost});
+            }
+        }
+    }
+}
+
+int RouteMap::getOrCreateNode(Floor& floor, const Point& pos)
+{
+    auto it = floor.tileNodes.find(floor.index(pos));
+    if(it != floor.tileNodes.end())
+        return it->second;
+
+    Node node;
+    node.pos = pos;
+    node.cluster = floor.getCluster(pos);
+    m_nodes.push_back(node);
+
+    int id = m_nodes.size() - 1;
+    floor.tileNodes[floor.index(pos)] = id;
+    floor.clusterNodes[node.cluster].push_back(id);
+    return id;
+}
+
+void RouteMap::addEntrance(Floor& floor, const Point& from, const Point& to)
+{
+    int a = getOrCreateNode(floor, from);
+    int b = getOrCreateNode(floor, to);
+    m_nodes[a].edges.push_back(Edge{b, getStepCost(floor, from, to)});
+    m_nodes[b].edges.push_back(Edge{a, getStepCost(floor, to, from)});
+}
+
+float RouteMap::getStepCost(const Floor& floor, const Point& from, const Point& to)
+{
+    // same costs as Map::findPath, diagonal steps count three times
+    float walkFactor = (from.x != to.x && from.y != to.y) ? 3.0f : 1.0f;
+    return floor.getSpeed(to) * walkFactor / 100.0f;
+}
+
+// dijkstra over the walkable tiles of an area, costs from source or, reversed, to source
+void RouteMap::searchArea(const Floor& floor, const Rect& area, const Point& source, bool reverse, std::vector<float>& costs)
+{
+    typedef std::pair<float, int> QueueEntry;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> queue;
+
+    costs.assign(area.width() * area.height(), infinity);
+    int sourceIndex = (source.y - area.top()) * area.width() + source.x - area.left();
+    costs[sourceIndex] = 0;
+    queue.push(QueueEntry(0, sourceIndex));
+
+    while(!queue.empty()) {
+        QueueEntry entry = queue.top();
+        queue.pop();
+        if(entry.first > costs[entry.second])
+            continue;
+
+        Point current(area.left() + entry.second % area.width(), area.top() + entry.second / area.width());
+        for(int i=-1;i<=1;++i) {
+            for(int j=-1;j<=1;++j) {
+                Point neighbor = current + Point(i, j);
+                if((i == 0 && j == 0) || !area.contains(neighbor) || !floor.isWalkable(neighbor))
+                    continue;
+
+                float cost = entry.first + (reverse ? getStepCost(floor, neighbor, current) : getStepCost(floor, current, neighbor));
+                int index = (neighbor.y - area.top()) * area.width() + neighbor.x - area.left();
+                if(cost < costs[index]) {
+                    costs[index] = cost;
+                    queue.push(QueueEntry(cost, index));
+                }
+            }
+        }
+    }
+}
+
+// a* over the walkable tiles of an area
+bool RouteMap::searchRaster(const Floor& floor, const Rect& area, const Point& start, const Point& goal, std::vector<Otc::Direction>& dirs)
+{
+    typedef std::pair<float, int> QueueEntry;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> queue;
+
+    std::vector<float> costs(area.width() * area.height(), infinity);
+    std::vector<int> previous(area.width() * area.height(), -1);
+    auto toIndex = [&area](const Point& p) { return (p.y - area.top()) * area.width() + p.x - area.left(); };
+    auto toPoint = [&area](int index) { return Point(area.left() + index % area.width(), area.top() + index / area.width()); };
+    auto heuristic = [&](const Point& p) { return std::sqrt((float)((p.x - goal.x) * (p.x - goal.x) + (p.y - goal.y) * (p.y - goal.y))) * m_minStepCost; };
+
+    int startIndex = toIndex(start);
+    int goalIndex = toIndex(goal);
+    costs[startIndex] = 0;
+    queue.push(QueueEntry(heuristic(start), startIndex));
+
+    while(!queue.empty()) {
+        QueueEntry entry = queue.top();
+        queue.pop();
+        if(entry.second == goalIndex)
+            break;
+
+        Point current = toPoint(entry.second);
+        if(entry.first > costs[entry.second] + heuristic(current))
+            continue;
+
+        for(int i=-1;i<=1;++i) {
+            for(int j=-1;j<=1;++j) {
+                Point neighbor = current + Point(i, j);
+                if((i == 0 && j == 0) || !area.contains(neighbor) || !floor.isWalkable(neighbor))
+                    continue;
+
+                float cost = costs[entry.second] + getStepCost(floor, current, neighbor);
+                int index = toIndex(neighbor);
+                if(cost < costs[index]) {
+                    costs[index] = cost;
+                    previous[index] = entry.second;
+                    queue.push(QueueEntry(cost + heuristic(neighbor), index));
+                }
+            }
+        }
+    }
+
+    if(costs[goalIndex] == infinity)
+        return false;
+
+    std::vector<Otc::Direction> steps;
+    for(int index = goalIndex; index != startIndex; index = previous[index])
+        steps.push_back(getDirection(toPoint(previous[index]), toPoint(index)));
+    dirs.insert(dirs.end(), steps.rbegin(), steps.rend());
+    return true;
+}
+
+std::tuple<std::vector<Otc::Direction>, Otc::PathFindResult> RouteMap::findPath(const Position& startPos, const Position& goalPos, int maxComplexity)
+{
+    std::tuple<std::vector<Otc::Direction>, Otc::PathFindResult> ret;
+    std::vector<Otc::Direction>& dirs = std::get<0>(ret);
+    Otc::PathFindResult& result = std::get<1>(ret);
+
+    result = Otc::PathFindResultNoWay;
+
+    if(startPos == goalPos) {
+        result = Otc::PathFindResultSamePosition;
+        return ret;
+    }
+
+    if(startPos.z != goalPos.z) {
+        result = Otc::PathFindResultImpossible;
+        return ret;
+    }
+
+    if(!m_built)
+        build();
+
+    const Floor& floor = m_floors[startPos.z];
+    Point start(startPos.x - floor.left, startPos.y - floor.top);
+    Point goal(goalPos.x - floor.left, goalPos.y - floor.top);
+    if(!floor.contains(start) || !floor.isWalkable(goal))
+        return ret;
+
+    // close routes are searched directly on the raster
+    if(std::max<int>(std::abs(goal.x - start.x), std::abs(goal.y - start.y)) <= ROUTEMAP_CLUSTER_SIZE) {
+        Rect area = Rect(Point(std::min<int>(start.x, goal.x), std::min<int>(start.y, goal.y)),
+                         Point(std::max<int>(start.x, goal.x), std::max<int>(start.y, goal.y)));
+        area = area.expanded(ROUTEMAP_CLUSTER_SIZE).intersection(Rect(0, 0, floor.width, floor.height));
+        if(searchRaster(floor, area, start, goal, dirs)) {
+            result = Otc::PathFindResultOk;
+            return ret;
+        }
+    }
+
+    int startCluster = floor.getCluster(start);
+    int goalCluster = floor.getCluster(goal);
+    Rect startRect = floor.getClusterRect(startCluster);
+    Rect goalRect = floor.getClusterRect(goalCluster);
+    std::vector<float> startCosts, goalCosts;
+    searchArea(floor, startRect, start, false, startCosts);
+    searchArea(floor, goalRect, goal, true, goalCosts);
+    auto costIn = [](const std::vector<float>& costs, const Rect& rect, const Point& p) {
+        return costs[(p.y - rect.top()) * rect.width() + p.x - rect.left()];
+    };
+    auto heuristic = [&](const Point& p) { return std::sqrt((float)((p.x - goal.x) * (p.x - goal.x) + (p.y - goal.y) * (p.y - goal.y))) * m_minStepCost; };
+
+    // a* over the portal graph, starting from every portal reachable inside the start cluster
+    typedef std::pair<float, int> QueueEntry;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> queue;
+    std::unordered_map<int, float> costs;
+    std::unordered_map<int, int> previous;
+    for(int node : floor.clusterNodes[startCluster]) {
+        float cost = costIn(startCosts, startRect, m_nodes[node].pos);
+        if(cost < infinity) {
+            costs[node] = cost;
+            previous[node] = -1;
+            queue.push(QueueEntry(cost + heuristic(m_nodes[node].pos), node));
+        }
+    }
+
+    float bestCost = infinity;
+    int bestNode = -1;
+    bool direct = false;
+    if(startCluster == goalCluster && costIn(startCosts, startRect, goal) < infinity) {
+        bestCost = costIn(startCosts, startRect, goal);
+        direct = true;
+    }
+
+    int expanded = 0;
+    while(!queue.empty()) {
+        QueueEntry entry = queue.top();
+        queue.pop();
+        if(entry.first >= bestCost)
+            break;
+
+        const Node& node = m_nodes[entry.second];
+        float cost = costs[entry.second];
+        if(entry.first > cost + heuristic(node.pos))
+            continue;
+
+        if(++expanded > maxComplexity) {
+            result = Otc::PathFindResultTooFar;
+            return ret;
+        }
+
+        if(node.cluster == goalCluster) {
+            float total = cost + costIn(goalCosts, goalRect, node.pos);
+            if(total < bestCost) {
+                bestCost = total;
+                bestNode = entry.second;
+                direct = false;
+            }
+        }
+
+        for(const Edge& edge : node.edges) {
+            float edgeCost = cost + edge.cost;
+            auto it = costs.find(edge.node);
+            if(it != costs.end() && it->second <= edgeCost)
+                continue;
+            costs[edge.node] = edgeCost;
+            previous[edge.node] = entry.second;
+            queue.push(QueueEntry(edgeCost + heuristic(m_nodes[edge.node].pos), edge.node));
+        }
+    }
+
+    if(direct) {
+        if(searchRaster(floor, startRect, start, goal, dirs))
+            result = Otc::PathFindResultOk;
+        return ret;
+    }
+    if(bestNode < 0)
+        return ret;
+
+    // refine every hop of the portal route on the raster
+    std::vector<Point> waypoints;
+    waypoints.push_back(goal);
+    for(int node = bestNode; node >= 0; node = previous[node])
+        waypoints.push_back(m_nodes[node].pos);
+    waypoints.push_back(start);
+    std::reverse(waypoints.begin(), waypoints.end());
+
+    for(size_t i = 0; i + 1 < waypoints.size(); ++i) {
+        const Point& from = waypoints[i];
+        const Point& to = waypoints[i + 1];
+        if(from == to)
+            continue;
+        int cluster = floor.getCluster(from);
+        if(cluster != floor.getCluster(to))
+            dirs.push_back(getDirection(from, to));
+        else if(!searchRaster(floor, floor.getClusterRect(cluster), from, to, dirs)) {
+            dirs.clear();
+            return ret;
+        }
+    }
+
+    result = Otc::PathFindResultOk;
+    return ret;
+}
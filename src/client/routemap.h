@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef ROUTEMAP_H
+#define ROUTEMAP_H
+
+#include "declarations.h"
+#include "position.h"
+
+enum {
+    ROUTEMAP_CLUSTER_SIZE = 16,
+    ROUTEMAP_MAX_ENTRANCE_WIDTH = 6
+};
+
+// Condensed copy of the loaded map for long distance routing (Otc::PathFindHierarchical).
+// Every floor is reduced to a bit packed walkability raster with ground speeds stored
+// like MinimapTile does, then split in clusters connected by portals whose distances
+// inside a cluster are precomputed. Routes are searched on the portal graph and only
+// refined on the raster inside the clusters they cross. The raster reflects the map at
+// the time it was built, creatures are ignored.
+class RouteMap
+{
+public:
+    RouteMap() : m_built(false), m_minStepCost(1.0f) { }
+
+    void build();
+    void clear();
+    bool isBuilt() { return m_built; }
+
+    // maxComplexity limits the expanded portals instead of tiles
+    std::tuple<std::vector<Otc::Direction>, Otc::PathFindResult> findPath(const Position& startPos, const Position& goalPos, int maxComplexity);
+
+private:
+    struct Floor {
+        Floor() : left(0), top(0), width(0), height(0), clustersX(0), clustersY(0) { }
+
+        bool contains(const Point& p) const { return p.x >= 0 && p.y >= 0 && p.x < width && p.y < height; }
+        bool isWalkable(const Point& p) const { return contains(p) && (walkable[index(p) / 64] >> (index(p) % 64)) & 1; }
+        int getSpeed(const Point& p) const { return speed[index(p)] * 10; }
+        int getCluster(const Point& p) const { return (p.y / ROUTEMAP_CLUSTER_SIZE) * clustersX + p.x / ROUTEMAP_CLUSTER_SIZE; }
+        Rect getClusterRect(int cluster) const;
+        int index(const Point& p) const { return p.y * width + p.x; }
+
+        int left, top, width, height;
+        int clustersX, clustersY;
+        std::vector<uint64> walkable;
+        std::vector<uint8> speed;
+        std::vector<std::vector<int>> clusterNodes;
+        std::unordered_map<int, int> tileNodes;
+    };
+
+    struct Edge {
+        int node;
+        float cost;
+    };
+
+    struct Node {
+        Point pos;
+        int cluster;
+        std::vector<Edge> edges;
+    };
+
+    void buildFloor(int z);
+    int getOrCreateNode(Floor& floor, const Point& pos);
+    void addEntrance(Floor& floor, const Point& from, const Point& to);
+    float getStepCost(const Floor& floor, const Point& from, const Point& to);
+    void searchArea(const Floor& floor, const Rect& area, const Point& source, bool reverse, std::vector<float>& costs);
+    bool searchRaster(const Floor& floor, const Rect& area, const Point& start, const Point& goal, std::vector<Otc::Direction>& dirs);
+
+    Floor m_floors[Otc::MAX_Z+1];
+    std::vector<Node> m_nodes;
+    bool m_built;
+    float m_minStepCost;
+};
+
+#endif
@@ -22,6 +22,7 @@
 
 #include "spritemanager.h"
 #include "game.h"
+#include "workerplacement.h"
 #include <framework/core/resourcemanager.h>
 #include <framework/core/filestream.h>
 #include <framework/graphics/image.h>
@@ -37,6 +38,7 @@ SpriteManager::SpriteManager()
 void SpriteManager::terminate()
 {
     unload();
+    freeReplicas();
 }
 
 bool SpriteManager::loadSpr(std::string file)
@@ -135,6 +137,14 @@ public:
             ptr = g_sprites.getSpriteImage(i++);
         }
     }
+    // copies the pixels, so they end up in memory of the numa node running the calling thread
+    explicit SpriteCache(const SpriteCache& other)
+    {
+        images.reserve(other.images.size());
+        for(const ImagePtr& image : other.images)
+            images.push_back(image ? ImagePtr(new Image(image->getSize(), image->getBpp(), image->getPixelData())) : nullptr);
+    }
+
     ImagePtr getSpriteImage(int id) const
     {
         assert(id <= static_cast<int>(images.size()));
@@ -148,10 +158,34 @@ private:
     std::vector<ImagePtr> images;
 };
 
+static std::atomic<SpriteCache*> replicas[WORKERPLACEMENT_MAX_NODES];
+static std::mutex replicasMutex;
+
 ImagePtr SpriteManager::getSpriteImageCached(int id)
 {
     static const SpriteCache cache;
-    return cache.getSpriteImage(id);
+    if(!m_numaReplication)
+        return cache.getSpriteImage(id);
+
+    // each numa node reads its own copy, made by the first thread of the node that needs it
+    int node = g_workerPlacement.getCurrentNode();
+    SpriteCache *replica = replicas[node].load(std::memory_order_acquire);
+    if(!replica) {
+        std::lock_guard<std::mutex> lock(replicasMutex);
+        replica = replicas[node];
+        if(!replica) {
+            replica = new SpriteCache(cache);
+            replicas[node].store(replica, std::memory_order_release);
+        }
+    }
+    return replica->getSpriteImage(id);
+}
+
+void SpriteManager::freeReplicas()
+{
+    std::lock_guard<std::mutex> lock(replicasMutex);
+    for(std::atomic<SpriteCache*>& replica : replicas)
+        delete replica.exchange(nullptr);
 }
 
 ImagePtr SpriteManager::getSpriteImage(int id)
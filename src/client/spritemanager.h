@@ -49,10 +49,16 @@ public:
 
     ImagePtr getSpriteImage(int id);
     ImagePtr getSpriteImageCached(int id);
+    // keeps a copy of the decoded sprites on every numa node used by render workers
+    void setNumaReplication(bool enable) { m_numaReplication = enable; }
+    bool isNumaReplication() { return m_numaReplication; }
     bool isLoaded() { return m_loaded; }
 
 private:
+    void freeReplicas();
+
     stdext::boolean<false> m_loaded;
+    stdext::boolean<false> m_numaReplication;
     uint32 m_signature;
     int m_spritesCount;
     int m_spritesOffset;
@@ -412,7 +412,33 @@ void ThingType::draw(const Point& dest, float scaleFactor, int layer, int xPatte
     }
 }
 
-void ThingType::drawToImage(Point dest, int xPattern, int yPattern, int zPattern, ImagePtr image)
+int ThingType::getAnimationPhaseDuration(int phase)
+{
+    if(m_animator)
+        return std::max<int>(m_animator->getAverageDuration(phase), 1);
+    return Otc::ITEM_TICKS_PER_FRAME;
+}
+
+// phase shown after ticks milliseconds of a synchronous animation loop started at phase 0
+int ThingType::getAnimationPhaseAt(int ticks)
+{
+    if(m_animationPhases <= 1)
+        return 0;
+
+    int cycle = 0;
+    for(int phase = 0; phase < m_animationPhases; ++phase)
+        cycle += getAnimationPhaseDuration(phase);
+
+    ticks %= cycle;
+    for(int phase = 0; phase < m_animationPhases; ++phase) {
+        ticks -= getAnimationPhaseDuration(phase);
+        if(ticks < 0)
+            return phase;
+    }
+    return 0;
+}
+
+void ThingType::drawToImage(Point dest, int xPattern, int yPattern, int zPattern, ImagePtr image, int animationPhase)
 {
     if(m_null)
         return;
@@ -428,7 +454,7 @@ void ThingType::drawToImage(Point dest, int xPattern, int yPattern, int zPattern
                 int dy = y + 32 * (m_size.height() - h - 1) - 32 * (m_size.height() - 1);
                 if(dx >= 0 && dy >= 0)// todo wieksze
                 {
-                    image->blit(Point(dx, dy), g_sprites.getSpriteImageCached(m_spritesIndex[getSpriteIndex(w, h, l, xPattern, yPattern, zPattern, 0)]));
+                    image->blit(Point(dx, dy), g_sprites.getSpriteImageCached(m_spritesIndex[getSpriteIndex(w, h, l, xPattern, yPattern, zPattern, animationPhase)]));
                 }
             }
         }
@@ -457,7 +483,7 @@ const TexturePtr& ThingType::getTexture(int animationPhase)
         ImagePtr fullImage;
 
         if(useCustomImage)
-            fullImage = Image::load(m_customImage);
+            fullImage = m_customImageData ? m_customImageData : Image::load(m_customImage);
         else
             fullImage = ImagePtr(new Image(textureSize * Otc::TILE_PIXELS));
 
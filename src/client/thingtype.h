@@ -129,7 +129,9 @@ public:
     void exportImage(std::string fileName);
 
     void draw(const Point& dest, float scaleFactor, int layer, int xPattern, int yPattern, int zPattern, int animationPhase, LightView *lightView = nullptr);
-    void drawToImage(Point dest, int xPattern, int yPattern, int zPattern, ImagePtr image);
+    void drawToImage(Point dest, int xPattern, int yPattern, int zPattern, ImagePtr image, int animationPhase = 0);
+    int getAnimationPhaseDuration(int phase);
+    int getAnimationPhaseAt(int ticks);
 
     uint16 getId() { return m_id; }
     ThingCategory getCategory() { return m_category; }
@@ -199,6 +201,9 @@ public:
     // additional
     float getOpacity() { return m_opacity; }
     bool isNotPreWalkable() { return m_attribs.has(ThingAttrNotPreWalkable); }
+    const std::string& getCustomImage() { return m_customImage; }
+    // decoded custom image, used instead of loading the file when the texture is built
+    void setCustomImageData(const ImagePtr& image) { m_customImageData = image; }
 
 private:
     const TexturePtr& getTexture(int animationPhase);
@@ -222,6 +227,7 @@ private:
     int m_elevation;
     float m_opacity;
     std::string m_customImage;
+    ImagePtr m_customImageData;
 
     std::vector<int> m_spritesIndex;
     std::vector<TexturePtr> m_textures;
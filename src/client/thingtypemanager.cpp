@@ -28,12 +28,16 @@
 #include "creature.h"
 #include "creatures.h"
 #include "game.h"
+#include "mapjob.h"
 
 #include <framework/core/resourcemanager.h>
 #include <framework/core/filestream.h>
 #include <framework/core/binarytree.h>
 #include <framework/xml/tinyxml.h>
 #include <framework/otml/otml.h>
+#include <framework/graphics/image.h>
+
+#include <zlib.h>
 
 ThingTypeManager g_things;
 
@@ -48,6 +52,7 @@ void ThingTypeManager::init()
     m_datLoaded = false;
     m_xmlLoaded = false;
     m_otbLoaded = false;
+    m_otbCache = false;
     for(int i = 0; i < ThingLastCategory; ++i)
         m_thingTypes[i].resize(1, m_nullThingType);
     m_itemTypes.resize(1, m_nullItemType);
@@ -106,6 +111,8 @@ bool ThingTypeManager::loadDat(std::string file)
         file = g_resources.guessFilePath(file, "dat");
 
         FileStreamPtr fin = g_resources.openFile(file);
+        // every type is read byte by byte, so the whole file is read at once
+        fin->cache();
 
         m_datSignature = fin->getU32();
         m_contentRevision = static_cast<uint16_t>(m_datSignature);
@@ -142,6 +149,8 @@ bool ThingTypeManager::loadOtml(std::string file)
         file = g_resources.guessFilePath(file, "otml");
 
         OTMLDocumentPtr doc = OTMLDocument::parse(file);
+        std::vector<ThingTypePtr> customTypes;
+        std::vector<std::string> customImages;
         for(const OTMLNodePtr& node : doc->children()) {
             ThingCategory category;
             if(node->tag() == "creatures")
@@ -162,8 +171,17 @@ bool ThingTypeManager::loadOtml(std::string file)
                 if(!type)
                     throw OTMLException(node2, "thing not found");
                 type->unserializeOtml(node2);
+                if(!type->getCustomImage().empty()) {
+                    customTypes.push_back(type);
+                    customImages.push_back(type->getCustomImage());
+                }
             }
         }
+
+        // custom images are decoded together on the async dispatcher threads
+        std::vector<ImagePtr> images = Image::loadMany(customImages);
+        for(size_t i = 0; i < customTypes.size(); ++i)
+            customTypes[i]->setCustomImageData(images[i]);
         return true;
     } catch(std::exception& e) {
         g_logger.error(stdext::format("Failed to read dat otml '%s': %s'", file, e.what()));
@@ -173,41 +191,43 @@ bool ThingTypeManager::loadOtml(std::string file)
 
 void ThingTypeManager::loadOtb(const std::string& file)
 {
-    try {
-        FileStreamPtr fin = g_resources.openFile(file);
-
-        uint signature = fin->getU32();
-        if(signature != 0)
-            stdext::throw_exception("invalid otb file");
-
-        BinaryTreePtr root = fin->getBinaryTree();
-        root->skip(1); // otb first byte is always 0
-
-        signature = root->getU32();
-        if(signature != 0)
-            stdext::throw_exception("invalid otb file");
+    if(loadOtbTypes(file))
+        g_lua.callGlobalField("g_things", "onLoadOtb", file);
+}
 
-        uint8 rootAttr = root->getU8();
-        if(rootAttr == 0x01) { // OTB_ROOT_ATTR_VERSION
-            uint16 size = root->getU16();
-            if(size != 4 + 4 + 4 + 128)
-                stdext::throw_exception("invalid otb root attr version size");
+MapJobPtr ThingTypeManager::loadOtbAsync(const std::string& file)
+{
+    return MapJob::schedule("loadOtb", [this, file](const MapJobStatePtr& state) { return loadOtbTypes(file, state); }, [file](bool loaded) {
+        if(loaded)
+            g_lua.callGlobalField("g_things", "onLoadOtb", file);
+    });
+}
 
-            m_otbMajorVersion = root->getU32();
-            m_otbMinorVersion = root->getU32();
-            root->skip(4); // buildNumber
-            root->skip(128); // description
+// with a job state, progress counts decoded item nodes and decoding stops when the job is cancelled
+bool ThingTypeManager::loadOtbTypes(const std::string& file, const MapJobStatePtr& state)
+{
+    try {
+        stdext::timer loadTimer;
+        std::string contents = g_resources.readFileContents(file);
+        uint32 checksum = adler32(adler32(0, nullptr, 0), (const Bytef*)contents.data(), contents.size());
+
+        ItemTypeList itemTypes;
+        if(!m_otbCache || !loadOtbCache(file + ".cache", contents.size(), checksum, itemTypes)) {
+            itemTypes = readOtb(file, contents, state);
+            if(m_otbCache)
+                saveOtbCache(file + ".cache", contents.size(), checksum, itemTypes);
         }
 
+        m_itemTypes.clear();
+        m_itemTypes.resize(itemTypes.size() + 1, m_nullItemType);
         m_reverseItemTypes.clear();
-        m_itemTypes.resize(root->getChildren().size() + 1, m_nullItemType);
-        m_reverseItemTypes.resize(root->getChildren().size() + 1, m_nullItemType);
-
-        for(const BinaryTreePtr& node : root->getChildren()) {
-            ItemTypePtr itemType(new ItemType);
-            itemType->unserialize(node);
+        m_reverseItemTypes.resize(itemTypes.size() + 1, m_nullItemType);
+        for(const ItemTypePtr& itemType : itemTypes) {
             addItemType(itemType);
 
+            // gaps between server ids are filled with null types
+            if(itemType->isNull())
+                continue;
             uint16 clientId = itemType->getClientId();
             if(unlikely(clientId >= m_reverseItemTypes.size()))
                 m_reverseItemTypes.resize(clientId + 1);
@@ -215,9 +235,156 @@ void ThingTypeManager::loadOtb(const std::string& file)
         }
 
         m_otbLoaded = true;
-        g_lua.callGlobalField("g_things", "onLoadOtb", file);
+        g_logger.debug(stdext::format("Loaded %d item types from '%s' in %d ms", (int)itemTypes.size(), file, (int)loadTimer.elapsed_millis()));
+        return true;
     } catch(std::exception& e) {
         g_logger.error(stdext::format("Failed to load '%s' (OTB file): %s", file, e.what()));
+        return false;
+    }
+}
+
+// item types of the otb in the order they are added, including null types filling gaps of server ids
+ItemTypeList ThingTypeManager::readOtb(const std::string& file, const std::string& contents, const MapJobStatePtr& state)
+{
+    FileStreamPtr fin(new FileStream(file, contents));
+
+    uint signature = fin->getU32();
+    if(signature != 0)
+        stdext::throw_exception("invalid otb file");
+
+    BinaryTreePtr root = fin->getBinaryTree();
+    root->skip(1); // otb first byte is always 0
+
+    signature = root->getU32();
+    if(signature != 0)
+        stdext::throw_exception("invalid otb file");
+
+    uint8 rootAttr = root->getU8();
+    if(rootAttr == 0x01) { // OTB_ROOT_ATTR_VERSION
+        uint16 size = root->getU16();
+        if(size != 4 + 4 + 4 + 128)
+            stdext::throw_exception("invalid otb root attr version size");
+
+        m_otbMajorVersion = root->getU32();
+        m_otbMinorVersion = root->getU32();
+        root->skip(4); // buildNumber
+        root->skip(128); // description
+    }
+
+    // first pass finds where every item node starts, then nodes are decoded in parallel,
+    // every thread reading its own copy of the file
+    BinaryTreeVec nodes = root->getChildren();
+    ItemTypeList decoded(nodes.size());
+    if(state)
+        state->total = nodes.size();
+    int threads = std::max<int>(1, std::min<int>(std::thread::hardware_concurrency(), nodes.size() / 1024));
+    std::vector<std::thread> workers;
+    std::vector<std::string> errors(threads);
+    for(int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            try {
+                FileStreamPtr stream = t == 0 ? fin : FileStreamPtr(new FileStream(file, contents));
+                for(size_t i = nodes.size() * t / threads; i < nodes.size() * (t + 1) / threads; ++i) {
+                    if(state) {
+                        if(!state->waitWhilePaused())
+                            stdext::throw_exception("cancelled");
+                        state->advance();
+                    }
+                    stream->seek(nodes[i]->getStartPos());
+                    BinaryTreePtr node(new BinaryTree(stream));
+                    ItemTypePtr itemType(new ItemType);
+                    itemType->unserialize(node);
+                    decoded[i] = itemType;
+                }
+            } catch(std::exception& e) {
+                errors[t] = e.what();
+            }
+        });
+    }
+    for(std::thread& worker : workers)
+        worker.join();
+    for(const std::string& error : errors) {
+        if(!error.empty())
+            stdext::throw_exception(error);
+    }
+
+    ItemTypeList itemTypes;
+    itemTypes.reserve(decoded.size());
+    uint16 offset = g_game.getClientVersion() < 960 ? 20000 : 30000;
+    uint16 lastId = 99;
+    for(const ItemTypePtr& itemType : decoded) {
+        uint16 serverId = itemType->getServerId();
+        if(serverId != 0) {
+            if(serverId > offset && serverId < offset + 100) {
+                serverId -= offset;
+            } else if(lastId > 99 && lastId != serverId - 1) {
+                while(lastId != serverId - 1) {
+                    ItemTypePtr tmp(new ItemType);
+                    tmp->setServerId(lastId++);
+                    itemTypes.push_back(tmp);
+                }
+            }
+            itemType->setServerId(serverId);
+            lastId = serverId;
+        }
+        itemTypes.push_back(itemType);
+    }
+    return itemTypes;
+}
+
+bool ThingTypeManager::loadOtbCache(const std::string& cacheFile, uint32 otbSize, uint32 otbChecksum, ItemTypeList& itemTypes)
+{
+    try {
+        if(!g_resources.fileExists(cacheFile))
+            return false;
+
+        FileStreamPtr fin = g_resources.openFile(cacheFile);
+        fin->cache();
+        if(fin->getU32() != OTB_CACHE_SIGNATURE || fin->getU16() != OTB_CACHE_VERSION)
+            return false;
+        // server ids are remapped depending on the client version
+        if(fin->getU32() != otbSize || fin->getU32() != otbChecksum || fin->getU16() != g_game.getClientVersion())
+            return false;
+
+        m_otbMajorVersion = fin->getU32();
+        m_otbMinorVersion = fin->getU32();
+        itemTypes.resize(fin->getU32());
+        for(ItemTypePtr& itemType : itemTypes) {
+            itemType = ItemTypePtr(new ItemType);
+            itemType->unserializeCache(fin);
+        }
+        fin->close();
+        return true;
+    } catch(stdext::exception& e) {
+        g_logger.warning(stdext::format("Ignoring otb cache '%s': %s", cacheFile, e.what()));
+        itemTypes.clear();
+        return false;
+    }
+}
+
+void ThingTypeManager::saveOtbCache(const std::string& cacheFile, uint32 otbSize, uint32 otbChecksum, const ItemTypeList& itemTypes)
+{
+    try {
+        FileStreamPtr fout = g_resources.createFile(cacheFile);
+        if(!fout)
+            stdext::throw_exception("unable to create file");
+        fout->cache();
+
+        fout->addU32(OTB_CACHE_SIGNATURE);
+        fout->addU16(OTB_CACHE_VERSION);
+        fout->addU32(otbSize);
+        fout->addU32(otbChecksum);
+        fout->addU16(g_game.getClientVersion());
+        fout->addU32(m_otbMajorVersion);
+        fout->addU32(m_otbMinorVersion);
+        fout->addU32(itemTypes.size());
+        for(const ItemTypePtr& itemType : itemTypes)
+            itemType->serializeCache(fout);
+
+        fout->flush();
+        fout->close();
+    } catch(stdext::exception& e) {
+        g_logger.warning(stdext::format("Failed to save otb cache '%s': %s", cacheFile, e.what()));
     }
 }
 
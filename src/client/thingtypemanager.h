@@ -29,6 +29,11 @@
 #include "thingtype.h"
 #include "itemtype.h"
 
+enum {
+    OTB_CACHE_SIGNATURE = 0x4342544F,
+    OTB_CACHE_VERSION = 1
+};
+
 class ThingTypeManager
 {
 public:
@@ -38,6 +43,11 @@ public:
     bool loadDat(std::string file);
     bool loadOtml(std::string file);
     void loadOtb(const std::string& file);
+    // loads on an async dispatcher thread, onLoadOtb is called on completion
+    MapJobPtr loadOtbAsync(const std::string& file);
+    // parsed item types are kept in <file>.cache and reused while the otb does not change
+    void setOtbCacheEnabled(bool enable) { m_otbCache = enable; }
+    bool isOtbCacheEnabled() { return m_otbCache; }
     void loadXml(const std::string& file);
     void parseItemType(uint16 id, TiXmlElement *elem);
 
@@ -76,6 +86,11 @@ public:
     bool isValidOtbId(uint16 id) { return id >= 1 && id < m_itemTypes.size(); }
 
 private:
+    ItemTypeList readOtb(const std::string& file, const std::string& contents, const MapJobStatePtr& state);
+    bool loadOtbTypes(const std::string& file, const MapJobStatePtr& state = nullptr);
+    bool loadOtbCache(const std::string& cacheFile, uint32 otbSize, uint32 otbChecksum, ItemTypeList& itemTypes);
+    void saveOtbCache(const std::string& cacheFile, uint32 otbSize, uint32 otbChecksum, const ItemTypeList& itemTypes);
+
     ThingTypeList m_thingTypes[ThingLastCategory];
     ItemTypeList m_reverseItemTypes;
     ItemTypeList m_itemTypes;
@@ -86,6 +101,7 @@ private:
     bool m_datLoaded;
     bool m_xmlLoaded;
     bool m_otbLoaded;
+    bool m_otbCache;
 
     uint32 m_otbMinorVersion;
     uint32 m_otbMajorVersion;
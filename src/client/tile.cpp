@@ -31,6 +31,8 @@
 #include "lightview.h"
 #include <framework/graphics/fontmanager.h>
 
+ObjectArena Tile::s_arena(sizeof(Tile));
+
 Tile::Tile(const Position& position) :
     m_position(position),
     m_drawElevation(0),
@@ -171,23 +173,24 @@ void Tile::draw(const Point& dest, float scaleFactor, int drawFlags, LightView *
     }
 }
 
-void Tile::drawToImage(Point dest, ImagePtr image)
+void Tile::drawToImage(Point dest, ImagePtr image, int animationTicks)
 {
     int x = dest.x;
     int y = dest.y;
     //g_logger.warning(stdext::format("items %d %d %d",x,y, m_things.size()));
         // first bottom items
-        m_drawElevation = 0;
+        // local elevation, the same tile can be drawn by many map generator threads at once
+        int drawElevation = 0;
         for(const ThingPtr& thing : m_things) {
             if(!thing->isGround() && !thing->isGroundBorder() && !thing->isOnBottom())
                 break;
 
             if(thing->isGround() || thing->isGroundBorder() || thing->isOnBottom()) {
-                thing->drawToImage(Point(x - m_drawElevation, y - m_drawElevation), image);
+                thing->drawToImage(Point(x - drawElevation, y - drawElevation), image, animationTicks);
             }
-            m_drawElevation += thing->getElevation();
-            if(m_drawElevation > Otc::MAX_ELEVATION)
-                m_drawElevation = Otc::MAX_ELEVATION;
+            drawElevation += thing->getElevation();
+            if(drawElevation > Otc::MAX_ELEVATION)
+                drawElevation = Otc::MAX_ELEVATION;
         }
 
         // normal items
@@ -195,17 +198,17 @@ void Tile::drawToImage(Point dest, ImagePtr image)
             const ThingPtr& thing = *it;
             if(thing->isOnTop() || thing->isOnBottom() || thing->isGroundBorder() || thing->isGround() || thing->isCreature())
                 break;
-            thing->drawToImage(Point(x - m_drawElevation, y - m_drawElevation), image);
+            thing->drawToImage(Point(x - drawElevation, y - drawElevation), image, animationTicks);
 
-            m_drawElevation += thing->getElevation();
-            if(m_drawElevation > Otc::MAX_ELEVATION)
-                m_drawElevation = Otc::MAX_ELEVATION;
+            drawElevation += thing->getElevation();
+            if(drawElevation > Otc::MAX_ELEVATION)
+                drawElevation = Otc::MAX_ELEVATION;
         }
 
         // top items
         for(const ThingPtr& thing : m_things)
             if(thing->isOnTop()) // TODO: why not minus elevation?
-                thing->drawToImage(Point(x - m_drawElevation, y - m_drawElevation), image);
+                thing->drawToImage(Point(x - drawElevation, y - drawElevation), image, animationTicks);
 }
 
 void Tile::clean()
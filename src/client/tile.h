@@ -28,6 +28,7 @@
 #include "effect.h"
 #include "creature.h"
 #include "item.h"
+#include "objectarena.h"
 #include <framework/luaengine/luaobject.h>
 
 enum tileflags_t
@@ -62,8 +63,12 @@ public:
 
     Tile(const Position& position);
 
+    static void *operator new(size_t size) { return s_arena.allocate(size); }
+    static void operator delete(void *p) { ObjectArena::deallocate(p); }
+    static ObjectArena& getArena() { return s_arena; }
+
     void draw(const Point& dest, float scaleFactor, int drawFlags, LightView *lightView = nullptr);
-    void drawToImage(Point dest, ImagePtr image);
+    void drawToImage(Point dest, ImagePtr image, int animationTicks = 0);
 
 public:
     void clean();
@@ -91,6 +96,8 @@ public:
     std::vector<CreaturePtr> getCreatures();
     std::vector<CreaturePtr> getWalkingCreatures() { return m_walkingCreatures; }
     std::vector<ThingPtr> getThings() { return m_things; }
+    // the stack itself, for loops that must not copy it
+    const stdext::small_vector<ThingPtr, 4>& rawGetThings() { return m_things; }
     ItemPtr getGround();
     int getGroundSpeed();
     uint8 getMinimapColorByte();
@@ -132,15 +139,18 @@ public:
 private:
     void checkTranslucentLight();
 
-    stdext::packed_vector<CreaturePtr> m_walkingCreatures;
-    stdext::packed_vector<EffectPtr> m_effects; // leave this outside m_things because it has no stackpos.
-    stdext::packed_vector<ThingPtr> m_things;
+    // ground, borders and an item or two fit without a heap allocation
+    stdext::small_vector<CreaturePtr, 1> m_walkingCreatures;
+    stdext::small_vector<EffectPtr, 1> m_effects; // leave this outside m_things because it has no stackpos.
+    stdext::small_vector<ThingPtr, 4> m_things;
     Position m_position;
     uint8 m_drawElevation;
     uint8 m_minimapColor;
     uint32 m_flags, m_houseId;
 
     stdext::boolean<false> m_selected;
+
+    static ObjectArena s_arena;
 };
 
 #endif
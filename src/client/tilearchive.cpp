@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "tilearchive.h"
+#include "maprenderjob.h"
+
+#include <framework/core/resourcemanager.h>
+#include <framework/core/filestream.h>
+#include <framework/platform/platform.h>
+
+bool TileArchive::readIndex(const std::string& dir, std::vector<TileArchiveEntry>& entries, int& packCount)
+{
+    entries.clear();
+    packCount = 0;
+    if(!g_resources.fileExists(getIndexFile(dir)))
+        return false;
+
+    FileStreamPtr fin = g_resources.openFile(getIndexFile(dir));
+    fin->cache();
+    if(fin->getU32() != TILEARCHIVE_SIGNATURE || fin->getU16() != TILEARCHIVE_VERSION)
+        stdext::throw_exception("invalid tile archive index");
+
+    packCount = fin->getU32();
+    entries.resize(fin->getU32());
+    for(TileArchiveEntry& entry : entries) {
+        entry.x = fin->getU16();
+        entry.y = fin->getU16();
+        entry.z = fin->getU8();
+        entry.zoom = fin->getU8();
+        entry.pack = fin->getU16();
+        entry.offset = fin->getU32();
+        entry.length = fin->getU32();
+        entry.hash = fin->getU64();
+    }
+    fin->close();
+    return true;
+}
+
+uint64 TileArchive::hash(const std::string& data)
+{
+    // fnv-1a
+    uint64 hash = 14695981039346656037ULL;
+    for(char c : data) {
+        hash ^= (uint8)c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool TileArchiveWriter::open(const std::string& dir)
+{
+    try {
+        m_dir = dir;
+        g_resources.makeDir(dir);
+        TileArchive::readIndex(dir, m_entries, m_packCount);
+        m_thread = std::thread(&TileArchiveWriter::writerLoop, this);
+        return true;
+    } catch(stdext::exception& e) {
+        g_logger.error(stdext::format("Unable to open tile archive '%s': %s", dir, e.what()));
+        return false;
+    }
+}
+
+void TileArchiveWriter::add(int x, int y, int z, int zoom, const std::string& data)
+{
+    PendingTile tile;
+    tile.entry.x = x;
+    tile.entry.y = y;
+    tile.entry.z = z;
+    tile.entry.zoom = zoom;
+    tile.entry.length = data.size();
+    tile.entry.hash = TileArchive::hash(data);
+    tile.data = data;
+    tile.immediate = false;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_spaceCondition.wait(lock, [this]() { return m_queuedBytes < TILEARCHIVE_QUEUE_SIZE || m_closing; });
+    m_queuedBytes += data.size();
+    m_queue.push_back(std::move(tile));
+    m_queueCondition.notify_one();
+}
+
+void TileArchiveWriter::addBarrier(const std::function<void(bool)>& callback, bool immediate)
+{
+    PendingTile barrier;
+    barrier.barrier = callback;
+    barrier.immediate = immediate;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.push_back(std::move(barrier));
+    m_queueCondition.notify_one();
+}
+
+// tiles queued by many render threads are written ordered along a hilbert curve, so neighbouring
+// tiles end up close to each other in the packs
+void TileArchiveWriter::writerLoop()
+{
+    while(true) {
+        std::deque<PendingTile> tiles;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto ready = [this]() { return !m_queue.empty() || m_closing; };
+            // waiting barriers are released by the next checkpoint even when no more tiles come
+            if(m_barriers.empty())
+                m_queueCondition.wait(lock, ready);
+            else {
+                ticks_t wait = std::max<ticks_t>(0, m_lastCheckpoint + TILEARCHIVE_CHECKPOINT_INTERVAL - stdext::millis());
+                m_queueCondition.wait_for(lock, std::chrono::milliseconds(wait), ready);
+            }
+            if(m_queue.empty() && m_closing)
+                return;
+            tiles.swap(m_queue);
+            m_queuedBytes = 0;
+        }
+        m_spaceCondition.notify_all();
+
+        // a barrier waits for every tile of its batch, so it is taken out before sorting
+        std::vector<std::function<void(bool)>> barriers;
+        bool immediate = false;
+        for(auto it = tiles.begin(); it != tiles.end();) {
+            if(it->barrier) {
+                immediate = immediate || it->immediate;
+                barriers.push_back(std::move(it->barrier));
+                it = tiles.erase(it);
+            } else
+                ++it;
+        }
+
+        std::stable_sort(tiles.begin(), tiles.end(), [](const PendingTile& a, const PendingTile& b) {
+            if(a.entry.z != b.entry.z)
+                return a.entry.z < b.entry.z;
+            return stdext::hilbert_index(a.entry.x, a.entry.y) < stdext::hilbert_index(b.entry.x, b.entry.y);
+        });
+        for(PendingTile& tile : tiles) {
+            if(!m_failed)
+                write(tile);
+        }
+        m_barriers.insert(m_barriers.end(), barriers.begin(), barriers.end());
+        if(!m_failed && (m_pack || !m_barriers.empty()) && (immediate || stdext::millis() - m_lastCheckpoint >= TILEARCHIVE_CHECKPOINT_INTERVAL))
+            checkpoint();
+        // nothing reaches a checkpoint after a failure
+        if(m_failed)
+            releaseBarriers(false);
+    }
+}
+
+void TileArchiveWriter::write(PendingTile& tile)
+{
+    try {
+        if(!m_pack || m_packOffset + tile.data.size() > TILEARCHIVE_PACK_SIZE) {
+            if(m_pack) {
+                closePack();
+                writeIndex();
+            }
+            m_pack = g_resources.createFile(TileArchive::getPackFile(m_dir, m_packCount++));
+            if(!m_pack)
+                stdext::throw_exception("unable to create pack");
+            m_pack->setWriteBufferSize(TILEARCHIVE_WRITE_BUFFER_SIZE);
+            m_packOffset = 0;
+        }
+
+        m_pack->write(tile.data.data(), tile.data.size());
+        tile.entry.pack = m_packCount - 1;
+        tile.entry.offset = m_packOffset;
+        m_packOffset += tile.data.size();
+        m_entries.push_back(tile.entry);
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Unable to write tile archive '%s': %s", m_dir, e.what()));
+        m_failed = true;
+    }
+}
+
+void TileArchiveWriter::checkpoint()
+{
+    try {
+        if(m_pack) {
+            m_pack->flush();
+            g_platform.syncFile(g_resources.getRealPath(TileArchive::getPackFile(m_dir, m_packCount - 1)));
+        }
+        writeIndex();
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Unable to checkpoint tile archive '%s': %s", m_dir, e.what()));
+        m_failed = true;
+    }
+}
+
+// replaces the index only after everything it points at is synced
+void TileArchiveWriter::writeIndex()
+{
+    // chunks rendered again (after resuming a job) replace the older copy
+    std::stable_sort(m_entries.begin(), m_entries.end());
+    std::vector<TileArchiveEntry> entries;
+    entries.reserve(m_entries.size());
+    for(const TileArchiveEntry& entry : m_entries) {
+        if(!entries.empty() && !(entries.back() < entry))
+            entries.back() = entry;
+        else
+            entries.push_back(entry);
+    }
+    m_entries.swap(entries);
+
+    std::string data(14 + m_entries.size() * 24, '\0');
+    uchar *out = (uchar*)&data[0];
+    stdext::writeULE32(out, TILEARCHIVE_SIGNATURE);
+    stdext::writeULE16(out + 4, TILEARCHIVE_VERSION);
+    stdext::writeULE32(out + 6, m_packCount);
+    stdext::writeULE32(out + 10, m_entries.size());
+    out += 14;
+    for(const TileArchiveEntry& entry : m_entries) {
+        stdext::writeULE16(out, entry.x);
+        stdext::writeULE16(out + 2, entry.y);
+        out[4] = entry.z;
+        out[5] = entry.zoom;
+        stdext::writeULE16(out + 6, entry.pack);
+        stdext::writeULE32(out + 8, entry.offset);
+        stdext::writeULE32(out + 12, entry.length);
+        stdext::writeULE64(out + 16, entry.hash);
+        out += 24;
+    }
+
+    MapRenderJob::writeFileAtomic(g_resources.getRealDir(m_dir) + "/" + TileArchive::getIndexFile(m_dir), data);
+    m_lastCheckpoint = stdext::millis();
+    releaseBarriers(true);
+}
+
+void TileArchiveWriter::releaseBarriers(bool durable)
+{
+    std::vector<std::function<void(bool)>> barriers;
+    barriers.swap(m_barriers);
+    for(const std::function<void(bool)>& barrier : barriers)
+        barrier(durable);
+}
+
+// the index is written after all packs are on disk, so it never points at lost data
+void TileArchiveWriter::closePack()
+{
+    m_pack->flush();
+    m_pack->close();
+    m_pack = nullptr;
+    g_platform.syncFile(g_resources.getRealPath(TileArchive::getPackFile(m_dir, m_packCount - 1)));
+}
+
+bool TileArchiveWriter::close()
+{
+    if(!m_thread.joinable())
+        return !m_failed;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closing = true;
+    }
+    m_queueCondition.notify_all();
+    m_spaceCondition.notify_all();
+    m_thread.join();
+
+    try {
+        if(m_pack)
+            closePack();
+        if(m_failed)
+            return false;
+        writeIndex();
+
+        g_logger.info(stdext::format("Tile archive '%s' has %d chunks in %d packs", m_dir, (int)m_entries.size(), m_packCount));
+        return true;
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Unable to close tile archive '%s': %s", m_dir, e.what()));
+        m_failed = true;
+        releaseBarriers(false);
+        return false;
+    }
+}
+
+bool TileArchiveReader::open(const std::string& dir)
+{
+    try {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        int packCount;
+        if(!TileArchive::readIndex(dir, m_entries, packCount))
+            stdext::throw_exception("index not found");
+        m_dir = dir;
+        m_packs.clear();
+        m_packs.resize(packCount);
+        return true;
+    } catch(stdext::exception& e) {
+        g_logger.error(stdext::format("Unable to open tile archive '%s': %s", dir, e.what()));
+        return false;
+    }
+}
+
+const TileArchiveEntry *TileArchiveReader::find(int x, int y, int z, int zoom)
+{
+    TileArchiveEntry key;
+    key.x = x;
+    key.y = y;
+    key.z = z;
+    key.zoom = zoom;
+    auto it = std::lower_bound(m_entries.begin(), m_entries.end(), key);
+    if(it == m_entries.end() || key < *it)
+        return nullptr;
+    return &*it;
+}
+
+bool TileArchiveReader::read(int x, int y, int z, int zoom, std::string& data)
+{
+    const TileArchiveEntry *entry = find(x, y, z, zoom);
+    if(!entry || entry->pack >= m_packs.size())
+        return false;
+
+    try {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        FileStreamPtr& pack = m_packs[entry->pack];
+        if(!pack)
+            pack = g_resources.openFile(TileArchive::getPackFile(m_dir, entry->pack));
+
+        data.resize(entry->length);
+        pack->seek(entry->offset);
+        return entry->length == 0 || pack->read(&data[0], entry->length) == 1;
+    } catch(stdext::exception& e) {
+        g_logger.error(stdext::format("Unable to read chunk %d,%d,%d from tile archive '%s': %s", x, y, z, m_dir, e.what()));
+        return false;
+    }
+}
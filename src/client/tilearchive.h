@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TILEARCHIVE_H
+#define TILEARCHIVE_H
+
+#include "declarations.h"
+#include <framework/core/declarations.h>
+
+enum {
+    TILEARCHIVE_SIGNATURE = 0x4154544F,
+    TILEARCHIVE_VERSION = 1,
+    TILEARCHIVE_PACK_SIZE = 1024 * 1024 * 1024,
+    TILEARCHIVE_QUEUE_SIZE = 64 * 1024 * 1024,
+    TILEARCHIVE_WRITE_BUFFER_SIZE = 1024 * 1024,
+    TILEARCHIVE_CHECKPOINT_INTERVAL = 10 * 1000
+};
+
+struct TileArchiveEntry
+{
+    uint16 x;
+    uint16 y;
+    uint8 z;
+    uint8 zoom;
+    uint16 pack;
+    uint32 offset;
+    uint32 length;
+    uint64 hash;
+
+    bool operator<(const TileArchiveEntry& other) const {
+        return std::tie(z, x, y, zoom) < std::tie(other.z, other.x, other.y, other.zoom);
+    }
+};
+
+// A tile archive is a directory with pack-NNNN.dat files holding encoded chunk images
+// back to back and index.dat with one entry per chunk sorted by (z, x, y, zoom).
+class TileArchive
+{
+public:
+    static std::string getPackFile(const std::string& dir, int pack) { return stdext::format("%s/pack-%04d.dat", dir, pack); }
+    static std::string getIndexFile(const std::string& dir) { return dir + "/index.dat"; }
+    static bool readIndex(const std::string& dir, std::vector<TileArchiveEntry>& entries, int& packCount);
+    static uint64 hash(const std::string& data);
+};
+
+// Appends chunks from any thread; a single thread writes them to the packs in the order
+// they were added. An existing archive is continued in new packs. The index is replaced
+// atomically whenever a pack is closed and every few seconds, after the packs are synced,
+// so an interrupted writer leaves an index of the chunks written until then. Barriers tell
+// callers when their chunks reached such a checkpoint.
+class TileArchiveWriter
+{
+public:
+    TileArchiveWriter() : m_packCount(0), m_packOffset(0), m_lastCheckpoint(0), m_queuedBytes(0), m_closing(false), m_failed(false) { }
+    ~TileArchiveWriter() { close(); }
+
+    bool open(const std::string& dir);
+    // blocks while too much data waits for the writer
+    void add(int x, int y, int z, int zoom, const std::string& data);
+    // callback runs on the writer thread once every chunk added before it is synced and in the index
+    // (true), or once the writer failed and they never will be (false). An immediate barrier makes the
+    // writer checkpoint right after those chunks instead of waiting for the interval.
+    void addBarrier(const std::function<void(bool)>& callback, bool immediate = false);
+    // writes the queued chunks and the index
+    bool close();
+
+private:
+    struct PendingTile {
+        TileArchiveEntry entry;
+        std::string data;
+        std::function<void(bool)> barrier;
+        bool immediate;
+    };
+
+    void writerLoop();
+    void write(PendingTile& tile);
+    void closePack();
+    void checkpoint();
+    void writeIndex();
+    void releaseBarriers(bool durable);
+
+    std::string m_dir;
+    std::vector<TileArchiveEntry> m_entries;
+    std::vector<std::function<void(bool)>> m_barriers;
+    FileStreamPtr m_pack;
+    int m_packCount;
+    uint32 m_packOffset;
+    ticks_t m_lastCheckpoint;
+
+    std::deque<PendingTile> m_queue;
+    size_t m_queuedBytes;
+    bool m_closing;
+    bool m_failed;
+    std::mutex m_mutex;
+    std::condition_variable m_queueCondition;
+    std::condition_variable m_spaceCondition;
+    std::thread m_thread;
+};
+
+// Finds chunks with a binary search over the index and reads them with one seek.
+// Reads are serialized, packs are opened when first needed.
+class TileArchiveReader
+{
+public:
+    bool open(const std::string& dir);
+    const TileArchiveEntry *find(int x, int y, int z, int zoom);
+    bool read(int x, int y, int z, int zoom, std::string& data);
+    const std::vector<TileArchiveEntry>& getEntries() { return m_entries; }
+
+private:
+    std::string m_dir;
+    std::vector<TileArchiveEntry> m_entries;
+    std::vector<FileStreamPtr> m_packs;
+    std::mutex m_mutex;
+};
+
+#endif
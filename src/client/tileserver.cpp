@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "tileserver.h"
+#include "map.h"
+
+#include <framework/core/resourcemanager.h>
+#include <framework/net/server.h>
+#include <framework/net/connection.h>
+
+#include <boost/filesystem.hpp>
+
+extern asio::io_service g_ioService;
+
+TileServer g_tileServer;
+
+bool TileServer::start(int port, int threads, const std::string& cacheDir)
+{
+    if(m_server) {
+        g_logger.error("Tile server is already running");
+        return false;
+    }
+
+    ServerPtr server = Server::createLocal(port);
+    if(!server)
+        return false;
+
+    m_server = server;
+    m_cacheDir = cacheDir;
+    if(!m_cacheDir.empty())
+        g_resources.makeDir(m_cacheDir);
+
+    m_stopping = false;
+    threads = std::max<int>(1, threads);
+    for(int i = 0; i < threads; ++i)
+        m_workers.push_back(std::thread(&TileServer::workerLoop, this));
+
+    m_server->setAcceptCallback([this](const ConnectionPtr& connection) {
+        if(connection)
+            readRequest(connection);
+        acceptNext();
+    });
+    acceptNext();
+
+    g_logger.info(stdext::format("Tile server listening on http://127.0.0.1:%d/z/x/y.png with %d threads", port, threads));
+    return true;
+}
+
+void TileServer::stop()
+{
+    if(!m_server)
+        return;
+
+    m_server->close();
+    m_server = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_jobs.clear();
+    }
+    m_condition.notify_all();
+    for(std::thread& worker : m_workers)
+        worker.join();
+    m_workers.clear();
+
+    for(auto& it : m_waiting) {
+        for(const ConnectionPtr& connection : it.second)
+            connection->close();
+    }
+    m_waiting.clear();
+}
+
+void TileServer::setCacheLimit(int megabytes)
+{
+    m_cacheLimit = (size_t)std::max<int>(0, megabytes) * 1024 * 1024;
+    trimCache();
+}
+
+void TileServer::clearCache()
+{
+    m_cache.clear();
+    m_lru.clear();
+    m_cacheBytes = 0;
+}
+
+std::map<std::string, int> TileServer::getStats()
+{
+    std::map<std::string, int> stats;
+    stats["requests"] = m_requests;
+    stats["memory_hits"] = m_memoryHits;
+    stats["coalesced"] = m_coalesced;
+    stats["disk_hits"] = m_diskHits;
+    stats["renders"] = m_renders;
+    stats["cached_chunks"] = m_cache.size();
+    stats["cached_kb"] = m_cacheBytes / 1024;
+    stats["pending"] = m_waiting.size();
+    return stats;
+}
+
+void TileServer::acceptNext()
+{
+    if(m_server)
+        m_server->acceptNext();
+}
+
+void TileServer::readRequest(const ConnectionPtr& connection)
+{
+    // keep-alive, the connection is closed by its read timeout when the client goes away
+    connection->read_until("\r\n\r\n", [this, connection](uint8* buffer, uint16 size) {
+        onRequest(connection, std::string((const char*)buffer, size));
+    });
+}
+
+void TileServer::readNextRequest(const ConnectionPtr& connection)
+{
+    // the connection consumes the current request after its callback returns
+    g_ioService.post([this, connection]() { readRequest(connection); });
+}
+
+void TileServer::onRequest(const ConnectionPtr& connection, const std::string& request)
+{
+    if(!m_server) {
+        connection->close();
+        return;
+    }
+
+    m_requests++;
+
+    std::istringstream line(request.substr(0, request.find("\r\n")));
+    std::string method, path;
+    line >> method >> path;
+    if(method != "GET") {
+        respondError(connection, 405, "Method Not Allowed");
+        return;
+    }
+
+    path = path.substr(0, path.find('?'));
+    int z, x, y;
+    char tail;
+    if(sscanf(path.c_str(), "/%d/%d/%d.pn%c", &z, &x, &y, &tail) != 4 || tail != 'g' ||
+       path.compare(path.size() - 4, 4, ".png") != 0 ||
+       z < 0 || z > Otc::MAX_Z || x < 0 || y < 0 || x > 65535 / TILESERVER_CHUNK_SIZE || y > 65535 / TILESERVER_CHUNK_SIZE) {
+        respondError(connection, 404, "Not Found");
+        return;
+    }
+
+    uint64 key = makeKey(x, y, z);
+    auto it = m_cache.find(key);
+    if(it != m_cache.end()) {
+        m_memoryHits++;
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+        respond(connection, it->second.data);
+        return;
+    }
+
+    std::vector<ConnectionPtr>& waiting = m_waiting[key];
+    waiting.push_back(connection);
+    if(waiting.size() > 1) {
+        m_coalesced++;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(key);
+    }
+    m_condition.notify_one();
+}
+
+void TileServer::onRendered(uint64 key, const std::shared_ptr<std::string>& data)
+{
+    auto it = m_waiting.find(key);
+    if(it == m_waiting.end())
+        return;
+    std::vector<ConnectionPtr> waiting = std::move(it->second);
+    m_waiting.erase(it);
+
+    if(!data) {
+        for(const ConnectionPtr& connection : waiting)
+            respondError(connection, 500, "Internal Server Error");
+        return;
+    }
+
+    cache(key, data);
+    for(const ConnectionPtr& connection : waiting)
+        respond(connection, data);
+}
+
+void TileServer::respond(const ConnectionPtr& connection, const std::shared_ptr<std::string>& data)
+{
+    // areas without anything to draw have no image, like in generated maps
+    if(data->empty()) {
+        respondError(connection, 404, "Not Found");
+        return;
+    }
+
+    std::string header = stdext::format("HTTP/1.1 200 OK\r\n"
+                                        "Content-Type: image/png\r\n"
+                                        "Content-Length: %d\r\n"
+                                        "Access-Control-Allow-Origin: *\r\n\r\n", (int)data->size());
+    connection->write((uint8*)header.data(), header.size());
+    connection->write((uint8*)data->data(), data->size());
+    readNextRequest(connection);
+}
+
+void TileServer::respondError(const ConnectionPtr& connection, int status, const std::string& reason)
+{
+    std::string response = stdext::format("HTTP/1.1 %d %s\r\n"
+                                          "Content-Type: text/plain\r\n"
+                                          "Content-Length: %d\r\n"
+                                          "Access-Control-Allow-Origin: *\r\n\r\n%s", status, reason, (int)reason.size(), reason);
+    connection->write((uint8*)response.data(), response.size());
+    readNextRequest(connection);
+}
+
+void TileServer::cache(uint64 key, const std::shared_ptr<std::string>& data)
+{
+    m_lru.push_front(key);
+    CachedChunk& chunk = m_cache[key];
+    chunk.data = data;
+    chunk.lru = m_lru.begin();
+    m_cacheBytes += data->size() + TILESERVER_ENTRY_OVERHEAD;
+    trimCache();
+}
+
+void TileServer::trimCache()
+{
+    while(m_cacheBytes > m_cacheLimit && !m_lru.empty()) {
+        auto it = m_cache.find(m_lru.back());
+        m_cacheBytes -= it->second.data->size() + TILESERVER_ENTRY_OVERHEAD;
+        m_cache.erase(it);
+        m_lru.pop_back();
+    }
+}
+
+void TileServer::workerLoop()
+{
+    while(true) {
+        uint64 key;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return !m_jobs.empty() || m_stopping; });
+            if(m_stopping)
+                return;
+            key = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        std::shared_ptr<std::string> data = render(key);
+        g_ioService.post([key, data]() { g_tileServer.onRendered(key, data); });
+    }
+}
+
+std::shared_ptr<std::string> TileServer::render(uint64 key)
+{
+    int z = key >> 48;
+    int x = (key >> 24) & 0xFFFFFF;
+    int y = key & 0xFFFFFF;
+
+    try {
+        std::string fileName = getCacheFile(key, g_map.getMapSignature());
+        if(!fileName.empty() && g_resources.fileExists(fileName)) {
+            m_diskHits++;
+            return std::make_shared<std::string>(g_resources.readFileContents(fileName));
+        }
+
+        std::shared_ptr<std::string> image = std::make_shared<std::string>();
+        if(!g_map.encodeMapImage(*image, x * TILESERVER_CHUNK_SIZE, y * TILESERVER_CHUNK_SIZE, z, TILESERVER_CHUNK_SIZE))
+            image->clear();
+        m_renders++;
+
+        // empty files mark areas without image, they are renamed into place so readers never see a partial file
+        if(!fileName.empty()) {
+            g_resources.makeDir(fileName.substr(0, fileName.rfind('/')));
+            std::string tmpFile = fileName + "." + boost::filesystem::unique_path().string() + ".tmp";
+            if(g_resources.writeFileContents(tmpFile, *image)) {
+                std::string realDir = g_resources.getRealDir(tmpFile);
+                boost::filesystem::rename(realDir + "/" + tmpFile, realDir + "/" + fileName);
+            }
+        }
+        return image;
+    } catch(std::exception& e) {
+        g_logger.error(stdext::format("Unable to render tile %d/%d/%d: %s", z, x, y, e.what()));
+        return nullptr;
+    }
+}
+
+// every loaded map has a cache directory of its own, so images of another map are never served
+std::string TileServer::getCacheFile(uint64 key, const std::string& mapSignature)
+{
+    if(m_cacheDir.empty() || mapSignature.empty())
+        return std::string();
+    return stdext::format("%s/%s/%d/%d/%d.png", m_cacheDir, mapSignature, (int)(key >> 48), (int)((key >> 24) & 0xFFFFFF), (int)(key & 0xFFFFFF));
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TILESERVER_H
+#define TILESERVER_H
+
+#include "declarations.h"
+#include <framework/net/declarations.h>
+
+enum {
+    TILESERVER_CHUNK_SIZE = 8,
+    TILESERVER_ENTRY_OVERHEAD = 64, // bytes counted for every cached chunk, so empty chunks are bounded too
+    TILESERVER_DEFAULT_CACHE_SIZE = 256 * 1024 * 1024
+};
+
+// Minimal http server for map reviews: GET /z/x/y.png returns the 8x8 tile chunk x, y of floor z
+// (same chunks as the generated map/x_y_z.png files). Chunks are rendered on demand by a pool of
+// worker threads, requests for a chunk that is already being rendered wait for that render, and
+// results are kept in a memory cache limited in bytes (least recently used chunks are dropped)
+// and optionally in a disk cache directory, in a subdirectory for every loaded map. Sockets are
+// handled by the main thread.
+class TileServer
+{
+public:
+    TileServer() : m_cacheLimit(TILESERVER_DEFAULT_CACHE_SIZE), m_cacheBytes(0), m_requests(0), m_memoryHits(0),
+        m_coalesced(0), m_diskHits(0), m_renders(0), m_stopping(false) { }
+
+    bool start(int port, int threads, const std::string& cacheDir);
+    void stop();
+    bool isRunning() { return !!m_server; }
+
+    void setCacheLimit(int megabytes);
+    // drops the memory cache, the disk cache is kept
+    void clearCache();
+    std::map<std::string, int> getStats();
+
+private:
+    struct CachedChunk {
+        std::shared_ptr<std::string> data;
+        std::list<uint64>::iterator lru;
+    };
+
+    void acceptNext();
+    void readRequest(const ConnectionPtr& connection);
+    void readNextRequest(const ConnectionPtr& connection);
+    void onRequest(const ConnectionPtr& connection, const std::string& request);
+    void onRendered(uint64 key, const std::shared_ptr<std::string>& data);
+    void respond(const ConnectionPtr& connection, const std::shared_ptr<std::string>& data);
+    void respondError(const ConnectionPtr& connection, int status, const std::string& reason);
+    void cache(uint64 key, const std::shared_ptr<std::string>& data);
+    void trimCache();
+    void workerLoop();
+    std::shared_ptr<std::string> render(uint64 key);
+    std::string getCacheFile(uint64 key, const std::string& mapSignature);
+
+    static uint64 makeKey(int x, int y, int z) { return (uint64)z << 48 | (uint64)x << 24 | (uint64)y; }
+
+    ServerPtr m_server;
+    std::string m_cacheDir;
+
+    // main thread only
+    std::unordered_map<uint64, CachedChunk> m_cache;
+    std::list<uint64> m_lru;
+    size_t m_cacheLimit;
+    size_t m_cacheBytes;
+    std::unordered_map<uint64, std::vector<ConnectionPtr>> m_waiting;
+    int m_requests;
+    int m_memoryHits;
+    int m_coalesced;
+
+    std::atomic<int> m_diskHits;
+    std::atomic<int> m_renders;
+
+    std::deque<uint64> m_jobs;
+    bool m_stopping;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<std::thread> m_workers;
+};
+
+extern TileServer g_tileServer;
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "workerplacement.h"
+
+#include <framework/platform/platform.h>
+
+WorkerPlacement g_workerPlacement;
+
+bool WorkerPlacement::place(int worker)
+{
+    if(!m_affinity)
+        return false;
+    std::call_once(m_detected, [this]() { detect(); });
+    return g_platform.setThreadAffinity(m_cpus[worker % m_cpus.size()]);
+}
+
+int WorkerPlacement::getNodeCount()
+{
+    std::call_once(m_detected, [this]() { detect(); });
+    return m_nodeCount;
+}
+
+int WorkerPlacement::getCpuCount()
+{
+    std::call_once(m_detected, [this]() { detect(); });
+    return m_cpus.size();
+}
+
+int WorkerPlacement::getCurrentNode()
+{
+    std::call_once(m_detected, [this]() { detect(); });
+    int cpu = g_platform.getCurrentCpu();
+    if(cpu < 0 || cpu >= (int)m_cpuNodes.size())
+        return 0;
+    return m_cpuNodes[cpu];
+}
+
+void WorkerPlacement::detect()
+{
+    // only cpus of the process affinity mask (taskset, cgroups) get workers
+    m_cpus = g_platform.getProcessCpus();
+    if(m_cpus.empty()) {
+        for(int cpu = 0; cpu < std::max<int>(1, std::thread::hardware_concurrency()); ++cpu)
+            m_cpus.push_back(cpu);
+    }
+
+    m_cpuNodes.resize(*std::max_element(m_cpus.begin(), m_cpus.end()) + 1, 0);
+    for(int cpu : m_cpus) {
+        m_cpuNodes[cpu] = std::min<int>(g_platform.getCpuNode(cpu), WORKERPLACEMENT_MAX_NODES - 1);
+        m_nodeCount = std::max<int>(m_nodeCount, m_cpuNodes[cpu] + 1);
+    }
+    std::stable_sort(m_cpus.begin(), m_cpus.end(), [this](int a, int b) { return m_cpuNodes[a] < m_cpuNodes[b]; });
+    g_logger.debug(stdext::format("Detected %d usable cpus in %d numa nodes", (int)m_cpus.size(), m_nodeCount));
+}
+
+WorkerRanges::WorkerRanges(size_t count, int workers) :
+    m_ranges(new Range[std::max<int>(workers, 1)]),
+    m_workers(std::max<int>(workers, 1))
+{
+    for(int i = 0; i < m_workers; ++i) {
+        m_ranges[i].next = count * i / m_workers;
+        m_ranges[i].end = count * (i + 1) / m_workers;
+    }
+}
+
+bool WorkerRanges::next(int worker, size_t& item)
+{
+    for(int i = 0; i < m_workers; ++i) {
+        Range& range = m_ranges[(worker + i) % m_workers];
+        if(range.next >= range.end)
+            continue;
+        item = range.next++;
+        if(item < range.end)
+            return true;
+    }
+    return false;
+}
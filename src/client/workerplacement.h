@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef WORKERPLACEMENT_H
+#define WORKERPLACEMENT_H
+
+#include "declarations.h"
+
+enum {
+    WORKERPLACEMENT_MAX_NODES = 64
+};
+
+// Where render worker threads run. With affinity enabled worker n is pinned to the n-th cpu of a
+// list ordered by numa node, so a few workers share one node (its memory and caches) before
+// the next node is used. Cpus allowed by the process affinity mask and their nodes are detected once.
+class WorkerPlacement
+{
+public:
+    WorkerPlacement() : m_affinity(false), m_nodeCount(1) { }
+
+    void setAffinityEnabled(bool enable) { m_affinity = enable; }
+    bool isAffinityEnabled() { return m_affinity; }
+
+    // called by a worker thread when it starts, returns false when it stays unpinned
+    bool place(int worker);
+    int getNodeCount();
+    int getCpuCount();
+    // numa node of the calling thread
+    int getCurrentNode();
+
+private:
+    void detect();
+
+    std::atomic<bool> m_affinity;
+    std::once_flag m_detected;
+    std::vector<int> m_cpus;
+    std::vector<int> m_cpuNodes;
+    int m_nodeCount;
+};
+
+// Splits items [0, count) into one contiguous range per worker. A worker takes items from its own
+// range first, so spatially ordered items (chunks, areas) stay together on one core, and then
+// takes the next items of the other ranges so nobody idles at the end.
+class WorkerRanges
+{
+public:
+    WorkerRanges(size_t count, int workers);
+
+    bool next(int worker, size_t& item);
+
+private:
+    struct Range {
+        std::atomic<size_t> next;
+        size_t end;
+    };
+
+    std::unique_ptr<Range[]> m_ranges;
+    int m_workers;
+};
+
+extern WorkerPlacement g_workerPlacement;
+
+#endif
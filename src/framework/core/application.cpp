@@ -150,6 +150,7 @@ void Application::poll()
 #endif
 
     g_dispatcher.poll();
+    g_logger.poll();
 
     // poll connection again to flush pending write
 #ifdef FW_NET
@@ -26,7 +26,10 @@ AsyncDispatcher g_asyncDispatcher;
 
 void AsyncDispatcher::init()
 {
-    spawn_thread();
+    // at least two, so a task waiting for other tasks does not block the pool
+    int threads = std::max<int>(2, std::thread::hardware_concurrency());
+    for(int i = 0; i < threads; ++i)
+        spawn_thread();
 }
 
 void AsyncDispatcher::terminate()
@@ -41,6 +41,8 @@ public:
     void seek(uint pos);
     void skip(uint len);
     uint tell() { return m_pos; }
+    // offset of the node data in the file, right after the node start byte
+    uint getStartPos() { return m_startPos; }
     uint size() { unserialize(); return m_buffer.size(); }
 
     uint8 getU8();
@@ -31,7 +31,8 @@ FileStream::FileStream(const std::string& name, PHYSFS_File *fileHandle, bool wr
     m_fileHandle(fileHandle),
     m_pos(0),
     m_writeable(writeable),
-    m_caching(false)
+    m_caching(false),
+    m_writeBufferSize(0)
 {
 }
 
@@ -40,7 +41,8 @@ FileStream::FileStream(const std::string& name, const std::string& buffer) :
     m_fileHandle(nullptr),
     m_pos(0),
     m_writeable(false),
-    m_caching(true)
+    m_caching(true),
+    m_writeBufferSize(0)
 {
     m_data.resize(buffer.length());
     memcpy(&m_data[0], &buffer[0], buffer.length());
@@ -51,8 +53,14 @@ FileStream::~FileStream()
 #ifndef NDEBUG
     assert(!g_app.isTerminated());
 #endif
-    if(!g_app.isTerminated())
-        close();
+    if(!g_app.isTerminated()) {
+        // a destructor must not throw, a failed flush of buffered writes is only logged
+        try {
+            close();
+        } catch(stdext::exception& e) {
+            g_logger.error(stdext::format("Unable to close file: %s", e.what()));
+        }
+    }
 }
 
 void FileStream::cache()
@@ -75,9 +83,41 @@ void FileStream::cache()
     }
 }
 
+void FileStream::setWriteBufferSize(uint size)
+{
+    if(!m_writeable || m_caching)
+        throwError("write buffer requires an uncached writeable filestream");
+
+    flushWriteBuffer();
+    m_writeBufferSize = size;
+    m_writeBuffer.reserve(size);
+}
+
+void FileStream::flushWriteBuffer()
+{
+    if(m_writeBuffer.empty())
+        return;
+
+    uint len = m_writeBuffer.size();
+    bool success = PHYSFS_write(m_fileHandle, m_writeBuffer.data(), 1, len) == len;
+    m_writeBuffer.clear();
+    if(!success)
+        throwError("write failed", true);
+}
+
 void FileStream::close()
 {
     if(m_fileHandle && PHYSFS_isInit()) {
+        // the handle is closed even when the buffered writes fail
+        try {
+            flushWriteBuffer();
+        } catch(stdext::exception&) {
+            PHYSFS_close(m_fileHandle);
+            m_fileHandle = nullptr;
+            m_data.clear();
+            m_pos = 0;
+            throw;
+        }
         if(!PHYSFS_close(m_fileHandle))
             throwError("close failed", true);
         m_fileHandle = nullptr;
@@ -101,6 +141,7 @@ void FileStream::flush()
                 throwError("flush write failed", true);
         }
 
+        flushWriteBuffer();
         if(PHYSFS_flush(m_fileHandle) == 0)
             throwError("flush failed", true);
     }
@@ -130,7 +171,12 @@ int FileStream::read(void *buffer, uint32 size, uint32 nmemb)
 void FileStream::write(const void *buffer, uint32 count)
 {
     if(!m_caching) {
-        if(PHYSFS_write(m_fileHandle, buffer, 1, count) != count)
+        if(m_writeBufferSize > 0) {
+            const uint8 *data = (const uint8*)buffer;
+            m_writeBuffer.insert(m_writeBuffer.end(), data, data + count);
+            if(m_writeBuffer.size() >= m_writeBufferSize)
+                flushWriteBuffer();
+        } else if(PHYSFS_write(m_fileHandle, buffer, 1, count) != count)
             throwError("write failed", true);
     } else {
         m_data.grow(m_pos + count);
@@ -142,6 +188,7 @@ void FileStream::write(const void *buffer, uint32 count)
 void FileStream::seek(uint32 pos)
 {
     if(!m_caching) {
+        flushWriteBuffer();
         if(!PHYSFS_seek(m_fileHandle, pos))
             throwError("seek failed", true);
     } else {
@@ -158,16 +205,17 @@ void FileStream::skip(uint len)
 
 uint FileStream::size()
 {
-    if(!m_caching)
+    if(!m_caching) {
+        flushWriteBuffer();
         return PHYSFS_fileLength(m_fileHandle);
-    else
+    } else
         return m_data.size();
 }
 
 uint FileStream::tell()
 {
     if(!m_caching)
-        return PHYSFS_tell(m_fileHandle);
+        return PHYSFS_tell(m_fileHandle) + m_writeBuffer.size();
     else
         return m_pos;
 }
@@ -354,8 +402,7 @@ void FileStream::endNode()
 void FileStream::addU8(uint8 v)
 {
     if(!m_caching) {
-        if(PHYSFS_write(m_fileHandle, &v, 1, 1) != 1)
-            throwError("write failed", true);
+        write(&v, 1);
     } else {
         m_data.add(v);
         m_pos++;
@@ -365,8 +412,9 @@ void FileStream::addU8(uint8 v)
 void FileStream::addU16(uint16 v)
 {
     if(!m_caching) {
-        if(PHYSFS_writeULE16(m_fileHandle, v) == 0)
-            throwError("write failed", true);
+        uint8 data[2];
+        stdext::writeULE16(data, v);
+        write(data, 2);
     } else {
         m_data.grow(m_pos + 2);
         stdext::writeULE16(&m_data[m_pos], v);
@@ -377,8 +425,9 @@ void FileStream::addU16(uint16 v)
 void FileStream::addU32(uint32 v)
 {
     if(!m_caching) {
-        if(PHYSFS_writeULE32(m_fileHandle, v) == 0)
-            throwError("write failed", true);
+        uint8 data[4];
+        stdext::writeULE32(data, v);
+        write(data, 4);
     } else {
         m_data.grow(m_pos + 4);
         stdext::writeULE32(&m_data[m_pos], v);
@@ -389,8 +438,9 @@ void FileStream::addU32(uint32 v)
 void FileStream::addU64(uint64 v)
 {
     if(!m_caching) {
-        if(PHYSFS_writeULE64(m_fileHandle, v) == 0)
-            throwError("write failed", true);
+        uint8 data[8];
+        stdext::writeULE64(data, v);
+        write(data, 8);
     } else {
         m_data.grow(m_pos + 8);
         stdext::writeULE64(&m_data[m_pos], v);
@@ -401,8 +451,7 @@ void FileStream::addU64(uint64 v)
 void FileStream::add8(int8 v)
 {
     if(!m_caching) {
-        if(PHYSFS_write(m_fileHandle, &v, 1, 1) != 1)
-            throwError("write failed", true);
+        write(&v, 1);
     } else {
         m_data.add(v);
         m_pos++;
@@ -412,8 +461,9 @@ void FileStream::add8(int8 v)
 void FileStream::add16(int16 v)
 {
     if(!m_caching) {
-        if(PHYSFS_writeSLE16(m_fileHandle, v) == 0)
-            throwError("write failed", true);
+        uint8 data[2];
+        stdext::writeSLE16(data, v);
+        write(data, 2);
     } else {
         m_data.grow(m_pos + 2);
         stdext::writeSLE16(&m_data[m_pos], v);
@@ -424,8 +474,9 @@ void FileStream::add16(int16 v)
 void FileStream::add32(int32 v)
 {
     if(!m_caching) {
-        if(PHYSFS_writeSLE32(m_fileHandle, v) == 0)
-            throwError("write failed", true);
+        uint8 data[4];
+        stdext::writeSLE32(data, v);
+        write(data, 4);
     } else {
         m_data.grow(m_pos + 4);
         stdext::writeSLE32(&m_data[m_pos], v);
@@ -436,8 +487,9 @@ void FileStream::add32(int32 v)
 void FileStream::add64(int64 v)
 {
     if(!m_caching) {
-        if(PHYSFS_writeSLE64(m_fileHandle, v) == 0)
-            throwError("write failed", true);
+        uint8 data[8];
+        stdext::writeSLE64(data, v);
+        write(data, 8);
     } else {
         m_data.grow(m_pos + 8);
         stdext::writeSLE64(&m_data[m_pos], v);
@@ -41,6 +41,8 @@ public:
     void cache();
     void close();
     void flush();
+    // keeps up to size bytes of writes in memory before passing them to the file
+    void setWriteBufferSize(uint size);
     void write(const void *buffer, uint count);
     int read(void *buffer, uint size, uint nmemb = 1);
     void seek(uint pos);
@@ -79,6 +81,7 @@ public:
 
 private:
     void checkWrite();
+    void flushWriteBuffer();
     void throwError(const std::string& message, bool physfsError = false);
 
     std::string m_name;
@@ -86,6 +89,8 @@ private:
     uint m_pos;
     bool m_writeable;
     bool m_caching;
+    uint m_writeBufferSize;
+    std::vector<uint8> m_writeBuffer;
 
     DataBuffer<uint8_t> m_data;
 };
@@ -21,7 +21,9 @@
  */
 
 #include "logger.h"
-#include "eventdispatcher.h"
+
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/thread/tss.hpp>
 
 //#include <boost/regex.hpp>
 #include <framework/core/resourcemanager.h>
@@ -34,72 +36,227 @@
 
 Logger g_logger;
 
-void Logger::log(Fw::LogLevel level, const std::string& message)
+struct Logger::QueuedMessage
+{
+    QueuedMessage(Fw::LogLevel level, const std::string& message, std::size_t when, uint64 sequence) :
+        level(level), message(message), when(when), sequence(sequence) { }
+    Fw::LogLevel level;
+    std::string message;
+    std::size_t when;
+    uint64 sequence;
+};
+
+// written only by its thread, read only by the thread holding the logger mutex
+struct Logger::LogRing
+{
+    LogRing() : closed(false) { }
+    boost::lockfree::spsc_queue<QueuedMessage*, boost::lockfree::capacity<LOG_RING_SIZE>> queue;
+    std::atomic<bool> closed;
+};
+
+// destroyed before g_logger, so the ring of the main thread is closed before the logger frees the rings
+boost::thread_specific_ptr<Logger::LogRing> Logger::m_threadRing(&Logger::closeRing);
+
+static const std::string logPrefixes[] = { "", "", "WARNING: ", "ERROR: ", "FATAL ERROR: " };
+
+Logger::Logger() : m_sequence(0), m_collectCallbacks(false), m_ignoreLogs(false), m_running(true)
 {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    m_thread = std::thread(&Logger::writerLoop, this);
+}
 
+Logger::~Logger()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_running = false;
+        m_wakeCondition.notify_all();
+    }
+    m_thread.join();
+    flush();
+
+    std::lock_guard<std::mutex> lock(m_ringsMutex);
+    for(LogRing *ring : m_rings)
+        delete ring;
+    m_rings.clear();
+}
+
+void Logger::log(Fw::LogLevel level, const std::string& message)
+{
 #ifdef NDEBUG
     if(level == Fw::LogDebug)
         return;
 #endif
 
-    static bool ignoreLogs = false;
-    if(ignoreLogs)
+    if(m_ignoreLogs)
         return;
 
-    const static std::string logPrefixes[] = { "", "", "WARNING: ", "ERROR: ", "FATAL ERROR: " };
+    QueuedMessage *queued = new QueuedMessage(level, logPrefixes[level] + message, std::time(NULL), m_sequence++);
+    LogRing *ring = getRing();
+    while(!ring->queue.push(queued)) {
+        // full ring, wait for the writer instead of losing messages
+        m_wakeCondition.notify_one();
+        std::this_thread::yield();
+    }
+    if(ring->queue.write_available() < LOG_RING_SIZE / 2)
+        m_wakeCondition.notify_one();
 
-    std::string outmsg = logPrefixes[level] + message;
+    if(level == Fw::LogFatal) {
+        flush();
+#ifdef FW_GRAPHICS
+        g_window.displayFatalError(message);
+#endif
+        m_ignoreLogs = true;
+        exit(-1);
+    }
 
-    /*
-#if !defined(NDEBUG) && !defined(WIN32)
-    // replace paths for improved debug with vim
-    std::stringstream tmp;
-    boost::smatch m;
-    boost::regex e ("/[^ :]+");
-    while(boost::regex_search(outmsg,m,e)) {
-        tmp << m.prefix().str();
-        tmp << g_resources.getRealDir(m.str()) << m.str();
-        outmsg = m.suffix().str();
+    // after the writer stopped messages are written at once
+    if(!m_running)
+        flush();
+}
+
+Logger::LogRing *Logger::getRing()
+{
+    LogRing *ring = m_threadRing.get();
+    if(!ring) {
+        ring = new LogRing;
+        m_threadRing.reset(ring);
+        std::lock_guard<std::mutex> lock(m_ringsMutex);
+        m_rings.push_back(ring);
     }
-    if(!tmp.str().empty())
-        outmsg = tmp.str();
-#endif
-    */
+    return ring;
+}
+
+// called when a thread exits, the writer frees the ring once it is drained
+void Logger::closeRing(LogRing *ring)
+{
+    ring->closed = true;
+}
+
+void Logger::writerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_wakeMutex);
+    while(m_running) {
+        m_wakeCondition.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL));
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+void Logger::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
 
-    std::cout << outmsg << std::endl;
+    {
+        std::lock_guard<std::mutex> ringsLock(m_ringsMutex);
+        for(auto it = m_rings.begin(); it != m_rings.end();) {
+            LogRing *ring = *it;
+            // a closed ring gets no more messages, so it can be freed after this drain
+            bool closed = ring->closed;
+            ring->queue.consume_all([this](QueuedMessage *queued) { m_batch.push_back(queued); });
+            if(closed) {
+                delete ring;
+                it = m_rings.erase(it);
+            } else
+                ++it;
+        }
+    }
+
+    // rings are drained one after another, the sequence restores the order of the messages
+    std::sort(m_batch.begin(), m_batch.end(), [](const QueuedMessage *a, const QueuedMessage *b) { return a->sequence < b->sequence; });
+
+    ticks_t now = stdext::millis();
+    for(QueuedMessage *queued : m_batch) {
+        auto it = m_repeatedMessages.find(queued->message);
+        if(it != m_repeatedMessages.end() && queued->level != Fw::LogFatal) {
+            it->second.count++;
+        } else {
+            RepeatedMessage repeated = { now, 0, queued->level };
+            m_repeatedMessages[queued->message] = repeated;
+            write(queued->level, queued->message, queued->when);
+        }
+        delete queued;
+    }
+    m_batch.clear();
 
-    if(m_outFile.good()) {
-        m_outFile << outmsg << std::endl;
+    // counts of messages not seen for a while, or all of them when the writer stopped
+    for(auto it = m_repeatedMessages.begin(); it != m_repeatedMessages.end();) {
+        if(m_running && now - it->second.since < LOG_REPEAT_INTERVAL) {
+            ++it;
+            continue;
+        }
+        if(it->second.count > 0)
+            write(it->second.level, stdext::format("%s (repeated %d times)", it->first, it->second.count), std::time(NULL));
+        it = m_repeatedMessages.erase(it);
+    }
+
+    std::cout.flush();
+    if(m_outFile.good())
         m_outFile.flush();
+}
+
+void Logger::logFromSignal(Fw::LogLevel level, const std::string& message)
+{
+    std::string text = logPrefixes[level] + message;
+
+    std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+    if(!lock.owns_lock()) {
+        std::cout << text << std::endl;
+        return;
     }
 
-    std::size_t now = std::time(NULL);
-    m_logMessages.push_back(LogMessage(level, outmsg, now));
+    // holding the mutex makes this the only reader of the rings, repeats are not folded here
+    std::unique_lock<std::mutex> ringsLock(m_ringsMutex, std::try_to_lock);
+    if(ringsLock.owns_lock()) {
+        for(LogRing *ring : m_rings)
+            ring->queue.consume_all([this](QueuedMessage *queued) { m_batch.push_back(queued); });
+        ringsLock.unlock();
+
+        std::sort(m_batch.begin(), m_batch.end(), [](const QueuedMessage *a, const QueuedMessage *b) { return a->sequence < b->sequence; });
+        for(QueuedMessage *queued : m_batch) {
+            write(queued->level, queued->message, queued->when);
+            delete queued;
+        }
+        m_batch.clear();
+    }
+
+    write(level, text, std::time(NULL));
+    std::cout.flush();
+    if(m_outFile.good())
+        m_outFile.flush();
+}
+
+void Logger::write(Fw::LogLevel level, const std::string& message, std::size_t when)
+{
+    std::cout << message << "\n";
+
+    if(m_outFile.good())
+        m_outFile << message << "\n";
+
+    m_logMessages.push_back(LogMessage(level, message, when));
     if(m_logMessages.size() > MAX_LOG_HISTORY)
         m_logMessages.pop_front();
 
-    if(m_onLog) {
-        // schedule log callback, because this callback can run lua code that may affect the current state
-        g_dispatcher.addEvent([=] {
-            if(m_onLog)
-                m_onLog(level, outmsg, now);
-        });
-    }
+    // the callback can run lua code, so it is called on the main thread by poll
+    if(m_collectCallbacks && m_callbackMessages.size() < MAX_LOG_HISTORY)
+        m_callbackMessages.push_back(LogMessage(level, message, when));
+}
 
-    if(level == Fw::LogFatal) {
-#ifdef FW_GRAPHICS
-        g_window.displayFatalError(message);
-#endif
-        ignoreLogs = true;
-        exit(-1);
+void Logger::poll()
+{
+    std::vector<LogMessage> messages;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        messages.swap(m_callbackMessages);
+    }
+    for(const LogMessage& logMessage : messages) {
+        if(m_onLog)
+            m_onLog(logMessage.level, logMessage.message, logMessage.when);
     }
 }
 
 void Logger::logFunc(Fw::LogLevel level, const std::string& message, std::string prettyFunction)
 {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-
     prettyFunction = prettyFunction.substr(0, prettyFunction.find_first_of('('));
     if(prettyFunction.find_last_of(' ') != std::string::npos)
         prettyFunction = prettyFunction.substr(prettyFunction.find_last_of(' ') + 1);
@@ -119,10 +276,16 @@ void Logger::logFunc(Fw::LogLevel level, const std::string& message, std::string
 
 void Logger::fireOldMessages()
 {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    flush();
 
+    std::list<LogMessage> backup;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        backup = m_logMessages;
+        // already in the history
+        m_callbackMessages.clear();
+    }
     if(m_onLog) {
-        auto backup = m_logMessages;
         for(const LogMessage& logMessage : backup) {
             m_onLog(logMessage.level, logMessage.message, logMessage.when);
         }
@@ -131,7 +294,7 @@ void Logger::fireOldMessages()
 
 void Logger::setLogFile(const std::string& file)
 {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    std::lock_guard<std::mutex> lock(m_mutex);
 
     m_outFile.open(stdext::utf8_to_latin1(file.c_str()).c_str(), std::ios::out | std::ios::app);
     if(!m_outFile.is_open() || !m_outFile.good()) {
@@ -26,7 +26,9 @@
 #include "../global.h"
 
 #include <framework/stdext/thread.h>
+#include <boost/thread/tss.hpp>
 #include <fstream>
+#include <atomic>
 
 struct LogMessage {
     LogMessage(Fw::LogLevel level, const std::string& message, std::size_t when) : level(level), message(message), when(when) { }
@@ -35,16 +37,25 @@ struct LogMessage {
     std::size_t when;
 };
 
+// Messages are queued in a lock-free ring of the logging thread and written in batches by a
+// writer thread, so threads logging at once do not wait for each other or for the console.
+// A message repeated within LOG_REPEAT_INTERVAL is written once, followed by a repeat count.
 // @bindsingleton g_logger
 class Logger
 {
     enum {
-        MAX_LOG_HISTORY = 1000
+        MAX_LOG_HISTORY = 1000,
+        LOG_RING_SIZE = 1024,
+        LOG_FLUSH_INTERVAL = 50, // ms
+        LOG_REPEAT_INTERVAL = 1000 // ms
     };
 
     typedef std::function<void(Fw::LogLevel, const std::string&, int64)> OnLogCallback;
 
 public:
+    Logger();
+    ~Logger();
+
     void log(Fw::LogLevel level, const std::string& message);
     void logFunc(Fw::LogLevel level, const std::string& message, std::string prettyFunction);
 
@@ -56,13 +67,48 @@ public:
 
     void fireOldMessages();
     void setLogFile(const std::string& file);
-    void setOnLog(const OnLogCallback& onLog) { m_onLog = onLog; }
+    void setOnLog(const OnLogCallback& onLog) { m_onLog = onLog; m_collectCallbacks = !!onLog; }
+
+    // calls the log callback for messages written since the last poll, main thread only
+    void poll();
+    // writes every queued message before returning
+    void flush();
+    // for crash handlers: writes the queued messages and then this one without waiting for any lock,
+    // when the crashed thread holds the logger only the console gets the message
+    void logFromSignal(Fw::LogLevel level, const std::string& message);
 
 private:
+    struct QueuedMessage;
+    struct LogRing;
+    struct RepeatedMessage {
+        ticks_t since;
+        int count;
+        Fw::LogLevel level;
+    };
+
+    static void closeRing(LogRing *ring);
+    static boost::thread_specific_ptr<LogRing> m_threadRing;
+    LogRing *getRing();
+    void writerLoop();
+    void write(Fw::LogLevel level, const std::string& message, std::size_t when);
+
     std::list<LogMessage> m_logMessages;
+    std::vector<LogMessage> m_callbackMessages;
+    std::vector<QueuedMessage*> m_batch;
+    std::unordered_map<std::string, RepeatedMessage> m_repeatedMessages;
     OnLogCallback m_onLog;
     std::ofstream m_outFile;
-    std::recursive_mutex m_mutex;
+    std::mutex m_mutex; // writer side: batch, outputs, history
+
+    std::vector<LogRing*> m_rings;
+    std::mutex m_ringsMutex;
+    std::atomic<uint64> m_sequence;
+    std::atomic<bool> m_collectCallbacks;
+    std::atomic<bool> m_ignoreLogs;
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wakeCondition;
 };
 
 extern Logger g_logger;
@@ -31,6 +31,8 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <vector>
+#include <algorithm>
 
 #if defined(_MSC_VER) && _MSC_VER >= 1300
 #define swap16(data) _byteswap_ushort(data)
@@ -71,12 +73,19 @@ int shift2[4]={6,4,2,0};
 int mask1[8]={128,64,32,16,8,4,2,1};
 int shift1[8]={7,6,5,4,3,2,1,0};
 
-unsigned int    keep_original = 1;
-unsigned char   pal[256][3];
-unsigned char   trns[256];
-unsigned int    palsize, trnssize;
-unsigned int    hasTRNS;
-unsigned short  trns1, trns2, trns3;
+// decoder state, kept per thread so images can be decoded by many threads at once
+#if defined(_MSC_VER)
+#define APNG_THREAD_LOCAL __declspec(thread)
+#else
+#define APNG_THREAD_LOCAL __thread
+#endif
+
+APNG_THREAD_LOCAL unsigned int    keep_original = 1;
+APNG_THREAD_LOCAL unsigned char   pal[256][3];
+APNG_THREAD_LOCAL unsigned char   trns[256];
+APNG_THREAD_LOCAL unsigned int    palsize, trnssize;
+APNG_THREAD_LOCAL unsigned int    hasTRNS;
+APNG_THREAD_LOCAL unsigned short  trns1, trns2, trns3;
 
 unsigned int read32(std::istream& f1)
 {
@@ -165,7 +174,8 @@ void read_paeth_row(unsigned char * row, unsigned char * prev_row, unsigned int
     }
 }
 
-void unpack(z_stream zstream, unsigned char * dst, unsigned int dst_size, unsigned char * src, unsigned int src_size, unsigned int h, unsigned int rowbytes, unsigned char bpp)
+// zlib keeps a pointer to the stream in its state, so the stream must not be copied
+void unpack(z_stream& zstream, unsigned char * dst, unsigned int dst_size, unsigned char * src, unsigned int src_size, unsigned int h, unsigned int rowbytes, unsigned char bpp)
 {
     unsigned int    j;
     unsigned char * row = dst;
@@ -508,7 +518,37 @@ void compose6(unsigned char * dst, unsigned int dstbytes, unsigned char * src, u
     }
 }
 
-int load_apng(std::stringstream& file, struct apng_data *apng)
+// reads straight from the buffer, without copying it into a stringstream
+class memory_reader : public std::streambuf
+{
+public:
+    memory_reader(const char *data, size_t size) {
+        char *begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+
+protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) {
+        char *pos = dir == std::ios_base::beg ? eback() : dir == std::ios_base::end ? egptr() : gptr();
+        pos += off;
+        if(pos < eback() || pos > egptr())
+            return pos_type(off_type(-1));
+        setg(eback(), pos, egptr());
+        return pos_type(pos - eback());
+    }
+    pos_type seekpos(pos_type pos, std::ios_base::openmode mode) {
+        return seekoff(off_type(pos), std::ios_base::beg, mode);
+    }
+};
+
+int load_apng(const char *data, size_t size, struct apng_data *apng)
+{
+    memory_reader buffer(data, size);
+    std::istream file(&buffer);
+    return load_apng(file, apng);
+}
+
+int load_apng(std::istream& file, struct apng_data *apng)
 {
     unsigned int    i, j;
     unsigned int    rowbytes;
@@ -917,46 +957,82 @@ void write_IDATs(std::ostream& f, unsigned char* data, unsigned int length, unsi
     }
 }
 
-void save_png(std::stringstream& f, unsigned int width, unsigned int height, int channels, unsigned char *pixels)
+struct png_encoder
 {
-    unsigned int bpp = 4;
-    unsigned char coltype = 0;
+    png_encoder() : initialized(false) { }
+    ~png_encoder() {
+        if(initialized) {
+            deflateEnd(&zstream1);
+            deflateEnd(&zstream2);
+        }
+    }
 
-    if(channels == 3)
-        coltype = 2;
-    else if (channels == 2)
-        coltype = 4;
-    else if (channels == 4)
-        coltype = 6;
+    std::vector<unsigned char> rows;
+    std::vector<unsigned char> zbuf1;
+    std::vector<unsigned char> zbuf2;
+    std::string data;
+    std::string chunk;
+    std::vector<unsigned int> kept;
+    std::vector<unsigned int> keptDelays;
+    z_stream zstream1;
+    z_stream zstream2;
+    bool initialized;
+};
+
+png_encoder* create_png_encoder()
+{
+    return new png_encoder;
+}
 
-    struct IHDR {
-        unsigned int    mWidth;
-        unsigned int    mHeight;
-        unsigned char   mDepth;
-        unsigned char   mColorType;
-        unsigned char   mCompression;
-        unsigned char   mFilterMethod;
-        unsigned char   mInterlaceMethod;
-    } ihdr = { swap32(width), swap32(height), 8, coltype, 0, 0, 0 };
+void free_png_encoder(png_encoder* encoder)
+{
+    delete encoder;
+}
 
-    z_stream        zstream1;
-    z_stream        zstream2;
+// ostream appending to a string, so the string keeps its capacity between images
+class string_appender : public std::streambuf
+{
+public:
+    string_appender(std::string& out) : m_out(out) { }
+
+protected:
+    int_type overflow(int_type c) {
+        if(c != traits_type::eof())
+            m_out.push_back((char)c);
+        return c;
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) {
+        m_out.append(s, n);
+        return n;
+    }
+
+private:
+    std::string& m_out;
+};
+
+// filters the rows and deflates them with two strategies, keeps the smaller zlib stream
+void compress_rows(std::string& out, unsigned int rowbytes, unsigned int height, unsigned int bpp, unsigned char *pixels, png_encoder* encoder)
+{
     unsigned int    i, j;
 
-    unsigned int rowbytes  = width * bpp;
     unsigned int idat_size = (rowbytes + 1) * height;
     unsigned int zbuf_size = idat_size + ((idat_size + 7) >> 3) + ((idat_size + 63) >> 6) + 11;
 
-    unsigned char* row_buf   = (unsigned char*)malloc(rowbytes + 1);
-    unsigned char* sub_row   = (unsigned char*)malloc(rowbytes + 1);
-    unsigned char* up_row    = (unsigned char*)malloc(rowbytes + 1);
-    unsigned char* avg_row   = (unsigned char*)malloc(rowbytes + 1);
-    unsigned char* paeth_row = (unsigned char*)malloc(rowbytes + 1);
-    unsigned char* zbuf1     = (unsigned char*)malloc(zbuf_size);
-    unsigned char* zbuf2     = (unsigned char*)malloc(zbuf_size);
+    // buffers only grow, an encoder reused for images of the same size allocates nothing
+    if(encoder->rows.size() < 5 * (rowbytes + 1))
+        encoder->rows.resize(5 * (rowbytes + 1));
+    if(encoder->zbuf1.size() < zbuf_size) {
+        encoder->zbuf1.resize(zbuf_size);
+        encoder->zbuf2.resize(zbuf_size);
+    }
 
-    if(!row_buf || !sub_row || !up_row || !avg_row || !paeth_row || !zbuf1 || !zbuf2)
-        return;
+    unsigned char* row_buf   = &encoder->rows[0];
+    unsigned char* sub_row   = row_buf + (rowbytes + 1);
+    unsigned char* up_row    = sub_row + (rowbytes + 1);
+    unsigned char* avg_row   = up_row + (rowbytes + 1);
+    unsigned char* paeth_row = avg_row + (rowbytes + 1);
+    unsigned char* zbuf1     = &encoder->zbuf1[0];
+    unsigned char* zbuf2     = &encoder->zbuf2[0];
 
     row_buf[0]   = 0;
     sub_row[0]   = 1;
@@ -964,31 +1040,30 @@ void save_png(std::stringstream& f, unsigned int width, unsigned int height, int
     avg_row[0]   = 3;
     paeth_row[0] = 4;
 
-    zstream1.data_type = Z_BINARY;
-    zstream1.zalloc    = Z_NULL;
-    zstream1.zfree     = Z_NULL;
-    zstream1.opaque    = Z_NULL;
-    deflateInit2(&zstream1, Z_BEST_COMPRESSION, 8, 15, 8, Z_DEFAULT_STRATEGY);
-
-    zstream2.data_type = Z_BINARY;
-    zstream2.zalloc    = Z_NULL;
-    zstream2.zfree     = Z_NULL;
-    zstream2.opaque    = Z_NULL;
-    deflateInit2(&zstream2, Z_BEST_COMPRESSION, 8, 15, 8, Z_FILTERED);
+    z_stream& zstream1 = encoder->zstream1;
+    z_stream& zstream2 = encoder->zstream2;
+    if(!encoder->initialized) {
+        zstream1.data_type = Z_BINARY;
+        zstream1.zalloc    = Z_NULL;
+        zstream1.zfree     = Z_NULL;
+        zstream1.opaque    = Z_NULL;
+        deflateInit2(&zstream1, Z_BEST_COMPRESSION, 8, 15, 8, Z_DEFAULT_STRATEGY);
+
+        zstream2.data_type = Z_BINARY;
+        zstream2.zalloc    = Z_NULL;
+        zstream2.zfree     = Z_NULL;
+        zstream2.opaque    = Z_NULL;
+        deflateInit2(&zstream2, Z_BEST_COMPRESSION, 8, 15, 8, Z_FILTERED);
+        encoder->initialized = true;
+    } else {
+        deflateReset(&zstream1);
+        deflateReset(&zstream2);
+    }
 
     int a, b, c, pa, pb, pc, p, v;
     unsigned char* prev;
     unsigned char* row;
 
-    f.write((char*)png_sign, 8);
-    write_chunk(f, "IHDR", (unsigned char*)(&ihdr), 13);
-
-    if(palsize > 0)
-        write_chunk(f, "PLTE", (unsigned char*)(&pal), palsize * 3);
-
-    if(trnssize > 0)
-        write_chunk(f, "tRNS", trns, trnssize);
-
     zstream1.next_out  = zbuf1;
     zstream1.avail_out = zbuf_size;
     zstream2.next_out  = zbuf2;
@@ -1113,26 +1188,170 @@ void save_png(std::stringstream& f, unsigned int width, unsigned int height, int
     deflate(&zstream2, Z_FINISH);
 
     if(zstream1.total_out <= zstream2.total_out)
-        write_IDATs(f, zbuf1, zstream1.total_out, idat_size);
+        out.assign((char*)zbuf1, zstream1.total_out);
     else
-        write_IDATs(f, zbuf2, zstream2.total_out, idat_size);
+        out.assign((char*)zbuf2, zstream2.total_out);
+}
+
+void write_header(std::ostream& f, unsigned int width, unsigned int height, int channels)
+{
+    unsigned char coltype = 0;
+
+    if(channels == 3)
+        coltype = 2;
+    else if (channels == 2)
+        coltype = 4;
+    else if (channels == 4)
+        coltype = 6;
+
+    struct IHDR {
+        unsigned int    mWidth;
+        unsigned int    mHeight;
+        unsigned char   mDepth;
+        unsigned char   mColorType;
+        unsigned char   mCompression;
+        unsigned char   mFilterMethod;
+        unsigned char   mInterlaceMethod;
+    } ihdr = { swap32(width), swap32(height), 8, coltype, 0, 0, 0 };
+
+    f.write((char*)png_sign, 8);
+    write_chunk(f, "IHDR", (unsigned char*)(&ihdr), 13);
+}
+
+void write_png(std::ostream& f, unsigned int width, unsigned int height, int channels, unsigned char *pixels, png_encoder* encoder)
+{
+    unsigned int bpp = 4;
+    unsigned int rowbytes  = width * bpp;
+    unsigned int idat_size = (rowbytes + 1) * height;
+
+    write_header(f, width, height, channels);
+
+    std::string& data = encoder->data;
+    compress_rows(data, rowbytes, height, bpp, pixels, encoder);
+    if(!data.empty())
+        write_IDATs(f, (unsigned char*)&data[0], data.size(), idat_size);
+
+    write_chunk(f, "IEND", 0, 0);
+}
+
+void save_png(std::stringstream& f, unsigned int width, unsigned int height, int channels, unsigned char *pixels)
+{
+    png_encoder encoder;
+    write_png(f, width, height, channels, pixels, &encoder);
+}
+
+void save_png(std::string& out, unsigned int width, unsigned int height, int channels, unsigned char *pixels, png_encoder* encoder)
+{
+    out.clear();
+    string_appender buffer(out);
+    std::ostream f(&buffer);
+    write_png(f, width, height, channels, pixels, encoder);
+}
+
+void write_fcTL(std::ostream& f, unsigned int& seq, unsigned int width, unsigned int height, unsigned int y, unsigned int delay)
+{
+    unsigned char fctl[26];
+    unsigned int value;
+    unsigned short value16;
+
+    value = swap32(seq); memcpy(fctl, &value, 4);
+    value = swap32(width); memcpy(fctl + 4, &value, 4);
+    value = swap32(height); memcpy(fctl + 8, &value, 4);
+    value = 0; memcpy(fctl + 12, &value, 4); // x offset
+    value = swap32(y); memcpy(fctl + 16, &value, 4);
+    value16 = swap16((unsigned short)delay); memcpy(fctl + 20, &value16, 2);
+    value16 = swap16((unsigned short)1000); memcpy(fctl + 22, &value16, 2);
+    fctl[24] = 0; // APNG_DISPOSE_OP_NONE
+    fctl[25] = 0; // APNG_BLEND_OP_SOURCE
+    write_chunk(f, "fcTL", fctl, 26);
+    seq++;
+}
+
+void write_fdATs(std::ostream& f, unsigned int& seq, unsigned char* data, unsigned int length, std::string& chunk)
+{
+    while(length > 0) {
+        unsigned int ds = std::min<unsigned int>(length, PNG_ZBUF_SIZE);
+        unsigned int value = swap32(seq);
+        chunk.assign((char*)&value, 4);
+        chunk.append((char*)data, ds);
+        write_chunk(f, "fdAT", (unsigned char*)&chunk[0], chunk.size());
+        seq++;
+        data += ds;
+        length -= ds;
+    }
+}
+
+void write_apng(std::ostream& f, unsigned int width, unsigned int height, int channels, unsigned char **frames, unsigned int *delays, unsigned int num_frames, png_encoder* encoder)
+{
+    unsigned int bpp = 4;
+    unsigned int rowbytes = width * bpp;
+
+    // frames equal to the previous one only extend its delay
+    std::vector<unsigned int>& kept = encoder->kept;
+    std::vector<unsigned int>& keptDelays = encoder->keptDelays;
+    kept.clear();
+    keptDelays.clear();
+    for(unsigned int n = 0; n < num_frames; n++) {
+        if(!kept.empty() && memcmp(frames[kept.back()], frames[n], rowbytes * height) == 0)
+            keptDelays.back() += delays[n];
+        else {
+            kept.push_back(n);
+            keptDelays.push_back(delays[n]);
+        }
+    }
 
-    deflateReset(&zstream1);
-    zstream1.data_type = Z_BINARY;
-    deflateReset(&zstream2);
-    zstream2.data_type = Z_BINARY;
+    if(kept.size() < 2) {
+        write_png(f, width, height, channels, frames[0], encoder);
+        return;
+    }
+
+    write_header(f, width, height, channels);
+
+    struct acTL {
+        unsigned int    mNumFrames;
+        unsigned int    mNumPlays;
+    } actl = { swap32((unsigned int)kept.size()), 0 };
+    write_chunk(f, "acTL", (unsigned char*)(&actl), 8);
+
+    unsigned int seq = 0;
+    std::string& data = encoder->data;
+    for(unsigned int k = 0; k < kept.size(); k++) {
+        unsigned char* frame = frames[kept[k]];
+        unsigned int first = 0;
+        unsigned int last = height - 1;
+
+        // only the band of rows that changed since the previous frame is stored
+        if(k > 0) {
+            unsigned char* prev = frames[kept[k - 1]];
+            while(first < last && memcmp(frame + first * rowbytes, prev + first * rowbytes, rowbytes) == 0)
+                first++;
+            while(last > first && memcmp(frame + last * rowbytes, prev + last * rowbytes, rowbytes) == 0)
+                last--;
+        }
+
+        write_fcTL(f, seq, width, last - first + 1, first, std::min<unsigned int>(keptDelays[k], 65535));
+        compress_rows(data, rowbytes, last - first + 1, bpp, frame + first * rowbytes, encoder);
+        if(k == 0)
+            write_IDATs(f, (unsigned char*)&data[0], data.size(), (rowbytes + 1) * height);
+        else
+            write_fdATs(f, seq, (unsigned char*)&data[0], data.size(), encoder->chunk);
+    }
 
     write_chunk(f, "IEND", 0, 0);
+}
 
-    deflateEnd(&zstream1);
-    deflateEnd(&zstream2);
-    free(zbuf1);
-    free(zbuf2);
-    free(row_buf);
-    free(sub_row);
-    free(up_row);
-    free(avg_row);
-    free(paeth_row);
+void save_apng(std::stringstream& f, unsigned int width, unsigned int height, int channels, unsigned char **frames, unsigned int *delays, unsigned int num_frames)
+{
+    png_encoder encoder;
+    write_apng(f, width, height, channels, frames, delays, num_frames, &encoder);
+}
+
+void save_apng(std::string& out, unsigned int width, unsigned int height, int channels, unsigned char **frames, unsigned int *delays, unsigned int num_frames, png_encoder* encoder)
+{
+    out.clear();
+    string_appender buffer(out);
+    std::ostream f(&buffer);
+    write_apng(f, width, height, channels, frames, delays, num_frames, encoder);
 }
 
 void free_apng(struct apng_data *apng)
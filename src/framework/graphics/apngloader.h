@@ -39,8 +39,19 @@ struct apng_data {
 };
 
 // returns -1 on error, 0 on success
-int load_apng(std::stringstream& file, struct apng_data *apng);
+int load_apng(std::istream& file, struct apng_data *apng);
+int load_apng(const char *data, size_t size, struct apng_data *apng);
 void save_png(std::stringstream& file, unsigned int width, unsigned int height, int channels, unsigned char *pixels);
+// buffers and deflate streams kept between images, not thread safe
+struct png_encoder;
+png_encoder* create_png_encoder();
+void free_png_encoder(png_encoder* encoder);
+// replaces the contents of out, encoding images of one size again allocates nothing
+void save_png(std::string& out, unsigned int width, unsigned int height, int channels, unsigned char *pixels, png_encoder* encoder);
+// frames are rgba pixel buffers of the same size, delays in milliseconds
+void save_apng(std::stringstream& file, unsigned int width, unsigned int height, int channels, unsigned char **frames, unsigned int *delays, unsigned int num_frames);
+// same as save_png with an encoder, the frame lists are kept in the encoder too
+void save_apng(std::string& out, unsigned int width, unsigned int height, int channels, unsigned char **frames, unsigned int *delays, unsigned int num_frames, png_encoder* encoder);
 void free_apng(struct apng_data *apng);
 
 #endif
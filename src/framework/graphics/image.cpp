@@ -25,6 +25,7 @@
 
 #include <framework/core/resourcemanager.h>
 #include <framework/core/filestream.h>
+#include <framework/core/asyncdispatcher.h>
 #include <framework/graphics/apngloader.h>
 
 Image::Image(const Size& size, int bpp, uint8 *pixels)
@@ -51,13 +52,24 @@ ImagePtr Image::load(std::string file)
     return image;
 }
 
+std::vector<ImagePtr> Image::loadMany(const std::vector<std::string>& files)
+{
+    std::vector<boost::shared_future<ImagePtr>> decoded;
+    for(const std::string& file : files)
+        decoded.push_back(g_asyncDispatcher.schedule([file]() { return load(file); }));
+
+    std::vector<ImagePtr> images;
+    for(boost::shared_future<ImagePtr>& image : decoded)
+        images.push_back(image.get());
+    return images;
+}
+
 ImagePtr Image::loadPNG(const std::string& file)
 {
-    std::stringstream fin;
-    g_resources.readFileStream(file, fin);
+    std::string data = g_resources.readFileContents(file);
     ImagePtr image;
     apng_data apng;
-    if(load_apng(fin, &apng) == 0) {
+    if(load_apng(data.data(), data.size(), &apng) == 0) {
         image = ImagePtr(new Image(Size(apng.width, apng.height), apng.bpp, apng.pdata));
         free_apng(&apng);
     }
@@ -66,7 +78,8 @@ ImagePtr Image::loadPNG(const std::string& file)
 
 void Image::savePNG(const std::string& fileName)
 {
-    if(!blited)
+    std::stringstream data;
+    if(!encodePNG(data))
     {
         // empty image
         return;
@@ -76,8 +89,71 @@ void Image::savePNG(const std::string& fileName)
         stdext::throw_exception(stdext::format("failed to open file '%s' for write", fileName));
 
     fin->cache();
-    std::stringstream data;
+    fin->write(data.str().c_str(), data.str().length());
+    fin->flush();
+    fin->close();
+}
+
+bool Image::encodePNG(std::stringstream& data)
+{
+    if(!blited)
+        return false;
     save_png(data, m_size.width(), m_size.height(), 4, (unsigned char*)getPixelData());
+    return true;
+}
+
+bool Image::encodePNG(std::string& data, png_encoder *encoder)
+{
+    if(!blited)
+        return false;
+    save_png(data, m_size.width(), m_size.height(), 4, (unsigned char*)getPixelData(), encoder);
+    return true;
+}
+
+bool Image::encodeAPNG(std::stringstream& data, const std::vector<ImagePtr>& frames, const std::vector<int>& delays)
+{
+    // empty when nothing is drawn in any frame
+    Size size;
+    bool anyBlited = false;
+    for(const ImagePtr& frame : frames) {
+        size = size.expandedTo(frame->getSize());
+        anyBlited = anyBlited || frame->blited;
+    }
+    if(!anyBlited || size.width() <= 0 || size.height() <= 0)
+        return false;
+
+    // smaller frames are pasted into transparent frames of the biggest size
+    std::vector<ImagePtr> padded;
+    std::vector<unsigned char*> pixels;
+    std::vector<unsigned int> frameDelays;
+    for(uint i = 0; i < frames.size(); ++i) {
+        ImagePtr frame = frames[i];
+        if(frame->getSize() != size) {
+            ImagePtr canvas(new Image(size));
+            canvas->paste(frame);
+            padded.push_back(canvas);
+            frame = canvas;
+        }
+        pixels.push_back(frame->getPixelData());
+        frameDelays.push_back(delays[i]);
+    }
+    save_apng(data, size.width(), size.height(), 4, &pixels[0], &frameDelays[0], pixels.size());
+    return true;
+}
+
+void Image::saveAPNG(const std::string& fileName, const std::vector<ImagePtr>& frames, const std::vector<int>& delays)
+{
+    std::stringstream data;
+    if(!encodeAPNG(data, frames, delays))
+    {
+        // empty image
+        return;
+    }
+    FileStreamPtr fin = g_resources.createFile(fileName);
+    if(!fin)
+        stdext::throw_exception(stdext::format("failed to open file '%s' for write", fileName));
+
+    fin->cache();
     fin->write(data.str().c_str(), data.str().length());
     fin->flush();
     fin->close();
@@ -85,13 +161,14 @@ void Image::savePNG(const std::string& fileName)
 
 void Image::cut()
 {
+    int width = std::max<int>(m_size.width() - 64, 0);
+    int height = std::max<int>(m_size.height() - 64, 0);
     if(!blited)
     {
-        // empty image
+        // empty image, cut to the same size as drawn ones so animation frames match
+        clear(Size(width, height));
         return;
     }
-    int width = m_size.width() - 64;
-    int height = m_size.height() - 64;
     //std::vector<uint8> pixels;
     //pixels.resize(width * height * m_bpp, 0);
     for(int y = 0; y  < height; y++)
@@ -26,6 +26,8 @@
 #include "declarations.h"
 #include <framework/util/databuffer.h>
 
+struct png_encoder;
+
 class Image : public stdext::shared_object
 {
 public:
@@ -33,14 +35,25 @@ public:
 
     static ImagePtr load(std::string file);
     static ImagePtr loadPNG(const std::string& file);
+    // decodes the files on the async dispatcher threads at once, results are in the order of files
+    // and null for files that failed to load
+    static std::vector<ImagePtr> loadMany(const std::vector<std::string>& files);
 
     void savePNG(const std::string& fileName);
+    bool encodePNG(std::stringstream& data);
+    // replaces the contents of data, buffers of the encoder are reused
+    bool encodePNG(std::string& data, png_encoder *encoder);
+    // delays are in milliseconds, frames smaller than the biggest one are padded at the right and bottom
+    static bool encodeAPNG(std::stringstream& data, const std::vector<ImagePtr>& frames, const std::vector<int>& delays);
+    static void saveAPNG(const std::string& fileName, const std::vector<ImagePtr>& frames, const std::vector<int>& delays);
     void cut();
 
     void overwriteMask(const Color& maskedColor, const Color& insideColor = Color::white, const Color& outsideColor = Color::alpha);
     void blit(const Point& dest, const ImagePtr& other);
     void paste(const ImagePtr& other);
     void resize(const Size& size) { m_size = size; m_pixels.resize(size.area() * m_bpp, 0); }
+    // transparent image of the given size, the pixel buffer is reused when it is big enough
+    void clear(const Size& size) { m_size = size; m_pixels.assign(size.area() * m_bpp, 0); blited = false; }
     bool nextMipmap();
 
     void setPixel(int x, int y, uint8 *pixel) { memcpy(&m_pixels[(y * m_size.width() + x) * m_bpp], pixel, m_bpp);}
@@ -54,6 +67,7 @@ public:
     int getHeight() { return m_size.height(); }
     int getBpp() { return m_bpp; }
     uint8* getPixel(int x, int y) { return &m_pixels[(y * m_size.width() + x) * m_bpp]; }
+    bool isBlited() { return blited; }
 
 private:
     bool blited;
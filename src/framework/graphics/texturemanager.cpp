@@ -28,6 +28,7 @@
 #include <framework/core/resourcemanager.h>
 #include <framework/core/clock.h>
 #include <framework/core/eventdispatcher.h>
+#include <framework/core/asyncdispatcher.h>
 #include <framework/graphics/apngloader.h>
 
 TextureManager g_textures;
@@ -43,6 +44,7 @@ void TextureManager::terminate()
         m_liveReloadEvent->cancel();
         m_liveReloadEvent = nullptr;
     }
+    m_decoding.clear();
     m_textures.clear();
     m_animatedTextures.clear();
     m_emptyTexture = nullptr;
@@ -50,6 +52,17 @@ void TextureManager::terminate()
 
 void TextureManager::poll()
 {
+    for(auto it = m_decoding.begin(); it != m_decoding.end();) {
+        if(!it->second.is_ready()) {
+            ++it;
+            continue;
+        }
+        std::string filePath = it->first;
+        DecodedTexturePtr decoded = it->second.get();
+        it = m_decoding.erase(it);
+        m_textures[filePath] = createTexture(filePath, decoded);
+    }
+
     // update only every 16msec, this allows upto 60 fps for animated textures
     static ticks_t lastUpdate = 0;
     ticks_t now = g_clock.millis();
@@ -63,6 +76,7 @@ void TextureManager::poll()
 
 void TextureManager::clearCache()
 {
+    m_decoding.clear();
     m_animatedTextures.clear();
     m_textures.clear();
 }
@@ -87,6 +101,16 @@ void TextureManager::liveReload()
     }, 1000);
 }
 
+void TextureManager::preloadAsync(const std::vector<std::string>& fileNames)
+{
+    for(const std::string& fileName : fileNames) {
+        std::string filePath = g_resources.resolvePath(fileName);
+        if(m_textures.find(filePath) != m_textures.end() || m_decoding.find(filePath) != m_decoding.end())
+            continue;
+        m_decoding[filePath] = g_asyncDispatcher.schedule([filePath]() { return decodeTexture(filePath); });
+    }
+}
+
 TexturePtr TextureManager::getTexture(const std::string& fileName)
 {
     TexturePtr texture;
@@ -100,56 +124,66 @@ TexturePtr TextureManager::getTexture(const std::string& fileName)
         texture = it->second;
     }
 
-    // texture not found, load it
+    // texture not found, load it or finish its preload
     if(!texture) {
-        try {
-            std::string filePathEx = g_resources.guessFilePath(filePath, "png");
-
-            // load texture file data
-            std::stringstream fin;
-            g_resources.readFileStream(filePathEx, fin);
-            texture = loadTexture(fin);
-        } catch(stdext::exception& e) {
-            g_logger.error(stdext::format("Unable to load texture '%s': %s", fileName, e.what()));
-            texture = g_textures.getEmptyTexture();
-        }
-
-        if(texture) {
-            texture->setTime(stdext::time());
-            texture->setSmooth(true);
-            m_textures[filePath] = texture;
-        }
+        DecodedTexturePtr decoded;
+        auto decoding = m_decoding.find(filePath);
+        if(decoding != m_decoding.end()) {
+            decoded = decoding->second.get();
+            m_decoding.erase(decoding);
+        } else
+            decoded = decodeTexture(filePath);
+
+        texture = createTexture(fileName, decoded);
+        m_textures[filePath] = texture;
     }
 
     return texture;
 }
 
-TexturePtr TextureManager::loadTexture(std::stringstream& file)
+// runs on any thread, reads and decodes the file without touching the graphics context
+TextureManager::DecodedTexturePtr TextureManager::decodeTexture(const std::string& filePath)
 {
-    TexturePtr texture;
+    DecodedTexturePtr decoded(new DecodedTexture);
+    try {
+        std::string filePathEx = g_resources.guessFilePath(filePath, "png");
+
+        // load texture file data
+        std::string data = g_resources.readFileContents(filePathEx);
+        apng_data apng;
+        if(load_apng(data.data(), data.size(), &apng) != 0)
+            stdext::throw_exception("invalid png");
 
-    apng_data apng;
-    if(load_apng(file, &apng) == 0) {
         Size imageSize(apng.width, apng.height);
         if(apng.num_frames > 1) { // animated texture
-            std::vector<ImagePtr> frames;
-            std::vector<int> framesDelay;
             for(uint i=0;i<apng.num_frames;++i) {
                 uchar *frameData = apng.pdata + ((apng.first_frame+i) * imageSize.area() * apng.bpp);
-                int frameDelay = apng.frames_delay[i];
-
-                framesDelay.push_back(frameDelay);
-                frames.push_back(ImagePtr(new Image(imageSize, apng.bpp, frameData)));
+                decoded->framesDelay.push_back(apng.frames_delay[i]);
+                decoded->frames.push_back(ImagePtr(new Image(imageSize, apng.bpp, frameData)));
             }
-            AnimatedTexturePtr animatedTexture = new AnimatedTexture(imageSize, frames, framesDelay);
-            m_animatedTextures.push_back(animatedTexture);
-            texture = animatedTexture;
-        } else {
-            ImagePtr image = ImagePtr(new Image(imageSize, apng.bpp, apng.pdata));
-            texture = TexturePtr(new Texture(image));
-        }
+        } else
+            decoded->frames.push_back(ImagePtr(new Image(imageSize, apng.bpp, apng.pdata)));
         free_apng(&apng);
+    } catch(stdext::exception& e) {
+        decoded->error = e.what();
     }
+    return decoded;
+}
 
+TexturePtr TextureManager::createTexture(const std::string& fileName, const DecodedTexturePtr& decoded)
+{
+    TexturePtr texture;
+    if(!decoded->error.empty()) {
+        g_logger.error(stdext::format("Unable to load texture '%s': %s", fileName, decoded->error));
+        texture = g_textures.getEmptyTexture();
+    } else if(decoded->frames.size() > 1) {
+        AnimatedTexturePtr animatedTexture = new AnimatedTexture(decoded->frames[0]->getSize(), decoded->frames, decoded->framesDelay);
+        m_animatedTextures.push_back(animatedTexture);
+        texture = animatedTexture;
+    } else
+        texture = TexturePtr(new Texture(decoded->frames[0]));
+
+    texture->setTime(stdext::time());
+    texture->setSmooth(true);
     return texture;
 }
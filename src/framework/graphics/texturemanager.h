@@ -37,13 +37,25 @@ public:
     void liveReload();
 
     void preload(const std::string& fileName) { getTexture(fileName); }
+    // decodes the files on the async dispatcher threads, textures are uploaded on the main thread
+    // by poll or by the first getTexture of a file
+    void preloadAsync(const std::vector<std::string>& fileNames);
     TexturePtr getTexture(const std::string& fileName);
     const TexturePtr& getEmptyTexture() { return m_emptyTexture; }
 
 private:
-    TexturePtr loadTexture(std::stringstream& file);
+    struct DecodedTexture {
+        std::vector<ImagePtr> frames;
+        std::vector<int> framesDelay;
+        std::string error;
+    };
+    typedef std::shared_ptr<DecodedTexture> DecodedTexturePtr;
+
+    static DecodedTexturePtr decodeTexture(const std::string& filePath);
+    TexturePtr createTexture(const std::string& fileName, const DecodedTexturePtr& decoded);
 
     std::unordered_map<std::string, TexturePtr> m_textures;
+    std::unordered_map<std::string, boost::shared_future<DecodedTexturePtr>> m_decoding;
     std::vector<AnimatedTexturePtr> m_animatedTextures;
     TexturePtr m_emptyTexture;
     ScheduledEventPtr m_liveReloadEvent;
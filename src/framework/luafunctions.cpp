@@ -322,6 +322,7 @@ void Application::registerLuaFunctions()
     // Textures
     g_lua.registerSingletonClass("g_textures");
     g_lua.bindSingletonFunction("g_textures", "preload", &TextureManager::preload, &g_textures);
+    g_lua.bindSingletonFunction("g_textures", "preloadAsync", &TextureManager::preloadAsync, &g_textures);
     g_lua.bindSingletonFunction("g_textures", "clearCache", &TextureManager::clearCache, &g_textures);
     g_lua.bindSingletonFunction("g_textures", "liveReload", &TextureManager::liveReload, &g_textures);
 
@@ -756,6 +757,7 @@ void Application::registerLuaFunctions()
     // Server
     g_lua.registerClass<Server>();
     g_lua.bindClassStaticFunction<Server>("create", &Server::create);
+    g_lua.bindClassStaticFunction<Server>("createLocal", &Server::createLocal);
     g_lua.bindClassMemberFunction<Server>("close", &Server::close);
     g_lua.bindClassMemberFunction<Server>("isOpen", &Server::isOpen);
     g_lua.bindClassMemberFunction<Server>("acceptNext", &Server::acceptNext);
@@ -25,15 +25,26 @@
 
 extern asio::io_service g_ioService;
 
-Server::Server(int port)
-    : m_acceptor(g_ioService, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
+Server::Server(int port, bool localOnly)
+    : m_acceptor(g_ioService, localOnly ? asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port)
+                                        : asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
 {
 }
 
 ServerPtr Server::create(int port)
+{
+    return open(port, false);
+}
+
+ServerPtr Server::createLocal(int port)
+{
+    return open(port, true);
+}
+
+ServerPtr Server::open(int port, bool localOnly)
 {
     try {
-        Server *server = new Server(port);
+        Server *server = new Server(port, localOnly);
         return ServerPtr(server);
     }
     catch(const std::exception& e) {
@@ -59,6 +70,11 @@ void Server::acceptNext()
             connection->m_connected = true;
             connection->m_connecting = false;
         }
+        if(self->m_acceptCallback) {
+            if(error != asio::error::operation_aborted)
+                self->m_acceptCallback(error ? ConnectionPtr() : connection);
+            return;
+        }
         self->callLuaField("onAccept", connection, error.message(), error.value());
     });
 }
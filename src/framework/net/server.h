@@ -29,15 +29,24 @@
 class Server : public LuaObject
 {
 public:
-    Server(int port);
+    typedef std::function<void(const ConnectionPtr&)> AcceptCallback;
+
+    Server(int port, bool localOnly = false);
     static ServerPtr create(int port);
+    // accepts connections from this machine only
+    static ServerPtr createLocal(int port);
     bool isOpen() { return m_isOpen; }
     void close();
 
     void acceptNext();
+    // accepted connections are passed to the callback instead of lua onAccept
+    void setAcceptCallback(const AcceptCallback& callback) { m_acceptCallback = callback; }
 
 private:
+    static ServerPtr open(int port, bool localOnly);
+
     stdext::boolean<true> m_isOpen;
+    AcceptCallback m_acceptCallback;
     asio::ip::tcp::acceptor m_acceptor;
 };
 
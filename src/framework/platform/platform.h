@@ -40,10 +40,21 @@ public:
     bool copyFile(std::string from, std::string to);
     bool fileExists(std::string file);
     bool removeFile(std::string file);
+    // flushes written data of the file to the disk
+    bool syncFile(std::string file);
     ticks_t getFileModificationTime(std::string file);
     void openUrl(std::string url);
     std::string getCPUName();
     double getTotalSystemMemory();
+    double getPeakMemoryUsage();
+    // pins the calling thread to one cpu
+    bool setThreadAffinity(int cpu);
+    // cpu running the calling thread, -1 when unknown
+    int getCurrentCpu();
+    // numa node of the cpu, 0 when unknown
+    int getCpuNode(int cpu);
+    // cpus the process may run on, empty when unknown
+    std::vector<int> getProcessCpus();
     std::string getOSName();
     std::string traceback(const std::string& where, int level = 1, int maxDepth = 32);
 };
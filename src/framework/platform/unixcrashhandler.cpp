@@ -38,7 +38,7 @@
 
 void crashHandler(int signum, siginfo_t* info, void* secret)
 {
-    g_logger.error("Application crashed");
+    g_logger.logFromSignal(Fw::LogError, "Application crashed");
 
     std::stringstream ss;
     ss << stdext::format("app name: %s\n", g_app.getName());
@@ -102,7 +102,7 @@ void crashHandler(int signum, siginfo_t* info, void* secret)
         free(tracebackBuffer);
     }
 
-    g_logger.info(ss.str());
+    g_logger.logFromSignal(Fw::LogInfo, ss.str());
 
     std::string fileName = "crash_report.log";
     std::ofstream fout(fileName.c_str(), std::ios::out | std::ios::app);
@@ -111,9 +111,9 @@ void crashHandler(int signum, siginfo_t* info, void* secret)
         fout << ss.str();
         fout << "\n";
         fout.close();
-        g_logger.info(stdext::format("Crash report saved to file %s", fileName));
+        g_logger.logFromSignal(Fw::LogInfo, stdext::format("Crash report saved to file %s", fileName));
     } else
-        g_logger.error("Failed to save crash report!");
+        g_logger.logFromSignal(Fw::LogError, "Failed to save crash report!");
 
     signal(SIGILL, SIG_DFL);
     signal(SIGSEGV, SIG_DFL);
@@ -29,7 +29,11 @@
 #include <framework/stdext/stdext.h>
 
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/resource.h>
 #include <execinfo.h>
+#include <pthread.h>
+#include <sched.h>
 
 void Platform::processArgs(std::vector<std::string>& args)
 {
@@ -109,6 +113,16 @@ bool Platform::removeFile(std::string file)
     return false;
 }
 
+bool Platform::syncFile(std::string file)
+{
+    int fd = open(file.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    bool ret = fsync(fd) == 0;
+    close(fd);
+    return ret;
+}
+
 ticks_t Platform::getFileModificationTime(std::string file)
 {
     struct stat attrib;
@@ -156,6 +170,66 @@ double Platform::getTotalSystemMemory()
     return 0;
 }
 
+double Platform::getPeakMemoryUsage()
+{
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024.0;
+#endif
+}
+
+bool Platform::setThreadAffinity(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+int Platform::getCurrentCpu()
+{
+#ifdef __linux__
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+int Platform::getCpuNode(int cpu)
+{
+    // the kernel links the node of every cpu into its sysfs directory
+    for(int node = 0; node < 64; ++node) {
+        if(fileExists(stdext::format("/sys/devices/system/cpu/cpu%d/node%d", cpu, node)))
+            return node;
+    }
+    return 0;
+}
+
+std::vector<int> Platform::getProcessCpus()
+{
+    std::vector<int> cpus;
+#ifdef __linux__
+    // the mask of the process, threads pinned earlier do not narrow it
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(getpid(), sizeof(set), &set) == 0) {
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if(CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+    }
+#endif
+    return cpus;
+}
+
 std::string Platform::getOSName()
 {
     std::string line;
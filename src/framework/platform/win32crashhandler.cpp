@@ -139,7 +139,7 @@ LONG CALLBACK ExceptionHandler(LPEXCEPTION_POINTERS e)
     SymCleanup(GetCurrentProcess());
 
     // print in stdout
-    g_logger.info(ss.str());
+    g_logger.logFromSignal(Fw::LogInfo, ss.str());
 
     // write stacktrace to crashreport.log
     char dir[MAX_PATH];
@@ -149,9 +149,9 @@ LONG CALLBACK ExceptionHandler(LPEXCEPTION_POINTERS e)
     if(fout.is_open() && fout.good()) {
         fout << ss.str();
         fout.close();
-        g_logger.info(stdext::format("Crash report saved to file %s", fileName));
+        g_logger.logFromSignal(Fw::LogInfo, stdext::format("Crash report saved to file %s", fileName));
     } else
-        g_logger.error("Failed to save crash report!");
+        g_logger.logFromSignal(Fw::LogError, "Failed to save crash report!");
 
     // inform the user
     std::string msg = stdext::format(
@@ -25,6 +25,7 @@
 #include "platform.h"
 #include <winsock2.h>
 #include <windows.h>
+#include <psapi.h>
 #include <framework/stdext/stdext.h>
 #include <boost/algorithm/string.hpp>
 #include <tchar.h>
@@ -133,6 +134,17 @@ bool Platform::removeFile(std::string file)
     return true;
 }
 
+bool Platform::syncFile(std::string file)
+{
+    boost::replace_all(file, "/", "\\");
+    HANDLE handle = CreateFileW(stdext::utf8_to_utf16(file).c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(handle == INVALID_HANDLE_VALUE)
+        return false;
+    bool ret = FlushFileBuffers(handle) != 0;
+    CloseHandle(handle);
+    return ret;
+}
+
 ticks_t Platform::getFileModificationTime(std::string file)
 {
     boost::replace_all(file, "/", "\\");
@@ -173,6 +185,14 @@ double Platform::getTotalSystemMemory()
     return status.ullTotalPhys;
 }
 
+double Platform::getPeakMemoryUsage()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+}
+
 #ifndef PRODUCT_PROFESSIONAL
 #define PRODUCT_PROFESSIONAL    0x00000030
 #define VER_SUITE_WH_SERVER     0x00008000
@@ -232,6 +252,39 @@ double Platform::getTotalSystemMemory()
 #define PRODUCT_SB_SOLUTION_SERVER                  0x00000032
 #endif
 
+bool Platform::setThreadAffinity(int cpu)
+{
+    if(cpu >= (int)sizeof(DWORD_PTR) * 8)
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+}
+
+int Platform::getCurrentCpu()
+{
+    return GetCurrentProcessorNumber();
+}
+
+int Platform::getCpuNode(int cpu)
+{
+    UCHAR node;
+    if(cpu > 255 || !GetNumaProcessorNode((UCHAR)cpu, &node))
+        return 0;
+    return node;
+}
+
+std::vector<int> Platform::getProcessCpus()
+{
+    std::vector<int> cpus;
+    DWORD_PTR processMask, systemMask;
+    if(GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+        for(int cpu = 0; cpu < (int)sizeof(DWORD_PTR) * 8; ++cpu) {
+            if(processMask & ((DWORD_PTR)1 << cpu))
+                cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
 std::string Platform::getOSName()
 {
     typedef void (WINAPI *PGNSI)(LPSYSTEM_INFO);
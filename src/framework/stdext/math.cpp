@@ -45,6 +45,26 @@ uint32_t adler32(const uint8_t *buffer, size_t size) {
     return (b << 16) | a;
 }
 
+uint64_t hilbert_index(uint32_t x, uint32_t y, int bits)
+{
+    uint32_t n = 1u << bits;
+    uint64_t d = 0;
+    for(uint32_t s = n / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) ? 1 : 0;
+        uint32_t ry = (y & s) ? 1 : 0;
+        d += (uint64_t)s * s * ((3 * rx) ^ ry);
+        // rotate the quadrant, so the curve continues where the previous one ended
+        if(ry == 0) {
+            if(rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
 long random_range(long min, long max)
 {
     static std::random_device rd;
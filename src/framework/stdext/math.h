@@ -49,6 +49,10 @@ inline void writeSLE64(uchar *addr, int64_t value) { writeSLE32(addr + 4, value
 
 uint32_t adler32(const uint8_t *buffer, size_t size);
 
+// position of (x, y) on the hilbert curve filling a 2^bits x 2^bits square, consecutive
+// positions are always neighbours
+uint64_t hilbert_index(uint32_t x, uint32_t y, int bits = 16);
+
 long random_range(long min, long max);
 float random_range(float min, float max);
 
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef STDEXT_SMALLVECTOR_H
+#define STDEXT_SMALLVECTOR_H
+
+#include "exception.h"
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace stdext {
+
+// packed_vector with room for N elements inside of the object itself. Storage only
+// goes to the heap when more elements are added, growing geometrically, and
+// elements are moved instead of copied when shifted or reallocated.
+template<class T, int N, class U = uint8_t>
+class small_vector
+{
+public:
+    typedef U                                        size_type;
+    typedef T*                                       iterator;
+    typedef const T*                                 const_iterator;
+    typedef std::reverse_iterator<iterator>          reverse_iterator;
+    typedef std::reverse_iterator<const_iterator>    const_reverse_iterator;
+
+    small_vector() : m_data(inlineData()), m_size(0), m_capacity(N) { }
+    small_vector(const small_vector& other) : m_data(inlineData()), m_size(0), m_capacity(N) { assign(other); }
+    small_vector(small_vector&& other) : m_data(inlineData()), m_size(0), m_capacity(N) { take(other); }
+    ~small_vector() { clear(); release(); }
+
+    small_vector& operator=(const small_vector& other) { if(this != &other) { clear(); assign(other); } return *this; }
+    small_vector& operator=(small_vector&& other) { if(this != &other) { clear(); release(); take(other); } return *this; }
+
+    iterator begin() { return m_data; }
+    const_iterator begin() const { return m_data; }
+    const_iterator cbegin() const { return m_data; }
+    iterator end() { return m_data + m_size; }
+    const_iterator end() const { return m_data + m_size; }
+    const_iterator cend() const { return m_data + m_size; }
+
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator crbegin() const { return const_reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+    const_reverse_iterator crend() const { return const_reverse_iterator(begin()); }
+
+    size_type size() const { return m_size; }
+    size_type capacity() const { return m_capacity; }
+    bool empty() const { return m_size == 0; }
+
+    T& operator[](size_type i) { return m_data[i]; }
+    const T& operator[](size_type i) const { return m_data[i]; }
+    T& at(size_type i) { return m_data[i]; }
+    const T& at(size_type i) const { return m_data[i]; }
+
+    T& front() { return m_data[0]; }
+    const T& front() const { return m_data[0]; }
+    T& back() { return m_data[m_size-1]; }
+    const T& back() const { return m_data[m_size-1]; }
+
+    T *data() { return m_data; }
+    const T *data() const { return m_data; }
+
+    // keeps the storage, like std::vector
+    void clear() {
+        for(size_type i = 0; i < m_size; ++i)
+            m_data[i].~T();
+        m_size = 0;
+    }
+
+    // keeps the first elements, like std::vector
+    void resize(size_type size) {
+        while(m_size > size)
+            m_data[--m_size].~T();
+        reserve(size);
+        for(; m_size < size; ++m_size)
+            new(m_data + m_size) T();
+    }
+
+    // size_type can not count more elements than its maximum
+    void reserve(size_t size) {
+        if(size <= m_capacity)
+            return;
+        if(size > std::numeric_limits<U>::max())
+            throw_exception("small_vector size limit exceeded");
+
+        size_t capacity = std::min<size_t>(std::max<size_t>(size, m_capacity * 2), std::numeric_limits<U>::max());
+        T *data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+        for(size_type i = 0; i < m_size; ++i) {
+            new(data + i) T(std::move(m_data[i]));
+            m_data[i].~T();
+        }
+        release();
+        m_data = data;
+        m_capacity = capacity;
+    }
+
+    void push_back(const T& x) { T value(x); push_back(std::move(value)); }
+    void push_back(T&& x) {
+        reserve(m_size + 1);
+        new(m_data + m_size) T(std::move(x));
+        m_size++;
+    }
+
+    void pop_back() { m_data[--m_size].~T(); }
+
+    iterator insert(const_iterator position, const T& x) {
+        size_type i = position - m_data;
+        // x may be an element of this vector
+        T value(x);
+        reserve(m_size + 1);
+        if(i == m_size)
+            new(m_data + m_size) T(std::move(value));
+        else {
+            new(m_data + m_size) T(std::move(m_data[m_size - 1]));
+            std::move_backward(m_data + i, m_data + m_size - 1, m_data + m_size);
+            m_data[i] = std::move(value);
+        }
+        m_size++;
+        return m_data + i;
+    }
+
+    iterator erase(const_iterator position) {
+        size_type i = position - m_data;
+        std::move(m_data + i + 1, m_data + m_size, m_data + i);
+        m_data[--m_size].~T();
+        return m_data + i;
+    }
+
+    void swap(small_vector& other) {
+        small_vector tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    operator std::vector<T>() const { return std::vector<T>(begin(), end()); }
+
+private:
+    T *inlineData() { return reinterpret_cast<T*>(&m_inline); }
+    bool isInline() { return m_data == inlineData(); }
+
+    void release() {
+        if(!isInline())
+            ::operator delete(m_data);
+        m_data = inlineData();
+        m_capacity = N;
+    }
+
+    // this must be empty and inline
+    void assign(const small_vector& other) {
+        reserve(other.m_size);
+        std::uninitialized_copy(other.begin(), other.end(), m_data);
+        m_size = other.m_size;
+    }
+
+    // this must be empty and inline
+    void take(small_vector& other) {
+        if(!other.isInline()) {
+            m_data = other.m_data;
+            m_capacity = other.m_capacity;
+            m_size = other.m_size;
+            other.m_data = other.inlineData();
+            other.m_capacity = N;
+            other.m_size = 0;
+            return;
+        }
+        for(size_type i = 0; i < other.m_size; ++i)
+            new(m_data + i) T(std::move(other.m_data[i]));
+        m_size = other.m_size;
+        other.clear();
+    }
+
+    T *m_data;
+    size_type m_size;
+    size_type m_capacity;
+    typename std::aligned_storage<sizeof(T) * N, std::alignment_of<T>::value>::type m_inline;
+};
+
+}
+
+namespace std {
+template<class T, int N, class U> void swap(stdext::small_vector<T,N,U>& lhs, stdext::small_vector<T,N,U>& rhs) { lhs.swap(rhs); }
+}
+
+#endif
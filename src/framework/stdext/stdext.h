@@ -40,5 +40,6 @@
 #include "packed_storage.h"
 #include "format.h"
 #include "packed_vector.h"
+#include "small_vector.h"
 
 #endif
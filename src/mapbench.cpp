@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2010-2015 OTClient <https://github.com/edubart/otclient>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <framework/core/application.h>
+#include <framework/core/resourcemanager.h>
+#include <framework/core/asyncdispatcher.h>
+#include <framework/core/eventdispatcher.h>
+#include <client/client.h>
+#include <client/mapbenchmark.h>
+
+// counts every heap allocation of the process for the reports
+void *operator new(size_t size)
+{
+    g_mapBenchmarkAllocations++;
+    if(void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+int main(int argc, const char* argv[])
+{
+    std::vector<std::string> args(argv, argv + argc);
+
+    // setup application name and version
+    g_app.setName("OTClient Map Benchmark");
+    g_app.setCompactName("otclient");
+    g_app.setVersion(VERSION);
+
+    // the benchmark is headless, so only the non graphical part of the framework is initialized
+    g_app.Application::init(args);
+    g_client.init(args);
+
+    if(!g_resources.setupUserWriteDir(g_app.getCompactName()))
+        g_logger.fatal("Unable to setup write directory.");
+
+    MapBenchmarkFixture fixture;
+    std::vector<int> threadCounts = { 1, 2, 4, 8 };
+    std::vector<std::string> placements = { "free" };
+    std::string dir = "/mapbench";
+    std::string output;
+    std::string golden = "/mapbench/golden.txt";
+    bool generate = false;
+    bool verify = false;
+    bool updateGolden = false;
+    int verifyThreads = 16;
+    int verifyRounds = 4;
+    bool indexBench = false;
+    int indexRounds = 10;
+    int clientVersion = MAPBENCH_CLIENT_VERSION;
+    bool pathBench = false;
+    int paths = 1000;
+    int pathComplexity = 50000;
+    bool loadBench = false;
+    int loadRounds = 3;
+
+    for(uint i = 1; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        const std::string value = i + 1 < args.size() ? args[i + 1] : std::string();
+        if(arg == "-generate") {
+            generate = true;
+            continue;
+        } else if(arg == "-verify") {
+            verify = true;
+            continue;
+        } else if(arg == "-update-golden") {
+            verify = updateGolden = true;
+            continue;
+        } else if(arg == "-index-bench") {
+            indexBench = true;
+            continue;
+        } else if(arg == "-path-bench") {
+            pathBench = true;
+            continue;
+        } else if(arg == "-load-bench") {
+            loadBench = true;
+            continue;
+        } else if(arg == "-load-rounds")
+            loadRounds = stdext::unsafe_cast<int>(value);
+        else if(arg == "-paths")
+            paths = stdext::unsafe_cast<int>(value);
+        else if(arg == "-path-complexity")
+            pathComplexity = stdext::unsafe_cast<int>(value);
+        else if(arg == "-index-rounds")
+            indexRounds = stdext::unsafe_cast<int>(value);
+        else if(arg == "-client-version")
+            clientVersion = stdext::unsafe_cast<int>(value);
+        else if(arg == "-golden")
+            golden = value;
+        else if(arg == "-verify-threads")
+            verifyThreads = stdext::unsafe_cast<int>(value);
+        else if(arg == "-verify-rounds")
+            verifyRounds = stdext::unsafe_cast<int>(value);
+        else if(arg == "-width")
+            fixture.width = stdext::unsafe_cast<int>(value);
+        else if(arg == "-height")
+            fixture.height = stdext::unsafe_cast<int>(value);
+        else if(arg == "-floors")
+            fixture.floors = stdext::unsafe_cast<int>(value);
+        else if(arg == "-seed")
+            fixture.seed = stdext::unsafe_cast<uint32>(value);
+        else if(arg == "-dir")
+            dir = value;
+        else if(arg == "-output")
+            output = value;
+        else if(arg == "-threads") {
+            threadCounts.clear();
+            for(const std::string& count : stdext::split(value, ","))
+                threadCounts.push_back(stdext::unsafe_cast<int>(count));
+        } else if(arg == "-placement")
+            placements = stdext::split(value, ",");
+        else {
+            stdext::print("Usage: ", args[0], " [options]\n"
+                "Options:\n"
+                "  -generate          Regenerate the synthetic fixture before running\n"
+                "  -width <tiles>     Fixture width (default 256)\n"
+                "  -height <tiles>    Fixture height (default 256)\n"
+                "  -floors <count>    Fixture floors counting up from the ground floor (default 2)\n"
+                "  -seed <number>     Fixture random seed (default 1)\n"
+                "  -threads <list>    Comma separated render thread counts (default 1,2,4,8)\n"
+                "  -placement <list>  Comma separated thread placements measured for every thread count: free, pinned\n"
+                "                     (threads pinned to cpus of one numa node after another, contiguous chunk ranges)\n"
+                "                     and numa (pinned, sprites copied to every numa node) (default free)\n"
+                "  -dir <path>        Fixture directory inside the write directory (default /mapbench)\n"
+                "  -output <file>     Also write the json report to this file\n"
+                "  -verify            Compare chunk pixel digests against the golden file instead of benchmarking\n"
+                "  -update-golden     Record the golden file from a single threaded render\n"
+                "  -golden <file>     Golden digests file, a plain file like tools/mapbench/golden.txt or a file of the\n"
+                "                     write directory (default /mapbench/golden.txt)\n"
+                "  -verify-threads <count>  Threads used to check parallel renders (default 16)\n"
+                "  -verify-rounds <count>   Parallel renders compared against the single threaded one (default 4)\n"
+                "  -index-bench       Compare tile lookups of the hash and paged tile index on Tibia.dat, items.otb and map.otbm of -dir\n"
+                "  -index-rounds <count>    Lookup passes over every tile and its neighbours (default 10)\n"
+                "  -client-version <version> Client version of the -index-bench and -load-bench files (default 1076)\n"
+                "  -path-bench        Measure paths per second of the path finder on the ground floor of the fixture\n"
+                "  -paths <count>     Random paths searched by -path-bench (default 1000)\n"
+                "  -path-complexity <nodes> Node limit of every path search (default 50000)\n"
+                "  -load-bench        Compare otbm load and clean times and allocations of heap and arena allocated tiles and items, then save the map as otbm and otcm\n"
+                "  -load-rounds <count>     Loads of map.otbm of -dir measured in every mode (default 3)");
+            return 1;
+        }
+        ++i;
+    }
+
+    if(generate || !g_resources.fileExists(dir + "/map.otbm"))
+        g_mapBenchmark.generateFixture(dir, fixture);
+
+    int ret = 0;
+    if(indexBench || pathBench || loadBench) {
+        std::string report;
+        if(indexBench)
+            report = g_mapBenchmark.benchmarkTileIndex(dir, clientVersion, indexRounds);
+        else if(pathBench)
+            report = g_mapBenchmark.benchmarkPathFinding(dir, paths, pathComplexity);
+        else
+            report = g_mapBenchmark.benchmarkMapLoading(dir, clientVersion, loadRounds);
+        if(!report.empty()) {
+            stdext::print(report);
+            if(!output.empty())
+                g_resources.writeFileContents(output, report + "\n");
+        } else
+            ret = 1;
+    } else if(verify) {
+        if(!g_mapBenchmark.verify(dir, golden, updateGolden, verifyThreads, verifyRounds))
+            ret = 1;
+    } else {
+        std::string report = g_mapBenchmark.run(dir, threadCounts, placements);
+        if(!report.empty()) {
+            stdext::print(report);
+            if(!output.empty())
+                g_resources.writeFileContents(output, report + "\n");
+        } else
+            ret = 1;
+    }
+
+    // Application::deinit polls the window, which is never created here
+    g_asyncDispatcher.terminate();
+    g_dispatcher.shutdown();
+
+    g_client.terminate();
+    g_app.Application::terminate();
+    return ret;
+}